@@ -0,0 +1,169 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+
+#include "fuzz.h"
+
+/*
+ * Runs fuzz targets over files and directories of inputs (or over stdin) when
+ * libFuzzer is not used, e.g. to replay the corpus or with AFL. Options are
+ * compatible with libFuzzer: -timeout=N sets time budget of each input in
+ * seconds, other options are ignored
+ */
+#define DRIVER_MAX_INPUT (16 * 1024 * 1024)
+
+static const char *cur_input;
+
+static void
+driver_timeout(int sig)
+{
+	static const char msg[] = "timeout exceeded for input: ";
+
+	(void)sig;
+	write(STDERR_FILENO, msg, sizeof(msg) - 1);
+	write(STDERR_FILENO, cur_input, strlen(cur_input));
+	write(STDERR_FILENO, "\n", 1);
+	abort();
+}
+
+static int
+driver_run_fd(int fd, const char *name, unsigned int timeout)
+{
+	unsigned char *buf;
+	size_t len = 0;
+	ssize_t r;
+
+	buf = malloc(DRIVER_MAX_INPUT);
+
+	if (buf == NULL) {
+		return (-1);
+	}
+
+	while (len < DRIVER_MAX_INPUT &&
+			(r = read(fd, buf + len, DRIVER_MAX_INPUT - len)) > 0) {
+		len += r;
+	}
+
+	cur_input = name;
+	alarm(timeout);
+	LLVMFuzzerTestOneInput(buf, len);
+	alarm(0);
+	free(buf);
+
+	return (0);
+}
+
+static int
+driver_run_path(const char *path, unsigned int timeout)
+{
+	char sub[PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+	FILE *f;
+	int ret = 0;
+
+	if (stat(path, &st) == -1) {
+		perror(path);
+		return (-1);
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		d = opendir(path);
+
+		if (d == NULL) {
+			perror(path);
+			return (-1);
+		}
+
+		while ((de = readdir(d)) != NULL) {
+			if (de->d_name[0] == '.') {
+				continue;
+			}
+
+			snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+
+			if (driver_run_path(sub, timeout) == -1) {
+				ret = -1;
+			}
+		}
+
+		closedir(d);
+
+		return (ret);
+	}
+
+	f = fopen(path, "r");
+
+	if (f == NULL) {
+		perror(path);
+		return (-1);
+	}
+
+	ret = driver_run_fd(fileno(f), path, timeout);
+	fclose(f);
+
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int timeout = 0, ninputs = 0;
+	int i, ret = 0;
+
+	signal(SIGALRM, driver_timeout);
+
+	for (i = 1; i < argc; i ++) {
+		if (strncmp(argv[i], "-timeout=", sizeof("-timeout=") - 1) == 0) {
+			timeout = strtoul(argv[i] + sizeof("-timeout=") - 1, NULL, 10);
+		}
+		else if (argv[i][0] != '-') {
+			ninputs ++;
+		}
+	}
+
+	for (i = 1; i < argc; i ++) {
+		if (argv[i][0] != '-' && driver_run_path(argv[i], timeout) == -1) {
+			ret = 1;
+		}
+	}
+
+	if (ninputs == 0) {
+		ret = driver_run_fd(STDIN_FILENO, "<stdin>", timeout) == -1;
+	}
+
+	return (ret);
+}
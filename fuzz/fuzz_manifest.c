@@ -0,0 +1,91 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asignify.h"
+#include "asignify_internal.h"
+#include "fuzz.h"
+
+/*
+ * Drives the digests list parser with the same limits a verifier would apply
+ */
+struct fuzz_manifest {
+	unsigned int nentries;
+	unsigned int sum;
+};
+
+static bool
+fuzz_manifest_cb(const char *fname, size_t fnlen,
+	enum asignify_digest_type type, const char *value, size_t vlen, void *ud)
+{
+	struct fuzz_manifest *st = ud;
+	size_t i;
+
+	if (++st->nentries > FUZZ_MAX_ENTRIES || fnlen > FUZZ_MAX_PATH ||
+			type >= ASIGNIFY_DIGEST_MAX) {
+		return (false);
+	}
+
+	/* Touch every byte, so sanitizers catch spans outside of the input */
+	for (i = 0; i < fnlen; i ++) {
+		st->sum += (unsigned char)fname[i];
+	}
+
+	for (i = 0; i < vlen; i ++) {
+		st->sum += (unsigned char)value[i];
+	}
+
+	if (type < ASIGNIFY_DIGEST_SIZE &&
+			vlen != asignify_digest_len(type) * 2) {
+		return (false);
+	}
+
+	return (true);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct fuzz_manifest st = { 0, 0 };
+	char *buf;
+
+	/* Copy the input, so reads past its end are detected */
+	buf = malloc(size > 0 ? size : 1);
+
+	if (buf == NULL) {
+		abort();
+	}
+
+	memcpy(buf, data, size);
+	asignify_manifest_parse(buf, size, fuzz_manifest_cb, &st);
+	free(buf);
+
+	return (0);
+}
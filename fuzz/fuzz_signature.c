@@ -0,0 +1,186 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asignify.h"
+#include "asignify_internal.h"
+#include "tweetnacl.h"
+#include "fuzz.h"
+
+/*
+ * Loads signatures with limits set. Random data almost never passes the
+ * signature check, so inputs are signed by a key generated on start and only
+ * inputs starting with FUZZ_RAW are loaded as they are to test signature lines
+ */
+#define FUZZ_RAW "#raw\n"
+
+static struct asignify_private_data fuzz_privk;
+static char *fuzz_pubkey;
+static size_t fuzz_pubkey_len;
+
+static void
+fuzz_keys_init(void)
+{
+	struct asignify_public_data pubk;
+	static unsigned char pk[crypto_sign_PUBLICKEYBYTES],
+		sk[crypto_sign_SECRETKEYBYTES], id[KEY_ID_LEN];
+	FILE *f;
+
+	crypto_sign_keypair(pk, sk);
+	memset(id, 0x5a, sizeof(id));
+
+	fuzz_privk.data = sk;
+	fuzz_privk.data_len = sizeof(sk);
+	fuzz_privk.id = id;
+	fuzz_privk.id_len = sizeof(id);
+	fuzz_privk.version = 1;
+
+	memset(&pubk, 0, sizeof(pubk));
+	pubk.data = pk;
+	pubk.data_len = sizeof(pk);
+	pubk.id = id;
+	pubk.id_len = sizeof(id);
+	pubk.version = 1;
+
+	f = open_memstream(&fuzz_pubkey, &fuzz_pubkey_len);
+
+	if (f == NULL || !asignify_pubkey_write(&pubk, f) || fclose(f) != 0) {
+		abort();
+	}
+}
+
+struct fuzz_data {
+	const uint8_t *data;
+	size_t size;
+};
+
+static bool
+fuzz_sign_reader(struct asignify_digest_ctx *dig, void *ud)
+{
+	struct fuzz_data *fd = ud;
+
+	asignify_digest_update(dig, fd->data, fd->size);
+
+	return (true);
+}
+
+/* Returns signature file for data signed by the fuzzing key */
+static char *
+fuzz_sign(const uint8_t *data, size_t size, size_t *outlen)
+{
+	struct asignify_public_data *sig;
+	struct fuzz_data fd;
+	enum asignify_error err;
+	char *out = NULL;
+	FILE *f;
+	bool ret;
+
+	fd.data = data;
+	fd.size = size;
+	sig = asignify_private_data_sign_stream(&fuzz_privk, fuzz_sign_reader,
+		&fd, &err);
+	f = open_memstream(&out, outlen);
+
+	if (sig == NULL || f == NULL) {
+		abort();
+	}
+
+	/* Empty data cannot be written */
+	ret = asignify_signature_write(sig, data, size, f);
+
+	if (fclose(f) != 0) {
+		abort();
+	}
+
+	asignify_public_data_free(sig);
+
+	if (!ret) {
+		free(out);
+		out = NULL;
+	}
+
+	return (out);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	asignify_verify_t *vrf;
+	char *buf;
+	size_t len;
+	bool signed_input;
+
+	if (fuzz_pubkey == NULL) {
+		fuzz_keys_init();
+	}
+
+	signed_input = size < sizeof(FUZZ_RAW) - 1 ||
+		memcmp(data, FUZZ_RAW, sizeof(FUZZ_RAW) - 1) != 0;
+
+	if (signed_input) {
+		buf = fuzz_sign(data, size, &len);
+
+		if (buf == NULL) {
+			return (0);
+		}
+	}
+	else {
+		/* Copy the input, so reads past its end are detected */
+		len = size - (sizeof(FUZZ_RAW) - 1);
+		buf = xmalloc(len > 0 ? len : 1);
+		memcpy(buf, data + sizeof(FUZZ_RAW) - 1, len);
+	}
+
+	vrf = asignify_verify_init();
+	asignify_verify_set_limits(vrf, FUZZ_MAX_MEMORY, FUZZ_MAX_ENTRIES,
+		FUZZ_MAX_PATH);
+
+	if (!asignify_verify_load_pubkey_buf(vrf, fuzz_pubkey, fuzz_pubkey_len)) {
+		abort();
+	}
+
+	if (!asignify_verify_load_signature_buf(vrf, buf, len)) {
+		/* Data signed here must reach the digests parser */
+		if (signed_input && strcmp(asignify_verify_get_error(vrf),
+				xerr_string(ASIGNIFY_ERROR_VERIFY)) == 0) {
+			abort();
+		}
+	}
+	else {
+		/* Look up a file, the result does not matter */
+		asignify_verify_file(vrf, "/nonexistent");
+	}
+
+	asignify_verify_free(vrf);
+	free(buf);
+
+	return (0);
+}
@@ -29,6 +29,8 @@
 #include <stddef.h>
 
 #define PBKDF_MINROUNDS 10000
+/* Maximum number of reads kept in flight, see asignify_set_io_params */
+#define ASIGNIFY_IO_MAX_DEPTH 64
 
 #if defined(__cplusplus)
 extern "C" {
@@ -40,9 +42,11 @@ extern "C" {
 struct asignify_verify_ctx;
 struct asignify_sign_ctx;
 struct asignify_encrypt_ctx;
+struct asignify_cancel;
 typedef struct asignify_verify_ctx asignify_verify_t;
 typedef struct asignify_sign_ctx asignify_sign_t;
 typedef struct asignify_encrypt_ctx asignify_encrypt_t;
+typedef struct asignify_cancel asignify_cancel_t;
 
 typedef int (*asignify_password_cb)(char *buf, size_t len, void *d);
 
@@ -54,7 +58,22 @@ enum asignify_digest_type {
 	ASIGNIFY_DIGEST_SHA512,
 	ASIGNIFY_DIGEST_BLAKE2,
 	ASIGNIFY_DIGEST_SIZE,
-	ASIGNIFY_DIGEST_MAX
+	ASIGNIFY_DIGEST_MTIME, /* modification time hint, it is not verified */
+	ASIGNIFY_DIGEST_MAX /* changed in library version 3, do not store it */
+};
+
+/* Bit of a digest type in masks of digest types */
+#define ASIGNIFY_DIGEST_BIT(type) (1U << (type))
+/* Length of the longest digest */
+#define ASIGNIFY_DIGEST_MAX_LEN 64
+
+/**
+ * Which of the digests recorded for a file are checked
+ */
+enum asignify_digest_policy {
+	ASIGNIFY_DIGEST_POLICY_ALL = 0, /* every recorded digest (default) */
+	ASIGNIFY_DIGEST_POLICY_FASTEST, /* the fastest one on this host */
+	ASIGNIFY_DIGEST_POLICY_PREFER /* the preferred one if recorded, the fastest otherwise */
 };
 
 /**
@@ -62,7 +81,8 @@ enum asignify_digest_type {
  */
 enum asignify_encrypt_type {
 	ASIGNIFY_ENCRYPT_SAFE = 0,
-	ASIGNIFY_ENCRYPT_FAST
+	ASIGNIFY_ENCRYPT_FAST,
+	ASIGNIFY_ENCRYPT_AESGCM
 };
 
 /**
@@ -79,6 +99,24 @@ asignify_verify_t* asignify_verify_init(void);
  */
 bool asignify_verify_load_pubkey(asignify_verify_t *ctx, const char *pubf);
 
+/**
+ * Load public key from a memory buffer
+ * @param ctx verify context
+ * @param buf public key data (NUL termination is not required)
+ * @param len length of data
+ * @return true if a key has been successfully loaded
+ */
+bool asignify_verify_load_pubkey_buf(asignify_verify_t *ctx, const char *buf,
+	size_t len);
+
+/**
+ * Load public keys compiled into the library (configured with
+ * `--with-trust-anchor`)
+ * @param ctx verify context
+ * @return true if at least one key has been loaded
+ */
+bool asignify_verify_load_builtin_pubkeys(asignify_verify_t *ctx);
+
 /**
  * Load and parse signature file
  * @param ctx verify context
@@ -87,6 +125,16 @@ bool asignify_verify_load_pubkey(asignify_verify_t *ctx, const char *pubf);
  */
 bool asignify_verify_load_signature(asignify_verify_t *ctx, const char *sigf);
 
+/**
+ * Load and parse signature from a memory buffer
+ * @param ctx verify context
+ * @param buf signature data (NUL termination is not required)
+ * @param len length of data
+ * @return true if a signature has been successfully loaded
+ */
+bool asignify_verify_load_signature_buf(asignify_verify_t *ctx, const char *buf,
+	size_t len);
+
 /**
  * Verify file against parsed signature and pubkey
  * @param ctx verify context
@@ -95,6 +143,188 @@ bool asignify_verify_load_signature(asignify_verify_t *ctx, const char *sigf);
  */
 bool asignify_verify_file(asignify_verify_t *ctx, const char *checkf);
 
+/**
+ * Identity of a file on a local volume: a file with the same identity is
+ * assumed to have the same content
+ */
+struct asignify_file_id {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime;
+	int64_t ctime;
+};
+
+/**
+ * Result of a file check
+ */
+struct asignify_verify_result {
+	const char *error; /**< NULL if the file is valid, error message otherwise */
+	uint64_t size; /**< number of bytes checked (of uncompressed data if any) */
+	bool attested; /**< file has been accepted by an attestation without hashing */
+	bool has_id; /**< id of a valid regular file is set unless it has been modified since the check start */
+	struct asignify_file_id id; /**< identity of a file as it has been checked */
+};
+
+/**
+ * Reentrant version of asignify_verify_file: once keys and signatures are
+ * loaded, a context is not modified by this function, so it can be shared
+ * by any number of threads without locking (other functions must not be
+ * called for the context concurrently)
+ * @param ctx verify context
+ * @param checkf file name or '-' to read from stdin
+ * @param res result of check (may be NULL)
+ * @return true if a file is valid
+ */
+bool asignify_verify_file_r(const asignify_verify_t *ctx, const char *checkf,
+	struct asignify_verify_result *res);
+
+/**
+ * Digests of a file computed by a single read pass
+ */
+struct asignify_file_digests {
+	unsigned int types; /**< ASIGNIFY_DIGEST_BIT mask of digests set below */
+	unsigned char digest[ASIGNIFY_DIGEST_SIZE][ASIGNIFY_DIGEST_MAX_LEN];
+};
+
+/**
+ * Reentrant version of asignify_verify_file that returns digests of a valid
+ * file, so callers do not need to hash it again. Extra digests are computed
+ * in the same read pass unless they are recorded in signatures: recorded
+ * digests of a valid file are returned as recorded (all of them are signed)
+ * @param ctx verify context
+ * @param checkf file name or '-' to read from stdin
+ * @param extra ASIGNIFY_DIGEST_BIT mask of digests to return in addition to
+ * recorded ones (e.g. ASIGNIFY_DIGEST_BIT(ASIGNIFY_DIGEST_BLAKE2))
+ * @param res result of check (may be NULL)
+ * @param digests digests of a valid file (may be NULL)
+ * @return true if a file is valid
+ */
+bool asignify_verify_file_digests(const asignify_verify_t *ctx,
+	const char *checkf, unsigned int extra, struct asignify_verify_result *res,
+	struct asignify_file_digests *digests);
+
+/**
+ * Check a signature file against loaded public keys without loading its
+ * digests: like asignify_verify_file_r, this function does not modify ctx
+ * @param ctx verify context
+ * @param sigf file name or '-' to read from stdin
+ * @param res result of check, size is the size of signature (may be NULL)
+ * @return true if a signature is valid
+ */
+bool asignify_verify_signature_r(const asignify_verify_t *ctx,
+	const char *sigf, struct asignify_verify_result *res);
+
+/**
+ * Check many signature files against loaded public keys: signatures are
+ * read, hashed and verified by a pool of threads
+ * @param ctx verify context
+ * @param sigs signature file names
+ * @param n number of signatures
+ * @param nthreads number of threads (0 for all online CPUs)
+ * @param results array of n results, error of a valid signature is NULL
+ * @return number of valid signatures
+ */
+size_t asignify_verify_signatures(const asignify_verify_t *ctx,
+	const char **sigs, size_t n, unsigned int nthreads,
+	struct asignify_verify_result *results);
+
+/**
+ * Get digest of all signatures loaded to the context, attestations made for
+ * these signatures are bound to it
+ * @param ctx verify context
+ * @param len returned length of digest
+ * @return digest or NULL if no signatures are loaded
+ */
+const unsigned char* asignify_verify_get_signatures_digest(
+	asignify_verify_t *ctx, size_t *len);
+
+/**
+ * Load attestation of files checked for the same signatures (e.g. by an
+ * earlier stage of a pipeline). Files listed in an attestation are accepted
+ * without hashing while their identity (device, inode, size, mtime and ctime)
+ * is unchanged. Must be called after all signatures are loaded, attestations
+ * made for other signatures fail to load with "signature verification error"
+ * @param ctx verify context
+ * @param pubf public key of the attesting verifier
+ * @param attf attestation file name
+ * @return true if an attestation has been successfully loaded
+ */
+bool asignify_verify_load_attestation(asignify_verify_t *ctx,
+	const char *pubf, const char *attf);
+
+/**
+ * Apply signed delta to a local copy of the base signature. The delta must be
+ * signed by a loaded key and made for exactly this base, the result is checked
+ * to match the target signature the delta has been made for and it is written
+ * with the target signature lines, so it can be loaded as usual
+ * @param ctx verify context
+ * @param basef base signature file name
+ * @param deltaf delta file name
+ * @param outf output file name for the target signature (may be basef)
+ * @return true if a target signature has been successfully written
+ */
+bool asignify_verify_apply_delta(asignify_verify_t *ctx, const char *basef,
+	const char *deltaf, const char *outf);
+
+/**
+ * Attach cancellation token to verify context, files being verified fail with
+ * "operation cancelled" error once the token fires
+ * @param ctx verify context
+ * @param c cancellation token or NULL to detach
+ */
+void asignify_verify_set_cancel(asignify_verify_t *ctx,
+	const asignify_cancel_t *c);
+
+/**
+ * Bound resources spent on parsing of untrusted signatures: signatures and
+ * digests lists exceeding limits fail to load with "incorrect data format" (or
+ * "size mismatch" for too large signatures)
+ * @param ctx verify context
+ * @param max_memory maximum memory for signature bodies and digests loaded
+ * @param max_entries maximum number of digest lines in all signatures loaded
+ * @param max_path maximum length of a file name in digests lists
+ * (zero means no limit for all values)
+ */
+void asignify_verify_set_limits(asignify_verify_t *ctx, size_t max_memory,
+	unsigned int max_entries, unsigned int max_path);
+
+/**
+ * Allow checking of compressed files: if a file named `name.gz` or `name.zst`
+ * has no digests, it is decompressed in memory and checked against digests
+ * and size of `name` (formats not supported by the library fail to verify)
+ * @param ctx verify context
+ * @param decompress true to enable transparent decompression
+ */
+void asignify_verify_set_decompress(asignify_verify_t *ctx, bool decompress);
+
+/**
+ * Select digests checked when several digests are recorded for a file, e.g.
+ * to skip SHA512 recorded for legacy consumers when BLAKE2 is also present.
+ * Any single digest is sufficient as all digests are signed, and digests
+ * are ranked by speed measured for the backends of this host
+ * @param ctx verify context
+ * @param policy digest policy
+ * @param prefer preferred digest type for ASIGNIFY_DIGEST_POLICY_PREFER
+ */
+void asignify_verify_set_digest_policy(asignify_verify_t *ctx,
+	enum asignify_digest_policy policy, enum asignify_digest_type prefer);
+
+/**
+ * Verify a signed tree head of an append-only log. If the previous head is
+ * specified, it must be signed by a loaded key as well and only the data
+ * appended since it (and its incomplete last segment) is read, otherwise the
+ * whole log is hashed. Log must be named as in the head and may have grown
+ * after the head has been signed
+ * @param ctx verify context
+ * @param logf log file name
+ * @param headf signed tree head file name
+ * @param prevf previous signed tree head file name or NULL
+ * @return true if a log matches head and head is consistent with prevf
+ */
+bool asignify_verify_log(asignify_verify_t *ctx, const char *logf,
+	const char *headf, const char *prevf);
+
 /**
  * Returns last error for verify context
  * @param ctx verify context
@@ -135,6 +365,77 @@ bool asignify_sign_load_privkey(asignify_sign_t *ctx, const char *privf,
 bool asignify_sign_add_file(asignify_sign_t *ctx, const char *f,
 	enum asignify_digest_type dt);
 
+/**
+ * Add digests of a file to the signature context computing all of them by a
+ * single read of the file, and return computed digests to the caller
+ * @param ctx sign context
+ * @param f file name or '-' to read from stdin
+ * @param types ASIGNIFY_DIGEST_BIT mask of digests to add (SIZE and MTIME
+ * must be added by asignify_sign_add_file)
+ * @param extra ASIGNIFY_DIGEST_BIT mask of digests that are computed in the
+ * same pass and returned without being added
+ * @param digests digests of types and extra (may be NULL)
+ * @return true if a file is valid
+ */
+bool asignify_sign_add_file_digests(asignify_sign_t *ctx, const char *f,
+	unsigned int types, unsigned int extra,
+	struct asignify_file_digests *digests);
+
+/**
+ * Update a signature made by the same key: its entries are added to the new
+ * signature unless files are added again. Files that are added again are
+ * rehashed only if their size or modification time differs from SIZE and
+ * MTIME lines of the old signature (see ASIGNIFY_DIGEST_MTIME). Private key
+ * must be loaded before calling this function
+ * @param ctx sign context
+ * @param sigf old signature file name or '-' to read from stdin
+ * @return true if the old signature is valid
+ */
+bool asignify_sign_load_update(asignify_sign_t *ctx, const char *sigf);
+
+/**
+ * Add digests lines from a digests file (e.g. produced by
+ * `asignify_sign_write_digests` on another host) to the signature context.
+ * Lines are validated and rewritten in the canonical form; in sorted mode
+ * duplicate lines are merged and different digests of the same type for the
+ * same file are rejected when the signature is written
+ * @param ctx sign context
+ * @param digestsf file name or '-' to read from stdin
+ * @return true if all lines are valid
+ */
+bool asignify_sign_add_digests(asignify_sign_t *ctx, const char *digestsf);
+
+/**
+ * Write digests of this context without signing them, so no private key
+ * is required
+ * @param ctx sign context
+ * @param outf file name or '-' to write to stdout
+ * @return true if digests have been successfully written
+ */
+bool asignify_sign_write_digests(asignify_sign_t *ctx, const char *outf);
+
+/**
+ * Write digests sorted by file names. Sorting is performed in bounded memory:
+ * when digests exceed the limit, they are spilled to sorted temporary files
+ * that are merged when the signature is written. Must be called before adding
+ * files.
+ * @param ctx sign context
+ * @param memlimit memory limit in bytes (0 for the default: 64Mb)
+ * @param tmpdir directory for temporary files (NULL to use $TMPDIR or /tmp)
+ * @return true if sorting has been enabled
+ */
+bool asignify_sign_set_sorted(asignify_sign_t *ctx, size_t memlimit,
+	const char *tmpdir);
+
+/**
+ * Attach cancellation token to sign context, files being added fail with
+ * "operation cancelled" error once the token fires
+ * @param ctx sign context
+ * @param c cancellation token or NULL to detach
+ */
+void asignify_sign_set_cancel(asignify_sign_t *ctx,
+	const asignify_cancel_t *c);
+
 /**
  * Write the complete signature for this context
  * @param ctx sign context
@@ -143,6 +444,61 @@ bool asignify_sign_add_file(asignify_sign_t *ctx, const char *f,
  */
 bool asignify_sign_write_signature(asignify_sign_t *ctx, const char *sigf);
 
+/**
+ * Sign a tree head of an append-only log: log is split to segments that are
+ * hashed to a Merkle tree. If the previous head is specified, it is checked
+ * to be signed by the same key and the new head is built from it by hashing
+ * only the data appended since it, so the log must not be modified but
+ * appended. Private key must be loaded before calling this function
+ * @param ctx sign context
+ * @param logf log file name
+ * @param headf output file name for the signed tree head
+ * @param prevf previous signed tree head file name or NULL
+ * @param segment size of segments, 0 means default (ignored if prevf is set)
+ * @param records if true, segments end by the first newline after segment
+ * bytes, so records are never split (ignored if prevf is set)
+ * @return true if a head has been successfully written
+ */
+bool asignify_sign_log(asignify_sign_t *ctx, const char *logf,
+	const char *headf, const char *prevf, size_t segment, bool records);
+
+/**
+ * Write signed delta between two signatures made by this context key, so
+ * clients having the base signature can get the target one by applying the
+ * delta (see asignify_verify_apply_delta). Delta is the smallest for sorted
+ * signatures. Private key must be loaded before calling this function
+ * @param ctx sign context
+ * @param basef base signature file name
+ * @param targetf target signature file name
+ * @param deltaf output file name for the delta or '-' to write to stdout
+ * @return true if a delta has been successfully written
+ */
+bool asignify_sign_delta(asignify_sign_t *ctx, const char *basef,
+	const char *targetf, const char *deltaf);
+
+/**
+ * Add a checked file to the attestation made by this context
+ * @param ctx sign context
+ * @param name file name as it is listed in signatures
+ * @param id identity of a file (see asignify_verify_result)
+ * @return true if a file has been added
+ */
+bool asignify_sign_attest_file(asignify_sign_t *ctx, const char *name,
+	const struct asignify_file_id *id);
+
+/**
+ * Write signed attestation of all files added by asignify_sign_attest_file,
+ * private key must be loaded before calling this function
+ * @param ctx sign context
+ * @param attf output file name or '-' to write to stdout
+ * @param sigdigest digest of signatures files were checked against
+ * (see asignify_verify_get_signatures_digest)
+ * @param len length of digest
+ * @return true if an attestation has been successfully written
+ */
+bool asignify_sign_write_attestation(asignify_sign_t *ctx, const char *attf,
+	const unsigned char *sigdigest, size_t len);
+
 /**
  * Returns last error for sign context
  * @param ctx sign context
@@ -210,6 +566,62 @@ const char * asignify_digest_name(enum asignify_digest_type type);
  */
 unsigned char* asignify_digest_fd(enum asignify_digest_type type, int fd);
 
+/**
+ * Tune reading of large files. This function should be called before any
+ * other function of the library and is not thread safe.
+ * @param depth number of reads kept in flight for a single regular file, it is
+ * useful to increase this value for high latency filesystems, such as NFS
+ * (0 to keep the current value, default: 1, at most ASIGNIFY_IO_MAX_DEPTH)
+ * @param block_size size of each read in bytes, rounded down to a power of two
+ * (0 to keep the current value, default: 1Mb)
+ */
+void asignify_set_io_params(unsigned int depth, size_t block_size);
+
+/**
+ * Write large outputs (e.g. of encryption) bypassing the page cache with
+ * O_DIRECT, so writing of huge files does not evict other data from the
+ * cache. Filesystems without direct I/O support fall back to normal writes.
+ * This function should be called before any other function of the library
+ * and is not thread safe.
+ * @param direct true to use direct I/O for regular output files
+ */
+void asignify_set_io_direct(bool direct);
+
+/**
+ * Create new cancellation token. A token can be shared by several contexts,
+ * long operations check it between I/O buffers and fail once it fires.
+ * @return new cancellation token
+ */
+asignify_cancel_t* asignify_cancel_init(void);
+
+/**
+ * Fire cancellation token. This function is safe to call from other threads
+ * and from signal handlers.
+ * @param c cancellation token
+ */
+void asignify_cancel_trigger(asignify_cancel_t *c);
+
+/**
+ * Set deadline for a cancellation token: it fires when the specified time has
+ * passed (measured by a monotonic clock)
+ * @param c cancellation token
+ * @param msec timeout in milliseconds from now (0 to remove the deadline)
+ */
+void asignify_cancel_set_timeout(asignify_cancel_t *c, unsigned int msec);
+
+/**
+ * Check cancellation token
+ * @param c cancellation token (NULL never fires)
+ * @return true if the token has been triggered or its deadline has passed
+ */
+bool asignify_cancel_check(const asignify_cancel_t *c);
+
+/**
+ * Free cancellation token, it must not be used by any context afterwards
+ * @param c cancellation token
+ */
+void asignify_cancel_free(asignify_cancel_t *c);
+
 /**
  * Parse string and returns the digest type
  * @param data string to parse
@@ -259,11 +671,16 @@ bool asignify_encrypt_load_privkey(asignify_encrypt_t *ctx, const char *privf,
 	asignify_password_cb password_cb, void *d);
 
 /**
- * Encrypt and sign the specified file using remote pubkey and local privkey
+ * Encrypt and sign the specified file using remote pubkey and local privkey.
+ * ASIGNIFY_ENCRYPT_AESGCM files are authenticated by AES-GCM tags of each
+ * chunk and the signature covers these tags, hence they are processed in
+ * a single pass but cannot be checked without a private key
  * @param ctx encrypt context
  * @param version version of encryption
  * @param inf input file
  * @param outf output file (MUST be a regular file)
+ * @param type type of encryption (AES-GCM requires libasignify built with
+ * openssl and fails with "unsupported cipher" error otherwise)
  * @return true if input has been encrypted and signed
  */
 bool
@@ -280,6 +697,115 @@ asignify_encrypt_crypt_file(asignify_encrypt_t *ctx, unsigned int version,
 bool
 asignify_encrypt_decrypt_file(asignify_encrypt_t *ctx, const char *inf,
 	const char *outf);
+
+/**
+ * Check integrity of the specified encrypted file (or chunks index) using
+ * just the sender's public key: neither a private key nor decryption is
+ * required
+ * @param ctx encrypt context with the sender's public key loaded
+ * @param inf input file or '-' to read from stdin
+ * @return true if the signature of encrypted data is valid
+ */
+bool
+asignify_encrypt_verify_file(asignify_encrypt_t *ctx, const char *inf);
+
+/**
+ * Encrypt and sign a file in chunked mode: input is split into content defined
+ * chunks, each chunk is encrypted with a key derived from its content and
+ * the secret shared with the peer, so unchanged chunks produce identical
+ * ciphertext and are stored only once in the chunks directory
+ * @param ctx encrypt context
+ * @param version version of encryption
+ * @param inf input file or '-' to read from stdin
+ * @param indexf output file for the encrypted and signed chunks index
+ * @param chunkdir directory where encrypted chunks are stored
+ * @param type type of encryption
+ * @return true if input has been encrypted and signed
+ */
+bool
+asignify_encrypt_crypt_chunked(asignify_encrypt_t *ctx, unsigned int version,
+	const char *inf, const char *indexf, const char *chunkdir,
+	enum asignify_encrypt_type type);
+
+/**
+ * Verify and decrypt a file encrypted in chunked mode
+ * @param ctx encrypt context
+ * @param indexf encrypted chunks index
+ * @param chunkdir directory where encrypted chunks are stored
+ * @param outf output file or '-' to write to stdout
+ * @return true if all chunks have been verified and decrypted
+ */
+bool
+asignify_encrypt_decrypt_chunked(asignify_encrypt_t *ctx, const char *indexf,
+	const char *chunkdir, const char *outf);
+
+/**
+ * Encrypt and sign a file as independently authenticated volumes: each
+ * contiguous range of input is encrypted to `indexf.N` with its own key and
+ * MAC, volumes are produced concurrently by the threads set for ctx
+ * @param ctx encrypt context
+ * @param version version of encryption
+ * @param inf input file (must be a regular file)
+ * @param indexf output file for the encrypted and signed volumes index
+ * @param nvolumes number of volumes (less for inputs shorter than nvolumes)
+ * @param type type of encryption
+ * @return true if input has been encrypted and signed
+ */
+bool
+asignify_encrypt_crypt_volumes(asignify_encrypt_t *ctx, unsigned int version,
+	const char *inf, const char *indexf, unsigned int nvolumes,
+	enum asignify_encrypt_type type);
+
+/**
+ * Verify and decrypt a file encrypted as volumes, volumes are processed in
+ * parallel and output appears only if all of them are valid
+ * @param ctx encrypt context
+ * @param indexf encrypted volumes index
+ * @param volumes volume files in any order or NULL to use `indexf.N`
+ * @param nvolumes number of volume files
+ * @param outf output file (must not be '-')
+ * @return true if all volumes have been verified and decrypted
+ */
+bool
+asignify_encrypt_decrypt_volumes(asignify_encrypt_t *ctx, const char *indexf,
+	const char **volumes, unsigned int nvolumes, const char *outf);
+
+/**
+ * Check whether a file is an encrypted volumes index by its header, no keys
+ * are required and the file is not authenticated
+ * @param file file to check
+ * @return true if file should be decrypted by asignify_encrypt_decrypt_volumes
+ */
+bool asignify_encrypt_is_volume_index(const char *file);
+
+/**
+ * Select encryption type for this host: ASIGNIFY_ENCRYPT_AESGCM if it is
+ * supported and CPU has AES and carry-less multiplication instructions,
+ * ASIGNIFY_ENCRYPT_SAFE otherwise
+ * @return encryption type
+ */
+enum asignify_encrypt_type asignify_encrypt_auto_type(void);
+
+/**
+ * Use several threads for encryption and decryption of regular files. Output
+ * is the same as for a single thread (AES-GCM files always use one thread). Decrypted data is written to a temporary
+ * file that replaces the output file only if the signature is valid.
+ * @param ctx encrypt context
+ * @param nthreads number of threads (0 for the number of online CPUs, 1 to
+ * disable parallel processing which is the default)
+ */
+void asignify_encrypt_set_threads(asignify_encrypt_t *ctx,
+	unsigned int nthreads);
+
+/**
+ * Attach cancellation token to encrypt context, encryption and decryption fail
+ * with "operation cancelled" error once the token fires
+ * @param ctx encrypt context
+ * @param c cancellation token or NULL to detach
+ */
+void asignify_encrypt_set_cancel(asignify_encrypt_t *ctx,
+	const asignify_cancel_t *c);
+
 /**
  * Returns last error for encrypt context
  * @param ctx encrypt context
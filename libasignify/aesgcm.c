@@ -0,0 +1,225 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asignify_internal.h"
+
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+
+#if defined(__linux__) && defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/*
+ * AES-256-GCM by OpenSSL: it selects AES-NI and carry-less multiplication
+ * (or ARMv8 crypto extensions) at runtime and uses constant time software
+ * implementation otherwise.
+ */
+struct asignify_aesgcm {
+	EVP_CIPHER_CTX *c;
+	unsigned char nonce[ASIGNIFY_AESGCM_NONCELEN];
+	bool decrypt;
+};
+
+struct asignify_aesgcm*
+asignify_aesgcm_init(const unsigned char *key, const unsigned char *nonce,
+	bool decrypt)
+{
+	struct asignify_aesgcm *g;
+	int r;
+
+	g = xmalloc0(sizeof(*g));
+
+	if ((g->c = EVP_CIPHER_CTX_new()) == NULL) {
+		free(g);
+		return (NULL);
+	}
+
+	/* Key schedule is kept, IV is set for each chunk */
+	if (decrypt) {
+		r = EVP_DecryptInit_ex(g->c, EVP_aes_256_gcm(), NULL, key, NULL);
+	}
+	else {
+		r = EVP_EncryptInit_ex(g->c, EVP_aes_256_gcm(), NULL, key, NULL);
+	}
+
+	if (r != 1) {
+		asignify_aesgcm_free(g);
+		return (NULL);
+	}
+
+	memcpy(g->nonce, nonce, sizeof(g->nonce));
+	g->decrypt = decrypt;
+
+	return (g);
+}
+
+/*
+ * IV is the session nonce followed by the big endian chunk number, and the
+ * last chunk is marked in AAD, so chunks cannot be reordered or truncated
+ */
+static bool
+asignify_aesgcm_start(struct asignify_aesgcm *g, uint32_t counter, bool last)
+{
+	unsigned char iv[ASIGNIFY_AESGCM_NONCELEN + 4], aad = last ? 1 : 0;
+	int outl, r;
+
+	memcpy(iv, g->nonce, ASIGNIFY_AESGCM_NONCELEN);
+	iv[ASIGNIFY_AESGCM_NONCELEN] = counter >> 24;
+	iv[ASIGNIFY_AESGCM_NONCELEN + 1] = counter >> 16;
+	iv[ASIGNIFY_AESGCM_NONCELEN + 2] = counter >> 8;
+	iv[ASIGNIFY_AESGCM_NONCELEN + 3] = counter;
+
+	if (g->decrypt) {
+		r = EVP_DecryptInit_ex(g->c, NULL, NULL, NULL, iv) == 1 &&
+			EVP_DecryptUpdate(g->c, NULL, &outl, &aad, 1) == 1;
+	}
+	else {
+		r = EVP_EncryptInit_ex(g->c, NULL, NULL, NULL, iv) == 1 &&
+			EVP_EncryptUpdate(g->c, NULL, &outl, &aad, 1) == 1;
+	}
+
+	return (r);
+}
+
+bool
+asignify_aesgcm_seal(struct asignify_aesgcm *g, uint32_t counter, bool last,
+	const unsigned char *in, size_t len, unsigned char *out,
+	unsigned char *tag)
+{
+	int outl, finl;
+
+	if (g == NULL || g->decrypt || len > ASIGNIFY_AESGCM_CHUNK ||
+			!asignify_aesgcm_start(g, counter, last)) {
+		return (false);
+	}
+
+	outl = 0;
+
+	if ((len > 0 && EVP_EncryptUpdate(g->c, out, &outl, in, len) != 1) ||
+			EVP_EncryptFinal_ex(g->c, out + outl, &finl) != 1 ||
+			EVP_CIPHER_CTX_ctrl(g->c, EVP_CTRL_GCM_GET_TAG,
+			ASIGNIFY_AESGCM_TAGLEN, tag) != 1) {
+		return (false);
+	}
+
+	return (true);
+}
+
+bool
+asignify_aesgcm_open(struct asignify_aesgcm *g, uint32_t counter, bool last,
+	const unsigned char *in, size_t len, const unsigned char *tag,
+	unsigned char *out)
+{
+	int outl, finl;
+
+	if (g == NULL || !g->decrypt || len > ASIGNIFY_AESGCM_CHUNK ||
+			!asignify_aesgcm_start(g, counter, last)) {
+		return (false);
+	}
+
+	outl = 0;
+
+	if ((len > 0 && EVP_DecryptUpdate(g->c, out, &outl, in, len) != 1) ||
+			EVP_CIPHER_CTX_ctrl(g->c, EVP_CTRL_GCM_SET_TAG,
+			ASIGNIFY_AESGCM_TAGLEN, (void *)tag) != 1) {
+		return (false);
+	}
+
+	/* Plaintext must be discarded by caller if the tag is wrong */
+	return (EVP_DecryptFinal_ex(g->c, out + outl, &finl) == 1);
+}
+
+void
+asignify_aesgcm_free(struct asignify_aesgcm *g)
+{
+	if (g != NULL) {
+		EVP_CIPHER_CTX_free(g->c);
+		explicit_memzero(g->nonce, sizeof(g->nonce));
+		free(g);
+	}
+}
+
+bool
+asignify_aesgcm_accelerated(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+
+	return (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul"));
+#elif defined(__linux__) && defined(__aarch64__)
+	unsigned long hwcap = getauxval(AT_HWCAP);
+
+	return ((hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL));
+#else
+	return (false);
+#endif
+}
+
+#else
+
+struct asignify_aesgcm*
+asignify_aesgcm_init(const unsigned char *key, const unsigned char *nonce,
+	bool decrypt)
+{
+	return (NULL);
+}
+
+bool
+asignify_aesgcm_seal(struct asignify_aesgcm *g, uint32_t counter, bool last,
+	const unsigned char *in, size_t len, unsigned char *out,
+	unsigned char *tag)
+{
+	return (false);
+}
+
+bool
+asignify_aesgcm_open(struct asignify_aesgcm *g, uint32_t counter, bool last,
+	const unsigned char *in, size_t len, const unsigned char *tag,
+	unsigned char *out)
+{
+	return (false);
+}
+
+void
+asignify_aesgcm_free(struct asignify_aesgcm *g)
+{
+}
+
+bool
+asignify_aesgcm_accelerated(void)
+{
+	return (false);
+}
+
+#endif /* HAVE_OPENSSL */
@@ -0,0 +1,229 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "asignify_internal.h"
+
+#ifdef HAVE_AFALG
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+
+/*
+ * Kernel crypto API backend: file pages are spliced from the page cache
+ * into an AF_ALG hash socket, so data is never copied to userspace.
+ */
+
+#define AFALG_PIPE_SIZE (1024 * 1024)
+
+enum afalg_state {
+	AFALG_UNKNOWN = 0,
+	AFALG_AVAILABLE,
+	AFALG_UNAVAILABLE
+};
+
+static const char *afalg_names[ASIGNIFY_DIGEST_SIZE] = {
+	[ASIGNIFY_DIGEST_SHA256] = "sha256",
+	[ASIGNIFY_DIGEST_SHA512] = "sha512",
+	[ASIGNIFY_DIGEST_BLAKE2] = "blake2b-512"
+};
+
+/* Races here are harmless: the worst case is a duplicate probe */
+static enum afalg_state afalg_states[ASIGNIFY_DIGEST_SIZE];
+
+static int
+asignify_afalg_open(enum asignify_digest_type type)
+{
+	struct sockaddr_alg sa;
+	int tfm, op;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.salg_family = AF_ALG;
+	memcpy(sa.salg_type, "hash", sizeof("hash"));
+	strncpy((char *)sa.salg_name, afalg_names[type],
+		sizeof(sa.salg_name) - 1);
+
+	if ((tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1) {
+		return (-1);
+	}
+
+	if (bind(tfm, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		close(tfm);
+		return (-1);
+	}
+
+	op = accept(tfm, NULL, 0);
+	close(tfm);
+
+	return (op);
+}
+
+static bool
+asignify_afalg_splice(int fd, int op, const asignify_cancel_t *cancel)
+{
+	int pfd[2];
+	loff_t off = 0;
+	ssize_t r, w;
+	bool ret = true;
+
+	if (pipe(pfd) == -1) {
+		return (false);
+	}
+
+	/* Larger pipe means less syscalls, but it is not critical */
+	(void)fcntl(pfd[1], F_SETPIPE_SZ, AFALG_PIPE_SIZE);
+
+	for (;;) {
+		if (asignify_cancel_check(cancel)) {
+			ret = false;
+			break;
+		}
+
+		r = splice(fd, &off, pfd[1], NULL, AFALG_PIPE_SIZE, SPLICE_F_MOVE);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ret = false;
+			break;
+		}
+		else if (r == 0) {
+			break;
+		}
+
+		while (r > 0) {
+			w = splice(pfd[0], NULL, op, NULL, r,
+				SPLICE_F_MOVE | SPLICE_F_MORE);
+
+			if (w == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				ret = false;
+				break;
+			}
+
+			r -= w;
+		}
+
+		if (!ret) {
+			break;
+		}
+	}
+
+	close(pfd[0]);
+	close(pfd[1]);
+
+	return (ret);
+}
+
+static unsigned char *
+asignify_afalg_digest_fd(enum asignify_digest_type type, int fd,
+	const asignify_cancel_t *cancel)
+{
+	int op;
+	unsigned int len;
+	unsigned char *res;
+
+	if (type >= ASIGNIFY_DIGEST_SIZE || afalg_names[type] == NULL ||
+			afalg_states[type] == AFALG_UNAVAILABLE) {
+		return (NULL);
+	}
+
+	if ((op = asignify_afalg_open(type)) == -1) {
+		/* No such algorithm or AF_ALG is disabled in the kernel */
+		afalg_states[type] = AFALG_UNAVAILABLE;
+		return (NULL);
+	}
+
+	afalg_states[type] = AFALG_AVAILABLE;
+	len = asignify_digest_len(type);
+	res = xmalloc(len);
+
+	/* Reading from the socket finalizes the hash */
+	if (!asignify_afalg_splice(fd, op, cancel) || read(op, res, len) != len) {
+		free(res);
+		res = NULL;
+	}
+
+	close(op);
+
+	return (res);
+}
+
+static const struct asignify_digest_backend afalg_backends[] = {
+	{
+		.name = "afalg",
+		.type = ASIGNIFY_DIGEST_SHA256,
+		.priority = ASIGNIFY_DIGEST_PRIO_KERNEL,
+		.digest_fd = asignify_afalg_digest_fd,
+		.fd_min_size = ASIGNIFY_AFALG_MIN_SIZE
+	},
+	{
+		.name = "afalg",
+		.type = ASIGNIFY_DIGEST_SHA512,
+		.priority = ASIGNIFY_DIGEST_PRIO_KERNEL,
+		.digest_fd = asignify_afalg_digest_fd,
+		.fd_min_size = ASIGNIFY_AFALG_MIN_SIZE
+	},
+	{
+		.name = "afalg",
+		.type = ASIGNIFY_DIGEST_BLAKE2,
+		.priority = ASIGNIFY_DIGEST_PRIO_KERNEL,
+		.digest_fd = asignify_afalg_digest_fd,
+		.fd_min_size = ASIGNIFY_AFALG_MIN_SIZE
+	}
+};
+
+void
+asignify_afalg_register(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(afalg_backends) / sizeof(afalg_backends[0]); i ++) {
+		asignify_digest_register(&afalg_backends[i]);
+	}
+}
+
+#else
+
+void
+asignify_afalg_register(void)
+{
+}
+
+#endif /* HAVE_AFALG */
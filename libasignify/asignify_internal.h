@@ -85,6 +85,8 @@ struct asignify_file {
 	char *fname;
 	struct asignify_file_digest *digests;
 	size_t size;
+	/* Identity of a file from the loaded attestation */
+	struct asignify_file_id *attest;
 };
 
 void randombytes(unsigned char *buf, uint64_t len);
@@ -92,8 +94,22 @@ void randombytes(unsigned char *buf, uint64_t len);
 int pkcs5_pbkdf2(const char *pass, size_t pass_len, const uint8_t *salt,
     size_t salt_len, uint8_t *key, size_t key_len, unsigned int rounds);
 
+#define ASIGNIFY_MAX_LINE 4096
+#define ASIGNIFY_MAX_PUBKEY_SIZE (64 * 1024)
+#ifndef ASIGNIFY_MAX_SIGNATURE_SIZE
+#define ASIGNIFY_MAX_SIGNATURE_SIZE (1024 * 1024 * 1024)
+#endif
+
 FILE * xfopen(const char *fname, const char *mode);
 int xopen(const char *fname, int oflags, mode_t mode);
+/* Reads the whole fd to a NUL terminated buffer, NULL if larger than maxlen */
+unsigned char * xread_fd(int fd, size_t maxlen, size_t *len);
+/*
+ * Copies the next line from *pos to a NUL terminated line, returns line length
+ * including newline, 0 at the end of buffer and -1 if a line is too long
+ */
+ssize_t asignify_buf_getline(const char **pos, const char *end, char *line,
+	size_t linelen);
 void * xmalloc(size_t len);
 void * xmalloc_aligned(size_t align, size_t len);
 void * xmalloc0(size_t len);
@@ -125,6 +141,11 @@ enum asignify_error {
 	ASIGNIFY_ERROR_MISUSE,
 	ASIGNIFY_ERROR_WRONG_KEYPAIR,
 	ASIGNIFY_ERROR_WRONG_KEY,
+	ASIGNIFY_ERROR_CANCELLED,
+	ASIGNIFY_ERROR_CONFLICT,
+	ASIGNIFY_ERROR_COMPRESSION,
+	ASIGNIFY_ERROR_CIPHER,
+	ASIGNIFY_ERROR_CHANGED,
 	ASIGNIFY_ERROR_MAX
 };
 
@@ -135,6 +156,8 @@ enum asignify_error {
 } while(0)
 
 const char * xerr_string(enum asignify_error code);
+/* Returns ASIGNIFY_ERROR_CANCELLED if c has fired and ASIGNIFY_ERROR_FILE otherwise */
+enum asignify_error asignify_io_error(const asignify_cancel_t *c);
 
 /*
  * Common public data operations
@@ -155,11 +178,25 @@ void asignify_private_data_free(struct asignify_private_data *d);
 bool asignify_privkey_write(struct asignify_private_key *privk, FILE *f);
 struct asignify_public_data* asignify_private_data_sign(
 	struct asignify_private_data *privk, unsigned char *buf, size_t len);
+struct asignify_digest_ctx;
+/* Feeds the whole data being signed to dig, it is called twice */
+typedef bool (*asignify_sign_reader)(struct asignify_digest_ctx *dig,
+	void *ud);
+/*
+ * Signs data without keeping it in memory, the result equals to private_data_sign.
+ * Fails with ASIGNIFY_ERROR_CHANGED if the reader returns different data
+ * on the second call
+ */
+struct asignify_public_data* asignify_private_data_sign_stream(
+	struct asignify_private_data *privk, asignify_sign_reader reader,
+	void *ud, enum asignify_error *err);
 
 /*
  * Pubkey operations
  */
 struct asignify_public_data* asignify_pubkey_load(FILE *f);
+struct asignify_public_data* asignify_pubkey_load_buf(const char *buf,
+	size_t len);
 bool asignify_pubkey_check_signature(struct asignify_public_data *pk,
 	struct asignify_public_data *sig, const unsigned char *data, size_t dlen);
 bool asignify_pubkey_write(struct asignify_public_data *pk, FILE *f);
@@ -167,10 +204,262 @@ bool asignify_pubkey_write(struct asignify_public_data *pk, FILE *f);
 /*
  * Signature operations
  */
-struct asignify_public_data* asignify_signature_load(FILE *f,
-		struct asignify_public_data *pk);
+/* Sets consumed to the offset of signed data in buf */
+struct asignify_public_data* asignify_signature_load_buf(const char *buf,
+		size_t len, struct asignify_public_data *pk, size_t *consumed);
 bool asignify_signature_write(struct asignify_public_data *sig, const void *buf,
 	size_t len, FILE *f);
+/* Default memory used by sorted signing before spilling digests to disk */
+#define ASIGNIFY_SIGN_MEM_LIMIT (64 * 1024 * 1024)
+/* Writes just the signature line, signed data should follow it */
+bool asignify_signature_write_line(struct asignify_public_data *sig, FILE *f);
+
+/*
+ * Digests files parsing
+ */
+/* Called for each digest line, value is not validated against the type */
+typedef bool (*asignify_manifest_cb)(const char *fname, size_t fnlen,
+	enum asignify_digest_type type, const char *value, size_t vlen, void *ud);
+bool asignify_manifest_parse(const char *data, size_t dlen,
+	asignify_manifest_cb cb, void *ud);
+
+/*
+ * I/O pipelines
+ */
+#define ASIGNIFY_PIPE_BUFSIZE (1024 * 1024)
+#define ASIGNIFY_PIPE_MIN_BLOCK 4096
+#define ASIGNIFY_PIPE_MAX_BLOCK (64 * 1024 * 1024)
+#define ASIGNIFY_PIPE_NBUFS 4
+#define ASIGNIFY_PIPE_DEPTH 1
+#define ASIGNIFY_PIPE_MAX_DEPTH ASIGNIFY_IO_MAX_DEPTH
+/* Outputs smaller than this are not preallocated */
+#define ASIGNIFY_PIPE_PREALLOC_MIN (1024 * 1024)
+/* Dirty pages of outputs are written back by windows of this size */
+#define ASIGNIFY_PIPE_WRITEBACK (8 * 1024 * 1024)
+#define ASIGNIFY_PIPE_DIRECT_ALIGN 4096
+
+struct asignify_pipe;
+struct asignify_pipe* asignify_pipe_reader(int fd, off_t size_hint);
+struct asignify_pipe* asignify_pipe_writer(int fd, off_t size_hint);
+size_t asignify_pipe_bufsize(struct asignify_pipe *p);
+/*
+ * Returns the next chunk of input (valid until the next call), 0 on EOF and
+ * -1 on error; all chunks but the last one are exactly bufsize long
+ */
+ssize_t asignify_pipe_read(struct asignify_pipe *p, const unsigned char **data);
+/* Returns a buffer of bufsize bytes to be filled and queued by pipe_write */
+unsigned char* asignify_pipe_get_buf(struct asignify_pipe *p);
+bool asignify_pipe_write(struct asignify_pipe *p, size_t len);
+/* Makes read and get_buf fail and drops queued writes once c has fired */
+void asignify_pipe_set_cancel(struct asignify_pipe *p,
+	const asignify_cancel_t *c);
+/* Flushes and destroys pipe, returns false if any I/O error occurred */
+bool asignify_pipe_close(struct asignify_pipe *p);
+/*
+ * Transforms len bytes of a regular file from its current offset to out_fd at
+ * out_off by nthreads workers (synchronously if nthreads < 2); transform
+ * receives the offset of each block relative to the beginning and done
+ * receives input and output of each block strictly in order
+ */
+typedef bool (*asignify_pipe_transform_cb)(void *ud, off_t off,
+	const unsigned char *in, unsigned char *out, size_t len);
+typedef void (*asignify_pipe_block_cb)(void *ud, const unsigned char *in,
+	const unsigned char *out, size_t len);
+bool asignify_pipe_transform(int in_fd, int out_fd, off_t out_off, off_t len,
+	unsigned int nthreads, asignify_pipe_transform_cb transform,
+	asignify_pipe_block_cb done, void *ud, const asignify_cancel_t *cancel);
+
+/*
+ * Digests registry
+ */
+#define ASIGNIFY_DIGEST_PRIO_REF 0
+#define ASIGNIFY_DIGEST_PRIO_SIMD 10
+#define ASIGNIFY_DIGEST_PRIO_ACCEL 20
+#define ASIGNIFY_DIGEST_PRIO_KERNEL 30
+
+struct asignify_digest_backend {
+	const char *name;
+	enum asignify_digest_type type;
+	int priority;
+	/* Streaming interface, state is allocated by the registry */
+	size_t state_size;
+	void (*init)(void *st);
+	void (*update)(void *st, const unsigned char *buf, size_t len);
+	/* Writes asignify_digest_len(type) bytes and releases state resources */
+	void (*final)(void *st, unsigned char *out);
+	/* Optional: hashes the whole file, returns NULL to fall back */
+	unsigned char* (*digest_fd)(enum asignify_digest_type type, int fd,
+		const asignify_cancel_t *cancel);
+	off_t fd_min_size;
+};
+
+struct asignify_digest_ctx;
+
+/* Must be called before the first digest operation */
+void asignify_digest_register(const struct asignify_digest_backend *b);
+struct asignify_digest_ctx* asignify_digest_init(enum asignify_digest_type type);
+void asignify_digest_update(struct asignify_digest_ctx *ctx,
+	const unsigned char *buf, size_t len);
+/* Also feeds all further updates of ctx to tee, which is not owned by ctx */
+void asignify_digest_tee(struct asignify_digest_ctx *ctx,
+	struct asignify_digest_ctx *tee);
+/* Returns digest and frees context */
+unsigned char* asignify_digest_final(struct asignify_digest_ctx *ctx);
+void asignify_digest_free(struct asignify_digest_ctx *ctx);
+/* Like asignify_digest_fd but returns NULL if cancel fires while reading */
+unsigned char* asignify_digest_fd_cancel(enum asignify_digest_type type,
+	int fd, const asignify_cancel_t *cancel);
+/*
+ * Computes digests of all types set in types (ASIGNIFY_DIGEST_BIT mask) by a
+ * single read of fd, out[type] is an allocated digest of each type set
+ */
+bool asignify_digest_fd_multi(int fd, unsigned int types, unsigned char **out,
+	const asignify_cancel_t *cancel);
+#define ASIGNIFY_DIGEST_BENCH_SIZE (256 * 1024)
+/* Returns measured speed of digest in bytes per microsecond, 0 if unknown */
+uint64_t asignify_digest_speed(enum asignify_digest_type type);
+
+/*
+ * Attestations of checked files are bound to a digest of the signatures
+ */
+#define ASIGNIFY_ATTEST_MAGIC "asignify-attest: 1"
+#define ASIGNIFY_ATTEST_HASHLEN 64
+
+/*
+ * Deltas between signatures: copy (`= n`), skip (`- n`) and insert (`+ line`)
+ * operations over lines of the base signature body
+ */
+#define ASIGNIFY_DELTA_MAGIC "asignify-delta: 1"
+#define ASIGNIFY_DELTA_HASHLEN 64
+
+/*
+ * Merkle tree heads of append-only logs
+ */
+#define ASIGNIFY_LOG_HASHLEN 64
+#define ASIGNIFY_LOG_SEGMENT (64 * 1024)
+#define ASIGNIFY_LOG_MAX_HEIGHT 64
+
+struct asignify_log_head {
+	char *name;
+	/* Fixed segment size or the minimal size of records segment */
+	uint64_t segment;
+	bool records;
+	uint64_t size;
+	uint64_t leaves;
+	/* End of the last complete segment */
+	uint64_t offset;
+	unsigned int nfrontier;
+	unsigned char frontier[ASIGNIFY_LOG_MAX_HEIGHT][ASIGNIFY_LOG_HASHLEN];
+	unsigned char root[ASIGNIFY_LOG_HASHLEN];
+};
+
+/* Returns NULL if name cannot be stored in a head */
+struct asignify_log_head* asignify_log_head_new(const char *name,
+	uint64_t segment, bool records);
+/* Parses signed head text, returns NULL if it is malformed */
+struct asignify_log_head* asignify_log_head_parse(const char *data,
+	size_t len);
+char* asignify_log_head_format(const struct asignify_log_head *h,
+	size_t *len);
+void asignify_log_head_free(struct asignify_log_head *h);
+/*
+ * Extends h by the data of fd from h->offset to size and sets its root,
+ * h is left in undefined state on error
+ */
+enum asignify_error asignify_log_hash(struct asignify_log_head *h, int fd,
+	uint64_t size, const asignify_cancel_t *cancel);
+/*
+ * Checks that fd still matches prev up to prev->size and returns a new head
+ * for size bytes, rereading just the tail of prev and the new data
+ */
+struct asignify_log_head* asignify_log_advance(
+	const struct asignify_log_head *prev, int fd, uint64_t size,
+	const asignify_cancel_t *cancel, enum asignify_error *err);
+
+/*
+ * Kernel crypto API (AF_ALG) digests, registers nothing if not available
+ */
+#define ASIGNIFY_AFALG_MIN_SIZE (64 * 1024)
+void asignify_afalg_register(void);
+
+/*
+ * Streaming decompression of checked files
+ */
+enum asignify_compression {
+	ASIGNIFY_COMPRESSION_NONE = 0,
+	ASIGNIFY_COMPRESSION_GZIP,
+	ASIGNIFY_COMPRESSION_ZSTD
+};
+
+struct asignify_decompress;
+/* Receives decompressed data by chunks, returning false stops decompression */
+typedef bool (*asignify_decompress_cb)(void *ud, const unsigned char *buf,
+	size_t len);
+/* Detects format by the magic of the first len bytes of a file */
+enum asignify_compression asignify_compression_detect(const unsigned char *buf,
+	size_t len);
+/* Returns NULL if the format is not supported by this build */
+struct asignify_decompress* asignify_decompress_init(
+	enum asignify_compression type);
+bool asignify_decompress_update(struct asignify_decompress *d,
+	const unsigned char *in, size_t len, asignify_decompress_cb cb, void *ud);
+/* Returns true if the whole compressed stream has been consumed */
+bool asignify_decompress_finish(struct asignify_decompress *d);
+void asignify_decompress_free(struct asignify_decompress *d);
+
+/*
+ * Encryption internals
+ */
+struct asignify_encrypt_ctx {
+	struct asignify_private_data *privk;
+	struct asignify_public_data *pubk;
+	const asignify_cancel_t *cancel;
+	unsigned int nthreads;
+	const char *error;
+};
+
+/*
+ * AES-256-GCM chunks, all functions fail if the library is built without
+ * openssl
+ */
+#define ASIGNIFY_AESGCM_CHUNK (64 * 1024)
+#define ASIGNIFY_AESGCM_TAGLEN 16
+#define ASIGNIFY_AESGCM_NONCELEN 8
+struct asignify_aesgcm;
+struct asignify_aesgcm* asignify_aesgcm_init(const unsigned char *key,
+	const unsigned char *nonce, bool decrypt);
+bool asignify_aesgcm_seal(struct asignify_aesgcm *g, uint32_t counter,
+	bool last, const unsigned char *in, size_t len, unsigned char *out,
+	unsigned char *tag);
+/* Returns false if the tag is wrong, out must be discarded in this case */
+bool asignify_aesgcm_open(struct asignify_aesgcm *g, uint32_t counter,
+	bool last, const unsigned char *in, size_t len, const unsigned char *tag,
+	unsigned char *out);
+void asignify_aesgcm_free(struct asignify_aesgcm *g);
+/* Returns true if CPU has AES and carry-less multiplication instructions */
+bool asignify_aesgcm_accelerated(void);
+
+int asignify_encrypt_rounds(enum asignify_encrypt_type type);
+/* Computes curve25519 key shared by our private key and peer's public key */
+bool asignify_encrypt_shared_key(asignify_encrypt_t *ctx, unsigned char *k);
+/*
+ * Sealed buffers use the encrypted file format with header version
+ * base + rounds, so that volume indexes can be told apart from files
+ */
+#define ASIGNIFY_SEAL_FILE 100
+#define ASIGNIFY_SEAL_VOLUMES 1000
+/* Encrypts and signs buffer using the normal encrypted file format */
+bool asignify_encrypt_seal_buf(asignify_encrypt_t *ctx,
+	enum asignify_encrypt_type type, unsigned int base,
+	const unsigned char *data, size_t len, FILE *out);
+/* Verifies and decrypts buffer sealed with the same base, returns allocated plaintext */
+unsigned char* asignify_encrypt_open_buf(asignify_encrypt_t *ctx,
+	unsigned int base, const unsigned char *data, size_t len, size_t *outlen);
+/* Temporary output renamed to outf by tmp_close only if ret is true */
+int asignify_encrypt_tmp_open(asignify_encrypt_t *ctx, const char *outf,
+	char **tmp);
+bool asignify_encrypt_tmp_close(asignify_encrypt_t *ctx, int fd, char *tmp,
+	const char *outf, bool ret);
 
 /*
  * SSH keys routines
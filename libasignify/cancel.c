@@ -0,0 +1,126 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "asignify.h"
+#include "asignify_internal.h"
+
+/*
+ * Cancellation tokens are checked by long operations between I/O buffers.
+ * Triggering only stores a flag, so it is safe from other threads and from
+ * signal handlers.
+ */
+struct asignify_cancel {
+	volatile sig_atomic_t cancelled;
+	bool has_deadline;
+	struct timespec deadline;
+};
+
+asignify_cancel_t*
+asignify_cancel_init(void)
+{
+	asignify_cancel_t *nc;
+
+	nc = xmalloc0(sizeof(*nc));
+
+	return (nc);
+}
+
+void
+asignify_cancel_trigger(asignify_cancel_t *c)
+{
+	if (c != NULL) {
+		c->cancelled = 1;
+	}
+}
+
+void
+asignify_cancel_set_timeout(asignify_cancel_t *c, unsigned int msec)
+{
+	if (c == NULL) {
+		return;
+	}
+
+	if (msec == 0) {
+		c->has_deadline = false;
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &c->deadline);
+	c->deadline.tv_sec += msec / 1000;
+	c->deadline.tv_nsec += (long)(msec % 1000) * 1000000L;
+
+	if (c->deadline.tv_nsec >= 1000000000L) {
+		c->deadline.tv_sec ++;
+		c->deadline.tv_nsec -= 1000000000L;
+	}
+
+	c->has_deadline = true;
+}
+
+bool
+asignify_cancel_check(const asignify_cancel_t *c)
+{
+	struct timespec now;
+
+	if (c == NULL) {
+		return (false);
+	}
+
+	if (c->cancelled) {
+		return (true);
+	}
+
+	if (c->has_deadline) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (now.tv_sec > c->deadline.tv_sec ||
+				(now.tv_sec == c->deadline.tv_sec &&
+				now.tv_nsec >= c->deadline.tv_nsec)) {
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+void
+asignify_cancel_free(asignify_cancel_t *c)
+{
+	free(c);
+}
+
+enum asignify_error
+asignify_io_error(const asignify_cancel_t *c)
+{
+	return (asignify_cancel_check(c) ?
+		ASIGNIFY_ERROR_CANCELLED : ASIGNIFY_ERROR_FILE);
+}
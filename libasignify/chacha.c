@@ -220,6 +220,16 @@ chacha_init(chacha_state *S, const chacha_key *key, const chacha_iv *iv, size_t
 	state->leftover = 0;
 }
 
+/* seek to the block, any buffered data is discarded */
+void
+chacha_set_counter(chacha_state *S, uint64_t counter)
+{
+	chacha_state_internal *state = (chacha_state_internal *)S;
+	U32TO8(state->s + 32, (chacha_int32)counter);
+	U32TO8(state->s + 36, (chacha_int32)(counter >> 32));
+	state->leftover = 0;
+}
+
 /* processes inlen bytes (can do partial blocks), handling input/ouput alignment */
 static void
 chacha_consume(chacha_state_internal *state, const unsigned char *in, unsigned char *out, size_t inlen)
@@ -2,6 +2,7 @@
 #define CHACHA_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef CHACHA_ALIGN
 # if defined(_MSC_VER)
@@ -34,6 +35,8 @@ typedef struct chacha_iv24_t {
 void chacha_init(chacha_state *S, const chacha_key *key, const chacha_iv *iv, size_t rounds);
 size_t chacha_update(chacha_state *S, const unsigned char *in, unsigned char *out, size_t inlen);
 size_t chacha_final(chacha_state *S, unsigned char *out);
+/* seek keystream to the specified 64 bytes block */
+void chacha_set_counter(chacha_state *S, uint64_t counter);
 
 #if defined(__cplusplus)
 }
@@ -0,0 +1,582 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+
+#include "blake2.h"
+#include "chacha.h"
+#include "asignify.h"
+#include "asignify_internal.h"
+#include "tweetnacl.h"
+#include "kvec.h"
+
+/*
+ * Chunked (convergent) encryption:
+ *
+ * Input is split into content defined chunks using gear rolling hash, each
+ * chunk is encrypted with a key derived from its content by blake2b keyed
+ * with a secret shared by the sender and the recipient, so unchanged chunks
+ * produce the same ciphertext. Encrypted chunks are stored in a directory
+ * named by blake2b of their ciphertext, and existing chunks are not written
+ * again. The list of chunks with their keys is an index which is encrypted
+ * and signed as a normal encrypted file.
+ */
+
+#define CHUNK_INDEX_MAGIC "asignify-chunk-index:"
+#define CHUNK_INDEX_VERSION 1
+#define CHUNK_INDEX_MAX_SIZE (1024 * 1024 * 1024)
+#define CHUNK_KDF_CONTEXT "asignify-chunk-key"
+#define CHUNK_MIN_SIZE (256 * 1024)
+#define CHUNK_MAX_SIZE (4 * 1024 * 1024)
+/* Average chunk is 1Mb */
+#define CHUNK_AVG_BITS 20
+#define CHUNK_WINDOW 64
+#define CHUNK_ID_LEN 32
+#define CHUNK_KEY_LEN 32
+#define CHUNK_HEX_LEN (CHUNK_ID_LEN * 2)
+
+struct asignify_chunker {
+	uint64_t gear[256];
+	uint64_t h;
+	size_t len;
+	unsigned char *buf;
+	unsigned char *cipher;
+	unsigned char conv_key[CHUNK_KEY_LEN];
+	const char *dir;
+	int rounds;
+	kvec_t(char) index;
+};
+
+static void
+asignify_chunker_gear_init(uint64_t *gear)
+{
+	uint64_t x = 0x6173696769666979ULL, z;
+	unsigned int i;
+
+	/* Splitmix64: the table must be the same everywhere to get same chunks */
+	for (i = 0; i < 256; i ++) {
+		x += 0x9e3779b97f4a7c15ULL;
+		z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+/*
+ * Returns number of bytes of data that belong to the current chunk, sets
+ * *boundary if the chunk is complete
+ */
+static size_t
+asignify_chunker_scan(struct asignify_chunker *c, const unsigned char *data,
+	size_t len, bool *boundary)
+{
+	size_t i = 0, avail = CHUNK_MAX_SIZE - c->len;
+	uint64_t h = c->h;
+
+	*boundary = false;
+
+	if (len >= avail) {
+		len = avail;
+		*boundary = true;
+	}
+
+	/* Hash value depends on the last CHUNK_WINDOW bytes only */
+	if (c->len < CHUNK_MIN_SIZE - CHUNK_WINDOW) {
+		i = CHUNK_MIN_SIZE - CHUNK_WINDOW - c->len;
+
+		if (i >= len) {
+			return (len);
+		}
+	}
+
+	for (; i < len; i ++) {
+		h = (h << 1) + c->gear[data[i]];
+
+		if (c->len + i + 1 >= CHUNK_MIN_SIZE &&
+				(h >> (64 - CHUNK_AVG_BITS)) == 0) {
+			*boundary = true;
+			c->h = h;
+			return (i + 1);
+		}
+	}
+
+	c->h = h;
+
+	return (len);
+}
+
+static bool
+asignify_chunk_path(const char *dir, const char *hexid, char *path,
+	size_t pathlen, bool subdir_only)
+{
+	int r;
+
+	/* Chunks are spread over 256 subdirectories */
+	if (subdir_only) {
+		r = snprintf(path, pathlen, "%s/%.2s", dir, hexid);
+	}
+	else {
+		r = snprintf(path, pathlen, "%s/%.2s/%s", dir, hexid, hexid);
+	}
+
+	return (r > 0 && r < pathlen);
+}
+
+static bool
+asignify_chunk_store(struct asignify_chunker *c, const char *hexid, size_t len)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	struct stat st;
+	int fd;
+	size_t written = 0;
+	ssize_t r;
+
+	if (!asignify_chunk_path(c->dir, hexid, path, sizeof(path), false)) {
+		return (false);
+	}
+
+	if (stat(path, &st) != -1 && S_ISREG(st.st_mode) && st.st_size == len) {
+		/* Chunk is already stored */
+		return (true);
+	}
+
+	asignify_chunk_path(c->dir, hexid, tmp, sizeof(tmp), true);
+
+	if (mkdir(tmp, 0755) == -1 && errno != EEXIST) {
+		return (false);
+	}
+
+	/* Write to a temporary file, so we never have partial chunks */
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp) ||
+			(fd = mkstemp(tmp)) == -1) {
+		return (false);
+	}
+
+	while (written < len) {
+		r = write(fd, c->cipher + written, len - written);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			close(fd);
+			unlink(tmp);
+			return (false);
+		}
+
+		written += r;
+	}
+
+	if (close(fd) == -1 || rename(tmp, path) == -1) {
+		unlink(tmp);
+		return (false);
+	}
+
+	return (true);
+}
+
+static bool
+asignify_chunker_emit(struct asignify_chunker *c)
+{
+	unsigned char key[CHUNK_KEY_LEN], id[CHUNK_ID_LEN], r8;
+	char hexid[CHUNK_HEX_LEN + 1], hexkey[CHUNK_HEX_LEN + 1], line[256];
+	const chacha_iv iv = {{0}};
+	blake2b_state sh;
+	chacha_state st;
+	size_t clen;
+	int l;
+
+	if (c->len == 0) {
+		return (true);
+	}
+
+	/* Key is unique for the content, so zero nonce is fine */
+	r8 = c->rounds;
+	blake2b_init_key(&sh, CHUNK_KEY_LEN, c->conv_key, sizeof(c->conv_key));
+	blake2b_update(&sh, &r8, 1);
+	blake2b_update(&sh, c->buf, c->len);
+	blake2b_final(&sh, key, CHUNK_KEY_LEN);
+
+	chacha_init(&st, (chacha_key *)key, &iv, c->rounds);
+	clen = chacha_update(&st, c->buf, c->cipher, c->len);
+	clen += chacha_final(&st, c->cipher + clen);
+
+	blake2b(id, c->cipher, NULL, CHUNK_ID_LEN, clen, 0);
+	bin2hex(hexid, sizeof(hexid), id, sizeof(id));
+	bin2hex(hexkey, sizeof(hexkey), key, sizeof(key));
+	explicit_memzero(key, sizeof(key));
+
+	if (!asignify_chunk_store(c, hexid, clen)) {
+		explicit_memzero(hexkey, sizeof(hexkey));
+		return (false);
+	}
+
+	l = snprintf(line, sizeof(line), "%s %s %zu\n", hexid, hexkey, clen);
+	kv_push_a(char, c->index, line, l);
+	explicit_memzero(hexkey, sizeof(hexkey));
+	explicit_memzero(line, sizeof(line));
+
+	c->len = 0;
+	c->h = 0;
+
+	return (true);
+}
+
+bool
+asignify_encrypt_crypt_chunked(asignify_encrypt_t *ctx, unsigned int version,
+	const char *inf, const char *indexf, const char *chunkdir,
+	enum asignify_encrypt_type type)
+{
+	struct asignify_chunker *c;
+	struct asignify_pipe *rd;
+	struct stat st;
+	const unsigned char *buf;
+	unsigned char shared[crypto_box_BEFORENMBYTES];
+	char hdr[64];
+	ssize_t r;
+	size_t n;
+	bool boundary, ret = false;
+	int fd, l;
+	FILE *out;
+
+	if (ctx == NULL || inf == NULL || indexf == NULL || chunkdir == NULL ||
+			version != 1) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if (type == ASIGNIFY_ENCRYPT_AESGCM) {
+		/* Chunks are always encrypted by chacha */
+		ctx->error = xerr_string(ASIGNIFY_ERROR_CIPHER);
+		return (false);
+	}
+
+	if (!asignify_encrypt_shared_key(ctx, shared)) {
+		return (false);
+	}
+
+	if (mkdir(chunkdir, 0755) == -1 && errno != EEXIST) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	if ((fd = xopen(inf, O_RDONLY, 0)) == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	c = xmalloc0(sizeof(*c));
+	asignify_chunker_gear_init(c->gear);
+	c->buf = xmalloc_aligned(64, CHUNK_MAX_SIZE);
+	c->cipher = xmalloc_aligned(64, CHUNK_MAX_SIZE);
+	c->dir = chunkdir;
+	c->rounds = asignify_encrypt_rounds(type);
+	blake2b(c->conv_key, CHUNK_KDF_CONTEXT, shared, sizeof(c->conv_key),
+		sizeof(CHUNK_KDF_CONTEXT) - 1, sizeof(shared));
+	explicit_memzero(shared, sizeof(shared));
+	kv_init(c->index);
+
+	l = snprintf(hdr, sizeof(hdr), "%s%d:%d\n", CHUNK_INDEX_MAGIC,
+		CHUNK_INDEX_VERSION, c->rounds);
+	kv_push_a(char, c->index, hdr, l);
+
+	rd = asignify_pipe_reader(fd,
+		(fstat(fd, &st) != -1 && S_ISREG(st.st_mode)) ? st.st_size : -1);
+	asignify_pipe_set_cancel(rd, ctx->cancel);
+
+	while ((r = asignify_pipe_read(rd, &buf)) > 0) {
+		while (r > 0) {
+			n = asignify_chunker_scan(c, buf, r, &boundary);
+			memcpy(c->buf + c->len, buf, n);
+			c->len += n;
+			buf += n;
+			r -= n;
+
+			if (boundary && !asignify_chunker_emit(c)) {
+				ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+				goto cleanup;
+			}
+		}
+	}
+
+	if (r == -1 || !asignify_chunker_emit(c)) {
+		ctx->error = xerr_string(asignify_io_error(ctx->cancel));
+		goto cleanup;
+	}
+
+	/* Chunks are in place, now write the index */
+	out = xfopen(indexf, "w");
+	if (out == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		goto cleanup;
+	}
+
+	ret = asignify_encrypt_seal_buf(ctx, type, ASIGNIFY_SEAL_FILE,
+		(const unsigned char *)c->index.a, kv_size(c->index), out);
+
+	if (fclose(out) != 0 && ret) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		ret = false;
+	}
+
+cleanup:
+	asignify_pipe_close(rd);
+	close(fd);
+	explicit_memzero(c->conv_key, sizeof(c->conv_key));
+	explicit_memzero(c->buf, CHUNK_MAX_SIZE);
+	if (c->index.a) {
+		explicit_memzero(c->index.a, kv_size(c->index));
+	}
+	kv_destroy(c->index);
+	free(c->buf);
+	free(c->cipher);
+	free(c);
+
+	return (ret);
+}
+
+static bool
+asignify_chunk_load(const char *dir, const char *hexid, unsigned char *buf,
+	size_t len)
+{
+	char path[PATH_MAX];
+	unsigned char id[CHUNK_ID_LEN], expected[CHUNK_ID_LEN];
+	struct stat st;
+	size_t total = 0;
+	ssize_t r;
+	int fd;
+
+	if (!asignify_chunk_path(dir, hexid, path, sizeof(path), false) ||
+			(fd = xopen(path, O_RDONLY, 0)) == -1) {
+		return (false);
+	}
+
+	if (fstat(fd, &st) == -1 || st.st_size != len) {
+		close(fd);
+		return (false);
+	}
+
+	while (total < len) {
+		r = read(fd, buf + total, len - total);
+
+		if (r == -1 && errno == EINTR) {
+			continue;
+		}
+		else if (r <= 0) {
+			close(fd);
+			return (false);
+		}
+
+		total += r;
+	}
+
+	close(fd);
+
+	/* Chunk must match its id which is covered by the index signature */
+	blake2b(id, buf, NULL, CHUNK_ID_LEN, len, 0);
+
+	if (hex2bin(expected, sizeof(expected), hexid, CHUNK_HEX_LEN,
+			NULL, NULL) != 0) {
+		return (false);
+	}
+
+	return (memcmp(id, expected, sizeof(id)) == 0);
+}
+
+bool
+asignify_encrypt_decrypt_chunked(asignify_encrypt_t *ctx, const char *indexf,
+	const char *chunkdir, const char *outf)
+{
+	unsigned char *data, *index = NULL, *cipher = NULL, *plain = NULL,
+		key[CHUNK_KEY_LEN], *outbuf;
+	const char *p, *end, *nl;
+	char *errstr, hexid[CHUNK_HEX_LEN + 1];
+	const chacha_iv iv = {{0}};
+	chacha_state st;
+	struct asignify_pipe *wr = NULL;
+	size_t dlen, ilen, clen, plen, bufsize, off, n;
+	unsigned long version, rounds;
+	int fd, out_fd = -1;
+	bool ret = false;
+
+	if (ctx == NULL || indexf == NULL || chunkdir == NULL || outf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if ((fd = xopen(indexf, O_RDONLY, 0)) == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	data = xread_fd(fd, CHUNK_INDEX_MAX_SIZE, &dlen);
+	close(fd);
+
+	if (data == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	index = asignify_encrypt_open_buf(ctx, ASIGNIFY_SEAL_FILE, data, dlen,
+		&ilen);
+	free(data);
+
+	if (index == NULL) {
+		return (false);
+	}
+
+	p = (const char *)index;
+	end = p + ilen;
+
+	/* Header: magic, version and chacha rounds */
+	if (ilen <= sizeof(CHUNK_INDEX_MAGIC) - 1 ||
+			memcmp(p, CHUNK_INDEX_MAGIC, sizeof(CHUNK_INDEX_MAGIC) - 1) != 0 ||
+			(nl = memchr(p, '\n', ilen)) == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		goto cleanup;
+	}
+
+	p += sizeof(CHUNK_INDEX_MAGIC) - 1;
+	version = strtoul(p, &errstr, 10);
+
+	if (*errstr != ':' || version != CHUNK_INDEX_VERSION) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		goto cleanup;
+	}
+
+	rounds = strtoul(errstr + 1, &errstr, 10);
+
+	if (errstr != nl || (rounds != asignify_encrypt_rounds(ASIGNIFY_ENCRYPT_SAFE) &&
+			rounds != asignify_encrypt_rounds(ASIGNIFY_ENCRYPT_FAST))) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		goto cleanup;
+	}
+
+	p = nl + 1;
+
+	if ((out_fd = xopen(outf, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		goto cleanup;
+	}
+
+	cipher = xmalloc_aligned(64, CHUNK_MAX_SIZE);
+	plain = xmalloc_aligned(64, CHUNK_MAX_SIZE);
+	wr = asignify_pipe_writer(out_fd, -1);
+	asignify_pipe_set_cancel(wr, ctx->cancel);
+	bufsize = asignify_pipe_bufsize(wr);
+
+	/* Each line: <id> <key> <size> */
+	while (p < end) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL ||
+				nl - p <= CHUNK_HEX_LEN * 2 + 2 ||
+				p[CHUNK_HEX_LEN] != ' ' || p[CHUNK_HEX_LEN * 2 + 1] != ' ') {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+			goto cleanup;
+		}
+
+		memcpy(hexid, p, CHUNK_HEX_LEN);
+		hexid[CHUNK_HEX_LEN] = '\0';
+
+		if (hex2bin(key, sizeof(key), p + CHUNK_HEX_LEN + 1, CHUNK_HEX_LEN,
+				NULL, NULL) != 0) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+			goto cleanup;
+		}
+
+		errno = 0;
+		clen = strtoumax(p + CHUNK_HEX_LEN * 2 + 2, &errstr, 10);
+
+		if (errstr != nl || errno != 0 || clen == 0 || clen > CHUNK_MAX_SIZE) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+			goto cleanup;
+		}
+
+		if (!asignify_chunk_load(chunkdir, hexid, cipher, clen)) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
+			goto cleanup;
+		}
+
+		chacha_init(&st, (chacha_key *)key, &iv, rounds);
+		plen = chacha_update(&st, cipher, plain, clen);
+		plen += chacha_final(&st, plain + plen);
+		explicit_memzero(key, sizeof(key));
+
+		for (off = 0; off < plen; off += n) {
+			n = plen - off > bufsize ? bufsize : plen - off;
+
+			if ((outbuf = asignify_pipe_get_buf(wr)) == NULL) {
+				ctx->error = xerr_string(asignify_io_error(ctx->cancel));
+				goto cleanup;
+			}
+
+			memcpy(outbuf, plain + off, n);
+
+			if (!asignify_pipe_write(wr, n)) {
+				ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+				goto cleanup;
+			}
+		}
+
+		p = nl + 1;
+	}
+
+	ret = asignify_pipe_close(wr);
+	wr = NULL;
+
+	if (!ret) {
+		ctx->error = xerr_string(asignify_io_error(ctx->cancel));
+	}
+
+cleanup:
+	if (wr != NULL) {
+		asignify_pipe_close(wr);
+	}
+	if (out_fd != -1) {
+		close(out_fd);
+	}
+	explicit_memzero(key, sizeof(key));
+	explicit_memzero(index, ilen);
+	free(index);
+	free(cipher);
+
+	if (plain != NULL) {
+		explicit_memzero(plain, CHUNK_MAX_SIZE);
+		free(plain);
+	}
+
+	return (ret);
+}
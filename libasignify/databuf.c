@@ -58,6 +58,7 @@ struct asignify_privkey_parser {
 	unsigned int required_len;
 };
 
+#ifndef ASIGNIFY_VERIFY_ONLY
 /*
  * Keep sorted by field name
  */
@@ -104,6 +105,7 @@ const static struct asignify_privkey_parser parser_fields[] = {
 		.required_len = 0
 	}
 };
+#endif
 
 void
 asignify_public_data_free(struct asignify_public_data *d)
@@ -197,6 +199,7 @@ asignify_public_data_load(const char *buf, size_t buflen, const char *magic,
 	return (res);
 }
 
+#ifndef ASIGNIFY_VERIFY_ONLY
 struct field_search_key {
 	const char *begin;
 	size_t len;
@@ -540,6 +543,8 @@ asignify_private_data_free(struct asignify_private_data *d)
 	}
 }
 
+#endif
+
 const unsigned char *
 asignify_ssh_read_string(const unsigned char *buf, unsigned int *str_len,
 		unsigned int remain, unsigned char const **npos)
@@ -570,6 +575,7 @@ asignify_ssh_read_string(const unsigned char *buf, unsigned int *str_len,
 	return (p);
 }
 
+#ifndef ASIGNIFY_VERIFY_ONLY
 #define SAFE_MEMCMP(in, pat, inlen) ((inlen) >= sizeof(pat) && memcmp(in, pat, sizeof(pat)) == 0)
 #define SAFE_STRCMP(in, pat, inlen) ((inlen) >= sizeof(pat) - 1 && memcmp(in, pat, sizeof(pat) - 1) == 0)
 
@@ -786,3 +792,4 @@ cleanup:
 
 	return (res);
 }
+#endif
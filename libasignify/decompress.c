@@ -0,0 +1,262 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asignify_internal.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * Streaming decompression: checked files are inflated in memory by chunks,
+ * so the uncompressed content never touches the disk.
+ */
+
+#define ASIGNIFY_DECOMPRESS_BUFSIZE (256 * 1024)
+
+struct asignify_decompress {
+	enum asignify_compression type;
+	/* Set when the last stream (or frame) has been fully decoded */
+	bool done;
+	unsigned char *out;
+#ifdef HAVE_ZLIB
+	z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zds;
+#endif
+};
+
+enum asignify_compression
+asignify_compression_detect(const unsigned char *buf, size_t len)
+{
+	static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+	static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+	if (len >= sizeof(gzip_magic) &&
+			memcmp(buf, gzip_magic, sizeof(gzip_magic)) == 0) {
+		return (ASIGNIFY_COMPRESSION_GZIP);
+	}
+	if (len >= sizeof(zstd_magic) &&
+			memcmp(buf, zstd_magic, sizeof(zstd_magic)) == 0) {
+		return (ASIGNIFY_COMPRESSION_ZSTD);
+	}
+
+	return (ASIGNIFY_COMPRESSION_NONE);
+}
+
+struct asignify_decompress*
+asignify_decompress_init(enum asignify_compression type)
+{
+	struct asignify_decompress *d;
+
+	d = xmalloc0(sizeof(*d));
+	d->type = type;
+
+	switch (type) {
+#ifdef HAVE_ZLIB
+	case ASIGNIFY_COMPRESSION_GZIP:
+		/* 16 means gzip wrapper instead of zlib one */
+		if (inflateInit2(&d->zs, 15 + 16) != Z_OK) {
+			free(d);
+			return (NULL);
+		}
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case ASIGNIFY_COMPRESSION_ZSTD:
+		if ((d->zds = ZSTD_createDStream()) == NULL ||
+				ZSTD_isError(ZSTD_initDStream(d->zds))) {
+			ZSTD_freeDStream(d->zds);
+			free(d);
+			return (NULL);
+		}
+		break;
+#endif
+	default:
+		free(d);
+		return (NULL);
+	}
+
+	d->out = xmalloc(ASIGNIFY_DECOMPRESS_BUFSIZE);
+
+	return (d);
+}
+
+#ifdef HAVE_ZLIB
+static bool
+asignify_decompress_gzip(struct asignify_decompress *d,
+	const unsigned char *in, size_t len, asignify_decompress_cb cb, void *ud)
+{
+	size_t produced;
+	bool more = false;
+	int r;
+
+	d->zs.next_in = (unsigned char *)in;
+	d->zs.avail_in = len;
+
+	while (d->zs.avail_in > 0 || more) {
+		if (d->done) {
+			/* Concatenated members are valid gzip files as well */
+			if (inflateReset(&d->zs) != Z_OK) {
+				return (false);
+			}
+			d->done = false;
+		}
+
+		d->zs.next_out = d->out;
+		d->zs.avail_out = ASIGNIFY_DECOMPRESS_BUFSIZE;
+		r = inflate(&d->zs, Z_NO_FLUSH);
+		produced = ASIGNIFY_DECOMPRESS_BUFSIZE - d->zs.avail_out;
+
+		if (r == Z_STREAM_END) {
+			d->done = true;
+		}
+		else if (r == Z_BUF_ERROR && produced == 0) {
+			/* Needs more input */
+			break;
+		}
+		else if (r != Z_OK) {
+			return (false);
+		}
+
+		if (produced > 0 && !cb(ud, d->out, produced)) {
+			return (false);
+		}
+
+		more = !d->done && d->zs.avail_out == 0;
+	}
+
+	return (true);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static bool
+asignify_decompress_zstd(struct asignify_decompress *d,
+	const unsigned char *in, size_t len, asignify_decompress_cb cb, void *ud)
+{
+	ZSTD_inBuffer inb;
+	ZSTD_outBuffer outb;
+	size_t r;
+	bool more = false;
+
+	inb.src = in;
+	inb.size = len;
+	inb.pos = 0;
+
+	/* Subsequent frames are decoded by the same stream automatically */
+	while (inb.pos < inb.size || more) {
+		outb.dst = d->out;
+		outb.size = ASIGNIFY_DECOMPRESS_BUFSIZE;
+		outb.pos = 0;
+
+		r = ZSTD_decompressStream(d->zds, &outb, &inb);
+
+		if (ZSTD_isError(r)) {
+			return (false);
+		}
+
+		if (outb.pos > 0 && !cb(ud, d->out, outb.pos)) {
+			return (false);
+		}
+
+		d->done = (r == 0);
+		more = (outb.pos == outb.size);
+	}
+
+	return (true);
+}
+#endif
+
+bool
+asignify_decompress_update(struct asignify_decompress *d,
+	const unsigned char *in, size_t len, asignify_decompress_cb cb, void *ud)
+{
+	if (d == NULL || cb == NULL) {
+		return (false);
+	}
+
+	switch (d->type) {
+#ifdef HAVE_ZLIB
+	case ASIGNIFY_COMPRESSION_GZIP:
+		return (asignify_decompress_gzip(d, in, len, cb, ud));
+#endif
+#ifdef HAVE_ZSTD
+	case ASIGNIFY_COMPRESSION_ZSTD:
+		return (asignify_decompress_zstd(d, in, len, cb, ud));
+#endif
+	default:
+		break;
+	}
+
+	return (false);
+}
+
+bool
+asignify_decompress_finish(struct asignify_decompress *d)
+{
+	if (d == NULL) {
+		return (false);
+	}
+
+	return (d->done);
+}
+
+void
+asignify_decompress_free(struct asignify_decompress *d)
+{
+	if (d == NULL) {
+		return;
+	}
+
+	switch (d->type) {
+#ifdef HAVE_ZLIB
+	case ASIGNIFY_COMPRESSION_GZIP:
+		inflateEnd(&d->zs);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case ASIGNIFY_COMPRESSION_ZSTD:
+		ZSTD_freeDStream(d->zds);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	free(d->out);
+	free(d);
+}
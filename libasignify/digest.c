@@ -0,0 +1,593 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+#include "sha2.h"
+#include "blake2.h"
+
+#include "asignify_internal.h"
+
+/*
+ * Digests registry: every digest type is described once, and backends
+ * register their implementations on the first use of digests. The best
+ * (highest priority) streaming and file backends are selected at that time,
+ * so there is no per buffer dispatch over digest types.
+ */
+
+struct asignify_digest_desc {
+	const char *name;
+	unsigned int len;
+	const struct asignify_digest_backend *impl;
+	const struct asignify_digest_backend *fd_impl;
+	/* Measured throughput of impl in bytes per microsecond */
+	uint64_t speed;
+};
+
+struct asignify_digest_ctx {
+	const struct asignify_digest_backend *impl;
+	struct asignify_digest_ctx *tee;
+};
+
+/* Backend state follows the context aligned as required by blake2 */
+#define DIGEST_STATE_OFFSET 64
+#define DIGEST_STATE(ctx) ((void *)((unsigned char *)(ctx) + DIGEST_STATE_OFFSET))
+
+static struct asignify_digest_desc digests[ASIGNIFY_DIGEST_MAX] = {
+	[ASIGNIFY_DIGEST_SHA256] = {
+		.name = "SHA256",
+		.len = SHA256_DIGEST_LENGTH
+	},
+	[ASIGNIFY_DIGEST_SHA512] = {
+		.name = "SHA512",
+		.len = SHA512_DIGEST_LENGTH
+	},
+	[ASIGNIFY_DIGEST_BLAKE2] = {
+		.name = "BLAKE2",
+		.len = BLAKE2B_OUTBYTES
+	},
+	/* Pseudo digest: has a name but no implementation */
+	[ASIGNIFY_DIGEST_SIZE] = {
+		.name = "SIZE",
+		.len = 0
+	},
+	/* Modification time hint used to skip unchanged files on update */
+	[ASIGNIFY_DIGEST_MTIME] = {
+		.name = "MTIME",
+		.len = 0
+	}
+};
+
+/*
+ * Reference implementations
+ */
+static void
+ref_sha256_init(void *st)
+{
+	SHA256Init(st);
+}
+
+static void
+ref_sha256_update(void *st, const unsigned char *buf, size_t len)
+{
+	SHA256Update(st, buf, len);
+}
+
+static void
+ref_sha256_final(void *st, unsigned char *out)
+{
+	SHA256Final(out, st);
+}
+
+static void
+ref_sha512_init(void *st)
+{
+	SHA512Init(st);
+}
+
+static void
+ref_sha512_update(void *st, const unsigned char *buf, size_t len)
+{
+	SHA512Update(st, buf, len);
+}
+
+static void
+ref_sha512_final(void *st, unsigned char *out)
+{
+	SHA512Final(out, st);
+}
+
+static void
+ref_blake2_init(void *st)
+{
+	blake2b_init(st, BLAKE2B_OUTBYTES);
+}
+
+static void
+ref_blake2_update(void *st, const unsigned char *buf, size_t len)
+{
+	blake2b_update(st, buf, len);
+}
+
+static void
+ref_blake2_final(void *st, unsigned char *out)
+{
+	blake2b_final(st, out, BLAKE2B_OUTBYTES);
+}
+
+static const struct asignify_digest_backend ref_backends[] = {
+	{
+		.name = "ref",
+		.type = ASIGNIFY_DIGEST_SHA256,
+		.priority = ASIGNIFY_DIGEST_PRIO_REF,
+		.state_size = sizeof(SHA2_CTX),
+		.init = ref_sha256_init,
+		.update = ref_sha256_update,
+		.final = ref_sha256_final
+	},
+	{
+		.name = "ref",
+		.type = ASIGNIFY_DIGEST_SHA512,
+		.priority = ASIGNIFY_DIGEST_PRIO_REF,
+		.state_size = sizeof(SHA2_CTX),
+		.init = ref_sha512_init,
+		.update = ref_sha512_update,
+		.final = ref_sha512_final
+	},
+	{
+		.name = "ref",
+		.type = ASIGNIFY_DIGEST_BLAKE2,
+		.priority = ASIGNIFY_DIGEST_PRIO_REF,
+		.state_size = sizeof(blake2b_state),
+		.init = ref_blake2_init,
+		.update = ref_blake2_update,
+		.final = ref_blake2_final
+	}
+};
+
+#ifdef HAVE_OPENSSL
+/*
+ * OpenSSL implementations, state is just a pointer to EVP context
+ */
+static void
+ossl_sha256_init(void *st)
+{
+	EVP_MD_CTX **mdctx = st;
+
+	*mdctx = EVP_MD_CTX_create();
+	EVP_DigestInit_ex(*mdctx, EVP_sha256(), NULL);
+}
+
+static void
+ossl_sha512_init(void *st)
+{
+	EVP_MD_CTX **mdctx = st;
+
+	*mdctx = EVP_MD_CTX_create();
+	EVP_DigestInit_ex(*mdctx, EVP_sha512(), NULL);
+}
+
+static void
+ossl_update(void *st, const unsigned char *buf, size_t len)
+{
+	EVP_MD_CTX **mdctx = st;
+
+	EVP_DigestUpdate(*mdctx, buf, len);
+}
+
+static void
+ossl_final(void *st, unsigned char *out)
+{
+	EVP_MD_CTX **mdctx = st;
+	unsigned int len;
+
+	EVP_DigestFinal(*mdctx, out, &len);
+	EVP_MD_CTX_destroy(*mdctx);
+}
+
+static const struct asignify_digest_backend ossl_backends[] = {
+	{
+		.name = "openssl",
+		.type = ASIGNIFY_DIGEST_SHA256,
+		.priority = ASIGNIFY_DIGEST_PRIO_ACCEL,
+		.state_size = sizeof(EVP_MD_CTX *),
+		.init = ossl_sha256_init,
+		.update = ossl_update,
+		.final = ossl_final
+	},
+	{
+		.name = "openssl",
+		.type = ASIGNIFY_DIGEST_SHA512,
+		.priority = ASIGNIFY_DIGEST_PRIO_ACCEL,
+		.state_size = sizeof(EVP_MD_CTX *),
+		.init = ossl_sha512_init,
+		.update = ossl_update,
+		.final = ossl_final
+	}
+};
+#endif
+
+void
+asignify_digest_register(const struct asignify_digest_backend *b)
+{
+	struct asignify_digest_desc *d;
+
+	if (b == NULL || b->type >= ASIGNIFY_DIGEST_SIZE) {
+		return;
+	}
+
+	d = &digests[b->type];
+
+	if (b->init != NULL && b->update != NULL && b->final != NULL) {
+		if (d->impl == NULL || d->impl->priority < b->priority) {
+			d->impl = b;
+		}
+	}
+
+	if (b->digest_fd != NULL) {
+		if (d->fd_impl == NULL || d->fd_impl->priority < b->priority) {
+			d->fd_impl = b;
+		}
+	}
+}
+
+static void
+asignify_digest_registry_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(ref_backends) / sizeof(ref_backends[0]); i ++) {
+		asignify_digest_register(&ref_backends[i]);
+	}
+#ifdef HAVE_OPENSSL
+	for (i = 0; i < sizeof(ossl_backends) / sizeof(ossl_backends[0]); i ++) {
+		asignify_digest_register(&ossl_backends[i]);
+	}
+#endif
+	asignify_afalg_register();
+}
+
+static const struct asignify_digest_desc *
+asignify_digest_get(enum asignify_digest_type type)
+{
+#ifdef HAVE_PTHREAD
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, asignify_digest_registry_init);
+#else
+	static bool initialized = false;
+
+	if (!initialized) {
+		asignify_digest_registry_init();
+		initialized = true;
+	}
+#endif
+
+	if (type >= ASIGNIFY_DIGEST_MAX) {
+		return (NULL);
+	}
+
+	return (&digests[type]);
+}
+
+unsigned int
+asignify_digest_len(enum asignify_digest_type type)
+{
+	const struct asignify_digest_desc *d = asignify_digest_get(type);
+
+	return (d != NULL ? d->len : 0);
+}
+
+const char *
+asignify_digest_name(enum asignify_digest_type type)
+{
+	const struct asignify_digest_desc *d = asignify_digest_get(type);
+
+	return (d != NULL ? d->name : "");
+}
+
+enum asignify_digest_type
+asignify_digest_from_str(const char *data, ssize_t dlen)
+{
+	unsigned int i;
+	const struct asignify_digest_desc *d;
+
+	for (i = 0; i < ASIGNIFY_DIGEST_MAX; i ++) {
+		d = asignify_digest_get(i);
+
+		if (d->name != NULL && dlen == (ssize_t)strlen(d->name) &&
+				strncasecmp(data, d->name, dlen) == 0) {
+			return (i);
+		}
+	}
+
+	return (ASIGNIFY_DIGEST_MAX);
+}
+
+struct asignify_digest_ctx *
+asignify_digest_init(enum asignify_digest_type type)
+{
+	const struct asignify_digest_desc *d = asignify_digest_get(type);
+	struct asignify_digest_ctx *ctx;
+
+	if (d == NULL || d->impl == NULL) {
+		return (NULL);
+	}
+
+	ctx = xmalloc_aligned(64, DIGEST_STATE_OFFSET + d->impl->state_size);
+	ctx->impl = d->impl;
+	ctx->tee = NULL;
+	ctx->impl->init(DIGEST_STATE(ctx));
+
+	return (ctx);
+}
+
+void
+asignify_digest_update(struct asignify_digest_ctx *ctx,
+	const unsigned char *buf, size_t len)
+{
+	ctx->impl->update(DIGEST_STATE(ctx), buf, len);
+
+	if (ctx->tee != NULL) {
+		asignify_digest_update(ctx->tee, buf, len);
+	}
+}
+
+void
+asignify_digest_tee(struct asignify_digest_ctx *ctx,
+	struct asignify_digest_ctx *tee)
+{
+	ctx->tee = tee;
+}
+
+unsigned char *
+asignify_digest_final(struct asignify_digest_ctx *ctx)
+{
+	unsigned char *res;
+
+	res = xmalloc(digests[ctx->impl->type].len);
+	ctx->impl->final(DIGEST_STATE(ctx), res);
+	explicit_memzero(DIGEST_STATE(ctx), ctx->impl->state_size);
+	free(ctx);
+
+	return (res);
+}
+
+void
+asignify_digest_free(struct asignify_digest_ctx *ctx)
+{
+	if (ctx != NULL) {
+		free(asignify_digest_final(ctx));
+	}
+}
+
+/*
+ * Speed of backends depends on CPU features and build options, so digests
+ * are ranked by hashing a small buffer once per process
+ */
+static void
+asignify_digest_speeds_init(void)
+{
+	struct asignify_digest_ctx *ctx;
+	struct timespec ts1, ts2;
+	unsigned char *buf;
+	uint64_t usec;
+	unsigned int i;
+
+	buf = xmalloc0(ASIGNIFY_DIGEST_BENCH_SIZE);
+
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		if ((ctx = asignify_digest_init(i)) == NULL) {
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		asignify_digest_update(ctx, buf, ASIGNIFY_DIGEST_BENCH_SIZE);
+		asignify_digest_free(ctx);
+		clock_gettime(CLOCK_MONOTONIC, &ts2);
+
+		usec = (ts2.tv_sec - ts1.tv_sec) * 1000000ULL +
+			(ts2.tv_nsec - ts1.tv_nsec) / 1000;
+		digests[i].speed = ASIGNIFY_DIGEST_BENCH_SIZE / (usec > 0 ? usec : 1);
+	}
+
+	free(buf);
+}
+
+uint64_t
+asignify_digest_speed(enum asignify_digest_type type)
+{
+#ifdef HAVE_PTHREAD
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, asignify_digest_speeds_init);
+#else
+	static bool initialized = false;
+
+	if (!initialized) {
+		asignify_digest_speeds_init();
+		initialized = true;
+	}
+#endif
+
+	if (type >= ASIGNIFY_DIGEST_SIZE) {
+		return (0);
+	}
+
+	return (digests[type].speed);
+}
+
+unsigned char*
+asignify_digest_fd(enum asignify_digest_type type, int fd)
+{
+	return (asignify_digest_fd_cancel(type, fd, NULL));
+}
+
+unsigned char*
+asignify_digest_fd_cancel(enum asignify_digest_type type, int fd,
+	const asignify_cancel_t *cancel)
+{
+	ssize_t r;
+	struct stat st;
+	struct asignify_pipe *pipe;
+	const struct asignify_digest_desc *d;
+	const unsigned char *buf;
+	unsigned char *res;
+	struct asignify_digest_ctx *dgst;
+
+	if (fd == -1 || type >= ASIGNIFY_DIGEST_SIZE ||
+			fstat(fd, &st) == -1) {
+		return (NULL);
+	}
+
+	if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
+		return (NULL);
+	}
+
+	d = asignify_digest_get(type);
+
+	/* Some backends can hash files without reading them to userspace */
+	if (d->fd_impl != NULL && S_ISREG(st.st_mode) &&
+			st.st_size >= d->fd_impl->fd_min_size &&
+			(res = d->fd_impl->digest_fd(type, fd, cancel)) != NULL) {
+		return (res);
+	}
+
+	if ((dgst = asignify_digest_init(type)) == NULL) {
+		return (NULL);
+	}
+
+	/* Large files are read by a separate thread while we are hashing */
+	pipe = asignify_pipe_reader(fd, S_ISREG(st.st_mode) ? st.st_size : -1);
+	asignify_pipe_set_cancel(pipe, cancel);
+
+	while ((r = asignify_pipe_read(pipe, &buf)) > 0) {
+		asignify_digest_update(dgst, buf, r);
+	}
+
+	asignify_pipe_close(pipe);
+	res = asignify_digest_final(dgst);
+
+	if (r == -1) {
+		/* Digest of a partially read file is meaningless */
+		free(res);
+		res = NULL;
+	}
+
+	return (res);
+}
+
+bool
+asignify_digest_fd_multi(int fd, unsigned int types, unsigned char **out,
+	const asignify_cancel_t *cancel)
+{
+	ssize_t r;
+	struct stat st;
+	struct asignify_pipe *pipe;
+	struct asignify_digest_ctx *dgst[ASIGNIFY_DIGEST_SIZE];
+	const unsigned char *buf;
+	unsigned int i, n = 0;
+
+	memset(dgst, 0, sizeof(dgst));
+
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		out[i] = NULL;
+
+		if (types & ASIGNIFY_DIGEST_BIT(i)) {
+			n ++;
+		}
+	}
+
+	if (n == 0 || (types & ~(ASIGNIFY_DIGEST_BIT(ASIGNIFY_DIGEST_SIZE) - 1))) {
+		return (false);
+	}
+
+	if (n == 1) {
+		/* A single digest can still be computed by a file backend */
+		for (i = 0; !(types & ASIGNIFY_DIGEST_BIT(i)); i ++);
+		out[i] = asignify_digest_fd_cancel(i, fd, cancel);
+
+		return (out[i] != NULL);
+	}
+
+	if (fd == -1 || fstat(fd, &st) == -1 ||
+			lseek(fd, 0, SEEK_SET) == (off_t)-1) {
+		return (false);
+	}
+
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		if ((types & ASIGNIFY_DIGEST_BIT(i)) &&
+				(dgst[i] = asignify_digest_init(i)) == NULL) {
+			r = -1;
+			goto cleanup;
+		}
+	}
+
+	/* All digests are updated from the same buffers, so data is read once */
+	pipe = asignify_pipe_reader(fd, S_ISREG(st.st_mode) ? st.st_size : -1);
+	asignify_pipe_set_cancel(pipe, cancel);
+
+	while ((r = asignify_pipe_read(pipe, &buf)) > 0) {
+		for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+			if (dgst[i] != NULL) {
+				asignify_digest_update(dgst[i], buf, r);
+			}
+		}
+	}
+
+	asignify_pipe_close(pipe);
+
+cleanup:
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		if (dgst[i] == NULL) {
+			continue;
+		}
+
+		if (r == -1) {
+			asignify_digest_free(dgst[i]);
+		}
+		else {
+			out[i] = asignify_digest_final(dgst[i]);
+		}
+	}
+
+	return (r != -1);
+}
@@ -46,12 +46,12 @@
 #define ENCRYPTED_SIGNATURE_MAGIC "chacha20-blake2"
 #define CHACHA_ROUNDS_SAFE 20
 #define CHACHA_ROUNDS_FAST 8
-
-struct asignify_encrypt_ctx {
-	struct asignify_private_data *privk;
-	struct asignify_public_data *pubk;
-	const char *error;
-};
+/* Version codes of chacha files are 100 + rounds */
+#define ENCRYPTED_VERSION_AESGCM 256
+/* Volume indexes are ASIGNIFY_SEAL_VOLUMES + rounds */
+#define ENCRYPTED_VERSION_MAX (ASIGNIFY_SEAL_VOLUMES + CHACHA_ROUNDS_SAFE)
+#define ENCRYPTED_IS_VOLUMES(v) ((v) == ASIGNIFY_SEAL_VOLUMES + CHACHA_ROUNDS_SAFE || \
+	(v) == ASIGNIFY_SEAL_VOLUMES + CHACHA_ROUNDS_FAST)
 
 asignify_encrypt_t*
 asignify_encrypt_init(void)
@@ -121,34 +121,15 @@ asignify_encrypt_load_pubkey(asignify_encrypt_t *ctx, const char *pubf)
 }
 
 #define ENCRYPTED_PAYLOAD_LEN (crypto_box_NONCEBYTES + crypto_box_ZEROBYTES + 8 + 32)
+/* Session nonce and key */
+#define ENCRYPTED_SESSION_LEN (8 + 32)
 #define ENCRYPT_VERIFY_SIG_LEN (BLAKE2B_OUTBYTES + crypto_sign_BYTES + sizeof(ENCRYPTED_SIGNATURE_MAGIC) - 1)
+#define ENCRYPT_B64_LEN (ENCRYPTED_PAYLOAD_LEN * 2)
 
-bool
-asignify_encrypt_crypt_file(asignify_encrypt_t *ctx, unsigned int version,
-	const char *inf, const char *outf, enum asignify_encrypt_type type)
+static bool
+asignify_encrypt_check_keys(asignify_encrypt_t *ctx)
 {
-	FILE *in, *out;
-	int out_fd, r;
-	off_t sig_pos = 0;
-	struct stat st;
-	unsigned char curvepk[crypto_box_PUBLICKEYBYTES],
-		curvesk[crypto_box_SECRETKEYBYTES],
-		session_key[ENCRYPTED_PAYLOAD_LEN], *p,
-		dig[ENCRYPT_VERIFY_SIG_LEN];
-	char *b64;
-	blake2b_state sh;
-	chacha_state enc_st;
-	bool ret = false;
-	int rounds;
-	unsigned long long outlen;
-#if BUFSIZ >= 2048
-	CHACHA_ALIGN( 64 ) unsigned char buf[BUFSIZ], outbuf[BUFSIZ];
-#else
-	/* BUFSIZ is insanely small */
-	CHACHA_ALIGN( 64 ) unsigned char buf[4096], outbuf[4096];
-#endif
-
-	if (ctx == NULL || ctx->privk == NULL || ctx->pubk == NULL || version != 1) {
+	if (ctx == NULL || ctx->privk == NULL || ctx->pubk == NULL) {
 		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
 		return (false);
 	}
@@ -159,32 +140,21 @@ asignify_encrypt_crypt_file(asignify_encrypt_t *ctx, unsigned int version,
 			ctx->error = xerr_string(ASIGNIFY_ERROR_WRONG_KEYPAIR);
 			return (false);
 		}
-
-	}
-
-	in = xfopen(inf, "r");
-
-	if (in == NULL) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		return (false);
-	}
-
-	out = xfopen(outf, "w");
-	if (out == NULL) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		fclose(in);
-		return (false);
 	}
 
-	/* Since we need to seek, we must ensure that the file is a normal file */
-	out_fd = fileno(out);
-	if (fstat(out_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
-		fclose(out);
-		fclose(in);
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	return (true);
+}
 
-		return (false);
-	}
+/*
+ * Generates a random session nonce and key, copies them to payload and seals
+ * them for the peer in session_key
+ */
+static void
+asignify_encrypt_session_new(asignify_encrypt_t *ctx,
+	unsigned char *session_key, unsigned char *payload)
+{
+	unsigned char curvepk[crypto_box_PUBLICKEYBYTES],
+		curvesk[crypto_box_SECRETKEYBYTES], *p;
 
 	crypto_sign_ed25519_sk_to_curve25519(curvesk, ctx->privk->data);
 	crypto_sign_ed25519_pk_to_curve25519(curvepk, ctx->pubk->data);
@@ -199,16 +169,7 @@ asignify_encrypt_crypt_file(asignify_encrypt_t *ctx, unsigned int version,
 	p += 8;
 	randombytes(p, 32);
 
-	version *= 100;
-	if (type == ASIGNIFY_ENCRYPT_SAFE) {
-		rounds = CHACHA_ROUNDS_SAFE;
-	}
-	else {
-		rounds = CHACHA_ROUNDS_FAST;
-	}
-	version += rounds;
-
-	chacha_init(&enc_st, (chacha_key *)p, (chacha_iv *)(p - 8), rounds);
+	memcpy(payload, p - 8, ENCRYPTED_SESSION_LEN);
 
 	/* Encrypt now the session key */
 	crypto_box(session_key + crypto_box_NONCEBYTES, /* begin of cryptobox */
@@ -217,214 +178,206 @@ asignify_encrypt_crypt_file(asignify_encrypt_t *ctx, unsigned int version,
 		session_key, /* session nonce */
 		curvepk, curvesk);
 
-	/* Write key header */
-	memset(dig, 0, crypto_sign_BYTES);
-	b64 = xmalloc(ENCRYPTED_PAYLOAD_LEN * 2);
-	b64_ntop(ctx->pubk->id, ctx->pubk->id_len, b64, ENCRYPTED_PAYLOAD_LEN * 2);
-	fprintf(out, "%s%d:%s:", ENCRYPTED_MAGIC, version, b64);
-	b64_ntop(session_key, ENCRYPTED_PAYLOAD_LEN, b64, ENCRYPTED_PAYLOAD_LEN * 2);
-	fprintf(out, "%s:", b64);
+	explicit_memzero(curvesk, sizeof(curvesk));
+}
 
-	/* Write fake signature */
-	fflush(out);
-	sig_pos = ftell(out);
-	b64_ntop(dig, crypto_sign_BYTES, b64, ENCRYPTED_PAYLOAD_LEN * 2);
-	fprintf(out, "%s\n", b64);
+/*
+ * Writes header up to the signature field
+ */
+static bool
+asignify_encrypt_write_header(asignify_encrypt_t *ctx, unsigned int version,
+	const unsigned char *session_key, FILE *out)
+{
+	char b64[ENCRYPT_B64_LEN];
 
-	blake2b_init(&sh, BLAKE2B_OUTBYTES);
-	blake2b_update(&sh, session_key, sizeof(session_key));
+	b64_ntop(ctx->pubk->id, ctx->pubk->id_len, b64, sizeof(b64));
+	if (fprintf(out, "%s%d:%s:", ENCRYPTED_MAGIC, version, b64) < 0) {
+		return (false);
+	}
+	b64_ntop((unsigned char *)session_key, ENCRYPTED_PAYLOAD_LEN, b64,
+		sizeof(b64));
 
-	while((r = fread(buf, 1, sizeof(buf), in)) > 0) {
-		r = chacha_update(&enc_st, buf, outbuf, r);
-		blake2b_update(&sh, outbuf, r);
+	return (fprintf(out, "%s:", b64) > 0);
+}
 
-		if (fwrite(outbuf, 1, r, out) != r) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+static bool
+asignify_encrypt_write_sig(const unsigned char *sig, FILE *out, bool newline)
+{
+	char b64[ENCRYPT_B64_LEN];
 
-			goto cleanup;
-		}
-	}
+	b64_ntop((unsigned char *)sig, crypto_sign_BYTES, b64, sizeof(b64));
 
-	if ((r = chacha_final(&enc_st, outbuf)) > 0) {
-		blake2b_update(&sh, outbuf, r);
-		if (fwrite(outbuf, 1, r, out) != r) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	return (fprintf(out, newline ? "%s\n" : "%s", b64) > 0);
+}
 
-			goto cleanup;
-		}
-	}
+/*
+ * Signs the MAC (blake2b over the sealed session key and ciphertext)
+ */
+static void
+asignify_encrypt_mac_sign(asignify_encrypt_t *ctx, blake2b_state *sh,
+	unsigned char *sig)
+{
+	unsigned char dig[ENCRYPT_VERIFY_SIG_LEN], *p;
+	unsigned long long outlen;
 
-	/* Now we need to calculate signature */
 	p = dig;
-	memset(p, 0, sizeof(crypto_sign_BYTES));
+	memset(p, 0, crypto_sign_BYTES);
 	p += crypto_sign_BYTES;
 	memcpy(p, ENCRYPTED_SIGNATURE_MAGIC, sizeof(ENCRYPTED_SIGNATURE_MAGIC) - 1);
 	p += sizeof(ENCRYPTED_SIGNATURE_MAGIC) - 1;
-	blake2b_final(&sh, p, BLAKE2B_OUTBYTES);
+	blake2b_final(sh, p, BLAKE2B_OUTBYTES);
 
 	outlen = sizeof(dig);
 	crypto_sign(dig, &outlen,
 		dig + crypto_sign_BYTES,
 		sizeof(dig) - crypto_sign_BYTES,
 		ctx->privk->data);
-
-	fflush(out);
-	/* Now rewind to the signature place and overwrite the fake signature */
-	if (fseek(out, sig_pos, SEEK_SET) != 0) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-
-		goto cleanup;
-	}
-
-	b64_ntop(dig, crypto_sign_BYTES, b64, ENCRYPTED_PAYLOAD_LEN * 2);
-	fprintf(out, "%s", b64);
-
-	ret = true;
-
-cleanup:
-	fclose(out);
-	fclose(in);
-	explicit_memzero(&enc_st, sizeof(enc_st));
-	return (ret);
+	memcpy(sig, dig, crypto_sign_BYTES);
 }
 
-bool
-asignify_encrypt_decrypt_file(asignify_encrypt_t *ctx,
-	const char *inf, const char *outf)
+static bool
+asignify_encrypt_mac_verify(asignify_encrypt_t *ctx, blake2b_state *sh,
+	const unsigned char *sig)
 {
-	FILE *in, *out;
-	int in_fd, r;
-	off_t sig_pos = 0;
-	struct stat st;
-	unsigned char curvepk[crypto_box_PUBLICKEYBYTES],
-		curvesk[crypto_box_SECRETKEYBYTES],
-		session_key[ENCRYPTED_PAYLOAD_LEN], *p,
-		dig[ENCRYPT_VERIFY_SIG_LEN];
-	char *line = NULL;
-	size_t linelen = 0;
-	struct asignify_public_data *enc = NULL;
-	blake2b_state sh;
-	chacha_state enc_st;
-	SHA2_CTX dig_st;
-	int rounds;
+	unsigned char dig[ENCRYPT_VERIFY_SIG_LEN], *p;
 	unsigned char h[crypto_sign_HASHBYTES];
-	bool ret = false;
-#if BUFSIZ >= 2048
-	CHACHA_ALIGN( 64 ) unsigned char buf[BUFSIZ], outbuf[BUFSIZ];
-#else
-	/* BUFSIZ is insanely small */
-	CHACHA_ALIGN( 64 ) unsigned char buf[4096], outbuf[4096];
-#endif
-
-	if (ctx == NULL || ctx->privk == NULL || ctx->pubk == NULL) {
-		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
-		return (false);
-	}
-
-	/* Ensure that we are not trying to encrypt using the related keypair */
-	if (ctx->pubk->id_len == ctx->privk->id_len && ctx->privk->id_len > 0) {
-		if (memcmp(ctx->pubk->id, ctx->privk->id, ctx->privk->id_len) == 0) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_WRONG_KEYPAIR);
-			return (false);
-		}
-
-	}
+	SHA2_CTX dig_st;
+	bool ret;
 
-	in = xfopen(inf, "r");
+	p = dig;
+	memcpy(p, sig, crypto_sign_BYTES);
+	p += crypto_sign_BYTES;
+	memcpy(p, ENCRYPTED_SIGNATURE_MAGIC, sizeof(ENCRYPTED_SIGNATURE_MAGIC) - 1);
+	p += sizeof(ENCRYPTED_SIGNATURE_MAGIC) - 1;
+	blake2b_final(sh, p, BLAKE2B_OUTBYTES);
 
-	if (in == NULL) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		return (false);
-	}
+	SHA512Init(&dig_st);
+	SHA512Update(&dig_st, dig, 32);
+	SHA512Update(&dig_st, ctx->pubk->data, 32);
+	SHA512Update(&dig_st, dig + crypto_sign_BYTES, sizeof(dig) - crypto_sign_BYTES);
+	SHA512Final(h, &dig_st);
 
-	out = xfopen(outf, "w");
-	if (out == NULL) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		fclose(in);
-		return (false);
-	}
+	ret = (crypto_sign_verify_detached(dig, h, ctx->pubk->data) == 0);
+	explicit_memzero(h, sizeof(h));
 
-	/* Since we need to seek, we must ensure that the file is a normal file */
-	in_fd = fileno(in);
-	if (fstat(in_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		goto cleanup;
-	}
+	return (ret);
+}
 
-	if ((r = getline(&line, &linelen, in)) < 0) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		goto cleanup;
-	}
+/*
+ * Parses the header line, returns sealed session key and decoded signature
+ */
+static struct asignify_public_data *
+asignify_encrypt_parse_header(asignify_encrypt_t *ctx, const char *line,
+	size_t len, int *rounds, unsigned char *sig)
+{
+	struct asignify_public_data *enc;
 
-	enc = asignify_public_data_load(line, r, ENCRYPTED_MAGIC,
-		sizeof(ENCRYPTED_MAGIC) - 1, 1, 120, ctx->privk->id_len, ENCRYPTED_PAYLOAD_LEN);
+	/* Peer's key id is not known without our private key */
+	enc = asignify_public_data_load(line, len, ENCRYPTED_MAGIC,
+		sizeof(ENCRYPTED_MAGIC) - 1, 1, ENCRYPTED_VERSION_MAX,
+		ctx->privk != NULL ? ctx->privk->id_len : ctx->pubk->id_len,
+		ENCRYPTED_PAYLOAD_LEN);
 	if (enc == NULL || enc->aux == NULL) {
 		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
-		goto cleanup;
+		asignify_public_data_free(enc);
+		return (NULL);
 	}
 
 	if (enc->version == 1) {
 		/* Old format without rounds */
-		rounds = CHACHA_ROUNDS_SAFE;
+		*rounds = CHACHA_ROUNDS_SAFE;
+	}
+	else if (enc->version == ENCRYPTED_VERSION_AESGCM) {
+		/* Zero rounds mean AES-GCM chunks */
+		*rounds = 0;
 	}
 	else if (enc->version == 120) {
-		rounds = CHACHA_ROUNDS_SAFE;
+		*rounds = CHACHA_ROUNDS_SAFE;
 	}
 	else if (enc->version == 108) {
-		rounds = CHACHA_ROUNDS_FAST;
+		*rounds = CHACHA_ROUNDS_FAST;
+	}
+	else if (ENCRYPTED_IS_VOLUMES(enc->version)) {
+		*rounds = enc->version - ASIGNIFY_SEAL_VOLUMES;
 	}
 	else {
 		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
-		goto cleanup;
+		asignify_public_data_free(enc);
+		return (NULL);
 	}
 
-	if (ctx->privk->id_len > 0 && (ctx->privk->id_len != enc->id_len ||
+	if (ctx->privk != NULL && ctx->privk->id_len > 0 &&
+			(ctx->privk->id_len != enc->id_len ||
 			memcmp(ctx->privk->id, enc->id, enc->id_len) != 0)) {
 		ctx->error = xerr_string(ASIGNIFY_ERROR_WRONG_KEY);
-		goto cleanup;
+		asignify_public_data_free(enc);
+		return (NULL);
 	}
 
 	/*
 	 * Now we have encrypted session key in enc->data and signature in
 	 * enc->aux, so decode aux first (aux is null terminated)
 	 */
-	if (b64_pton((const char*)enc->aux, dig, crypto_sign_BYTES) != crypto_sign_BYTES) {
+	if (b64_pton((const char*)enc->aux, sig, crypto_sign_BYTES) != crypto_sign_BYTES) {
 		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
-		goto cleanup;
+		asignify_public_data_free(enc);
+		return (NULL);
 	}
 
-	sig_pos = ftell(in);
+	return (enc);
+}
+
+/*
+ * Authenticates sealed session key and ciphertext: data (if any) is the
+ * beginning of ciphertext that has been read together with the header
+ */
+static bool
+asignify_encrypt_mac_pass(asignify_encrypt_t *ctx, struct asignify_pipe *rd,
+	struct asignify_public_data *enc, const unsigned char *sig,
+	const unsigned char *data, size_t len)
+{
+	blake2b_state sh;
+	const unsigned char *buf;
+	ssize_t r;
 
 	blake2b_init(&sh, BLAKE2B_OUTBYTES);
 	blake2b_update(&sh, enc->data, enc->data_len);
 
-	while((r = fread(buf, 1, sizeof(buf), in)) > 0) {
-		blake2b_update(&sh, buf, r);
+	if (len > 0) {
+		blake2b_update(&sh, data, len);
 	}
 
-	p = dig;
-	p += crypto_sign_BYTES;
-	memcpy(p, ENCRYPTED_SIGNATURE_MAGIC, sizeof(ENCRYPTED_SIGNATURE_MAGIC) - 1);
-	p += sizeof(ENCRYPTED_SIGNATURE_MAGIC) - 1;
-	blake2b_final(&sh, p, BLAKE2B_OUTBYTES);
+	asignify_pipe_set_cancel(rd, ctx->cancel);
 
-	SHA512Init(&dig_st);
-	SHA512Update(&dig_st, dig, 32);
-	SHA512Update(&dig_st, ctx->pubk->data, 32);
-	SHA512Update(&dig_st, dig + crypto_sign_BYTES, sizeof(dig) - crypto_sign_BYTES);
-	SHA512Final(h, &dig_st);
+	while ((r = asignify_pipe_read(rd, &buf)) > 0) {
+		blake2b_update(&sh, buf, r);
+	}
 
-	if (crypto_sign_verify_detached(dig, h, ctx->pubk->data) != 0) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
-		goto cleanup;
+	if (r == -1) {
+		ctx->error = xerr_string(asignify_io_error(ctx->cancel));
+		return (false);
 	}
 
-	if (fseek(in, sig_pos, SEEK_SET) != 0) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		goto cleanup;
+	if (!asignify_encrypt_mac_verify(ctx, &sh, sig)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
+		return (false);
 	}
 
-	/* We have successfully verified signature, so we can process with output */
+	return (true);
+}
+
+/*
+ * Opens the sealed session key and copies session nonce and key to payload
+ */
+static bool
+asignify_encrypt_session_unseal(asignify_encrypt_t *ctx,
+	struct asignify_public_data *enc, unsigned char *payload)
+{
+	unsigned char curvepk[crypto_box_PUBLICKEYBYTES],
+		curvesk[crypto_box_SECRETKEYBYTES],
+		session_key[ENCRYPTED_PAYLOAD_LEN], *p;
+	bool ret = true;
+
 	crypto_sign_ed25519_sk_to_curve25519(curvesk, ctx->privk->data);
 	crypto_sign_ed25519_pk_to_curve25519(curvepk, ctx->pubk->data);
 
@@ -437,31 +390,114 @@ asignify_encrypt_decrypt_file(asignify_encrypt_t *ctx,
 			curvepk, curvesk) != 0) {
 
 		ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
-		goto cleanup;
+		ret = false;
+	}
+	else {
+		/* Move to the real payload */
+		p = session_key + crypto_box_ZEROBYTES + crypto_box_NONCEBYTES;
+		memcpy(payload, p, ENCRYPTED_SESSION_LEN);
 	}
-
-	/* Move to the real payload */
-	p = session_key + crypto_box_ZEROBYTES + crypto_box_NONCEBYTES;
-	chacha_init(&enc_st, (chacha_key *)(p + 8), (chacha_iv *)p, rounds);
 
 	explicit_memzero(session_key, sizeof(session_key));
+	explicit_memzero(curvesk, sizeof(curvesk));
 
-	/* Write decrypted data */
+	return (ret);
+}
+
+/*
+ * Opens the sealed session key and initializes chacha with it
+ */
+static bool
+asignify_encrypt_session_open(asignify_encrypt_t *ctx,
+	struct asignify_public_data *enc, int rounds, chacha_state *st)
+{
+	unsigned char payload[ENCRYPTED_SESSION_LEN];
 
-	while((r = fread(buf, 1, sizeof(buf), in)) > 0) {
-		r = chacha_update(&enc_st, buf, outbuf, r);
+	if (!asignify_encrypt_session_unseal(ctx, enc, payload)) {
+		return (false);
+	}
 
-		if (fwrite(outbuf, 1, r, out) != r) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	chacha_init(st, (chacha_key *)(payload + 8), (chacha_iv *)payload, rounds);
+	explicit_memzero(payload, sizeof(payload));
+
+	return (true);
+}
+
+int
+asignify_encrypt_rounds(enum asignify_encrypt_type type)
+{
+	if (type == ASIGNIFY_ENCRYPT_SAFE) {
+		return (CHACHA_ROUNDS_SAFE);
+	}
+
+	return (CHACHA_ROUNDS_FAST);
+}
+
+bool
+asignify_encrypt_shared_key(asignify_encrypt_t *ctx, unsigned char *k)
+{
+	unsigned char curvepk[crypto_box_PUBLICKEYBYTES],
+		curvesk[crypto_box_SECRETKEYBYTES];
 
+	if (!asignify_encrypt_check_keys(ctx)) {
+		return (false);
+	}
+
+	crypto_sign_ed25519_sk_to_curve25519(curvesk, ctx->privk->data);
+	crypto_sign_ed25519_pk_to_curve25519(curvepk, ctx->pubk->data);
+	crypto_box_beforenm(k, curvepk, curvesk);
+	explicit_memzero(curvesk, sizeof(curvesk));
+
+	return (true);
+}
+
+/*
+ * Reading, encryption and writing are overlapped: input and output are
+ * processed by I/O threads whilst we are doing chacha and blake2 (if sh is
+ * not NULL, ciphertext written is authenticated)
+ */
+static bool
+asignify_encrypt_stream(asignify_encrypt_t *ctx, int in_fd, int out_fd,
+	off_t size_hint, chacha_state *st, blake2b_state *sh)
+{
+	struct asignify_pipe *rd, *wr;
+	const unsigned char *buf;
+	unsigned char *outbuf;
+	ssize_t r;
+	bool ret = false;
+
+	rd = asignify_pipe_reader(in_fd, size_hint);
+	wr = asignify_pipe_writer(out_fd, size_hint);
+	asignify_pipe_set_cancel(rd, ctx->cancel);
+	asignify_pipe_set_cancel(wr, ctx->cancel);
+
+	while((r = asignify_pipe_read(rd, &buf)) > 0) {
+		/* Output of chacha is never larger than a full input chunk */
+		if ((outbuf = asignify_pipe_get_buf(wr)) == NULL) {
+			goto cleanup;
+		}
+
+		r = chacha_update(st, buf, outbuf, r);
+
+		if (sh != NULL) {
+			blake2b_update(sh, outbuf, r);
+		}
+
+		if (!asignify_pipe_write(wr, r)) {
 			goto cleanup;
 		}
 	}
 
-	if ((r = chacha_final(&enc_st, outbuf)) > 0) {
-		if (fwrite(outbuf, 1, r, out) != r) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	if (r == -1 || (outbuf = asignify_pipe_get_buf(wr)) == NULL) {
+		goto cleanup;
+	}
+
+	if ((r = chacha_final(st, outbuf)) > 0) {
+		if (sh != NULL) {
+			blake2b_update(sh, outbuf, r);
+		}
 
+		if (!asignify_pipe_write(wr, r)) {
 			goto cleanup;
 		}
 	}
@@ -469,14 +505,912 @@ asignify_encrypt_decrypt_file(asignify_encrypt_t *ctx,
 	ret = true;
 
 cleanup:
-	fclose(out);
-	fclose(in);
-	explicit_memzero(session_key, sizeof(session_key));
-	explicit_memzero(&enc_st, sizeof(enc_st));
-	explicit_memzero(h, sizeof(h));
-	asignify_public_data_free(enc);
+	if (!asignify_pipe_close(wr)) {
+		ret = false;
+	}
+	asignify_pipe_close(rd);
 
-	return (ret);
+	if (!ret) {
+		ctx->error = xerr_string(asignify_io_error(ctx->cancel));
+	}
+
+	return (ret);
+}
+
+/*
+ * Parallel mode: chacha keystream is seekable, so workers process disjoint
+ * blocks whilst blake2 consumes ciphertext sequentially
+ */
+struct asignify_encrypt_job {
+	chacha_state st;
+	blake2b_state sh;
+	bool decrypt;
+};
+
+static bool
+asignify_encrypt_job_crypt(void *ud, off_t off, const unsigned char *in,
+	unsigned char *out, size_t len)
+{
+	struct asignify_encrypt_job *job = ud;
+	chacha_state st;
+	size_t r;
+
+	memcpy(&st, &job->st, sizeof(st));
+	chacha_set_counter(&st, off / 64);
+	r = chacha_update(&st, in, out, len);
+	/* Also cleans the state copy */
+	chacha_final(&st, out + r);
+
+	return (true);
+}
+
+static void
+asignify_encrypt_job_mac(void *ud, const unsigned char *in,
+	const unsigned char *out, size_t len)
+{
+	struct asignify_encrypt_job *job = ud;
+
+	blake2b_update(&job->sh, job->decrypt ? in : out, len);
+}
+
+static bool
+asignify_encrypt_parallel(asignify_encrypt_t *ctx,
+	struct asignify_encrypt_job *job, int in_fd, int out_fd, off_t out_off,
+	off_t size)
+{
+	off_t in_off;
+
+	if ((in_off = lseek(in_fd, 0, SEEK_CUR)) == (off_t)-1 || in_off > size) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	if (!asignify_pipe_transform(in_fd, out_fd, out_off, size - in_off,
+			ctx->nthreads, asignify_encrypt_job_crypt, asignify_encrypt_job_mac,
+			job, ctx->cancel)) {
+		ctx->error = xerr_string(asignify_io_error(ctx->cancel));
+		return (false);
+	}
+
+	return (true);
+}
+
+/*
+ * AES-GCM mode: input is split to chunks of ASIGNIFY_AESGCM_CHUNK bytes,
+ * each chunk is followed by its tag and the file signature covers the sealed
+ * session key and all tags, so data is processed in a single pass
+ */
+struct asignify_encrypt_gcm {
+	struct asignify_aesgcm *g;
+	blake2b_state sh;
+	struct asignify_pipe *wr;
+	unsigned char *obuf;
+	size_t opos;
+	unsigned char *tmp;
+	uint64_t counter;
+	bool decrypt;
+	enum asignify_error err;
+};
+
+static bool
+asignify_encrypt_gcm_output(struct asignify_encrypt_gcm *gs,
+	const unsigned char *data, size_t len)
+{
+	size_t bufsize, n;
+
+	bufsize = asignify_pipe_bufsize(gs->wr);
+
+	while (len > 0) {
+		if (gs->obuf == NULL) {
+			if ((gs->obuf = asignify_pipe_get_buf(gs->wr)) == NULL) {
+				return (false);
+			}
+			gs->opos = 0;
+		}
+
+		n = bufsize - gs->opos < len ? bufsize - gs->opos : len;
+		memcpy(gs->obuf + gs->opos, data, n);
+		gs->opos += n;
+		data += n;
+		len -= n;
+
+		if (gs->opos == bufsize) {
+			gs->obuf = NULL;
+
+			if (!asignify_pipe_write(gs->wr, bufsize)) {
+				return (false);
+			}
+		}
+	}
+
+	return (true);
+}
+
+static bool
+asignify_encrypt_gcm_chunk(struct asignify_encrypt_gcm *gs,
+	const unsigned char *in, size_t len, bool last)
+{
+	size_t clen;
+
+	if (gs->counter > UINT32_MAX) {
+		gs->err = ASIGNIFY_ERROR_SIZE;
+		return (false);
+	}
+
+	if (gs->decrypt) {
+		clen = len - ASIGNIFY_AESGCM_TAGLEN;
+
+		if (!asignify_aesgcm_open(gs->g, gs->counter, last, in, clen,
+				in + clen, gs->tmp)) {
+			gs->err = ASIGNIFY_ERROR_VERIFY;
+			return (false);
+		}
+
+		blake2b_update(&gs->sh, in + clen, ASIGNIFY_AESGCM_TAGLEN);
+	}
+	else {
+		clen = len + ASIGNIFY_AESGCM_TAGLEN;
+
+		if (!asignify_aesgcm_seal(gs->g, gs->counter, last, in, len,
+				gs->tmp, gs->tmp + len)) {
+			gs->err = ASIGNIFY_ERROR_FILE;
+			return (false);
+		}
+
+		blake2b_update(&gs->sh, gs->tmp + len, ASIGNIFY_AESGCM_TAGLEN);
+	}
+
+	gs->counter ++;
+
+	if (!asignify_encrypt_gcm_output(gs, gs->tmp, clen)) {
+		gs->err = ASIGNIFY_ERROR_FILE;
+		return (false);
+	}
+
+	return (true);
+}
+
+/*
+ * A chunk is known not to be the last one only when more input follows it,
+ * so a full chunk is kept pending until the next input arrives
+ */
+static bool
+asignify_encrypt_gcm_stream(asignify_encrypt_t *ctx,
+	struct asignify_encrypt_gcm *gs, int in_fd, int out_fd, off_t size_hint)
+{
+	struct asignify_pipe *rd;
+	const unsigned char *buf;
+	unsigned char *pending;
+	size_t unit, fill = 0, n;
+	ssize_t r;
+	bool ret = false;
+
+	unit = ASIGNIFY_AESGCM_CHUNK + (gs->decrypt ? ASIGNIFY_AESGCM_TAGLEN : 0);
+	pending = xmalloc(unit);
+	gs->tmp = xmalloc(ASIGNIFY_AESGCM_CHUNK + ASIGNIFY_AESGCM_TAGLEN);
+	gs->obuf = NULL;
+	gs->counter = 0;
+	gs->err = ASIGNIFY_ERROR_OK;
+
+	rd = asignify_pipe_reader(in_fd, size_hint);
+	gs->wr = asignify_pipe_writer(out_fd, size_hint);
+	asignify_pipe_set_cancel(rd, ctx->cancel);
+	asignify_pipe_set_cancel(gs->wr, ctx->cancel);
+
+	while ((r = asignify_pipe_read(rd, &buf)) > 0) {
+		while (r > 0) {
+			if (fill == unit) {
+				if (!asignify_encrypt_gcm_chunk(gs, pending, fill, false)) {
+					goto cleanup;
+				}
+				fill = 0;
+			}
+
+			if (fill == 0 && (size_t)r > unit) {
+				/* Process chunks in place when possible */
+				if (!asignify_encrypt_gcm_chunk(gs, buf, unit, false)) {
+					goto cleanup;
+				}
+				buf += unit;
+				r -= unit;
+				continue;
+			}
+
+			n = unit - fill < (size_t)r ? unit - fill : (size_t)r;
+			memcpy(pending + fill, buf, n);
+			fill += n;
+			buf += n;
+			r -= n;
+		}
+	}
+
+	if (r == -1) {
+		gs->err = asignify_io_error(ctx->cancel);
+		goto cleanup;
+	}
+
+	/* The last chunk is always present even for empty input */
+	if (gs->decrypt && fill < ASIGNIFY_AESGCM_TAGLEN) {
+		gs->err = ASIGNIFY_ERROR_FORMAT;
+		goto cleanup;
+	}
+
+	if (!asignify_encrypt_gcm_chunk(gs, pending, fill, true)) {
+		goto cleanup;
+	}
+
+	if (gs->obuf != NULL && !asignify_pipe_write(gs->wr, gs->opos)) {
+		gs->err = ASIGNIFY_ERROR_FILE;
+		goto cleanup;
+	}
+
+	gs->obuf = NULL;
+	ret = true;
+
+cleanup:
+	if (!asignify_pipe_close(gs->wr) && ret) {
+		gs->err = asignify_io_error(ctx->cancel);
+		ret = false;
+	}
+	asignify_pipe_close(rd);
+
+	if (!ret) {
+		ctx->error = xerr_string(gs->err != ASIGNIFY_ERROR_OK ? gs->err :
+			asignify_io_error(ctx->cancel));
+	}
+
+	explicit_memzero(pending, unit);
+	explicit_memzero(gs->tmp, ASIGNIFY_AESGCM_CHUNK + ASIGNIFY_AESGCM_TAGLEN);
+	free(pending);
+	free(gs->tmp);
+
+	return (ret);
+}
+
+bool
+asignify_encrypt_crypt_file(asignify_encrypt_t *ctx, unsigned int version,
+	const char *inf, const char *outf, enum asignify_encrypt_type type)
+{
+	FILE *in, *out;
+	int out_fd;
+	off_t sig_pos = 0, size_hint;
+	struct stat st;
+	unsigned char session_key[ENCRYPTED_PAYLOAD_LEN],
+		sig[crypto_sign_BYTES], payload[ENCRYPTED_SESSION_LEN];
+	struct asignify_encrypt_job job;
+	struct asignify_encrypt_gcm gs;
+	blake2b_state *sh;
+	bool ret = false;
+	int rounds;
+
+	if (!asignify_encrypt_check_keys(ctx)) {
+		return (false);
+	}
+
+	if (version != 1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	asignify_encrypt_session_new(ctx, session_key, payload);
+
+	if (type == ASIGNIFY_ENCRYPT_AESGCM) {
+		version = ENCRYPTED_VERSION_AESGCM;
+		gs.g = asignify_aesgcm_init(payload + 8, payload, false);
+		gs.decrypt = false;
+		sh = &gs.sh;
+	}
+	else {
+		rounds = asignify_encrypt_rounds(type);
+		version = version * 100 + rounds;
+		chacha_init(&job.st, (chacha_key *)(payload + 8), (chacha_iv *)payload,
+			rounds);
+		gs.g = NULL;
+		sh = &job.sh;
+	}
+
+	explicit_memzero(payload, sizeof(payload));
+
+	if (type == ASIGNIFY_ENCRYPT_AESGCM && gs.g == NULL) {
+		/* Check it before the output is truncated */
+		ctx->error = xerr_string(ASIGNIFY_ERROR_CIPHER);
+		return (false);
+	}
+
+	in = xfopen(inf, "r");
+
+	if (in == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		asignify_aesgcm_free(gs.g);
+		explicit_memzero(&job.st, sizeof(job.st));
+		return (false);
+	}
+
+	out = xfopen(outf, "w");
+	if (out == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		fclose(in);
+		asignify_aesgcm_free(gs.g);
+		explicit_memzero(&job.st, sizeof(job.st));
+		return (false);
+	}
+
+	/* Since we need to seek, we must ensure that the file is a normal file */
+	out_fd = fileno(out);
+	if (fstat(out_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		goto cleanup;
+	}
+
+	if (fstat(fileno(in), &st) != -1 && S_ISREG(st.st_mode)) {
+		size_hint = st.st_size;
+	}
+	else {
+		size_hint = -1;
+	}
+
+	/* Write key header */
+	asignify_encrypt_write_header(ctx, version, session_key, out);
+
+	/* Write fake signature */
+	fflush(out);
+	sig_pos = ftell(out);
+	memset(sig, 0, sizeof(sig));
+	asignify_encrypt_write_sig(sig, out, true);
+
+	blake2b_init(sh, BLAKE2B_OUTBYTES);
+	blake2b_update(sh, session_key, sizeof(session_key));
+	job.decrypt = false;
+
+	fflush(out);
+
+	if (gs.g != NULL) {
+		/* AES-GCM is fast enough for a single thread */
+		if (!asignify_encrypt_gcm_stream(ctx, &gs, fileno(in), out_fd,
+				size_hint)) {
+			goto cleanup;
+		}
+	}
+	else if (ctx->nthreads > 1 && size_hint >= 0) {
+		if (!asignify_encrypt_parallel(ctx, &job, fileno(in), out_fd,
+				ftell(out), size_hint)) {
+			goto cleanup;
+		}
+	}
+	else if (!asignify_encrypt_stream(ctx, fileno(in), out_fd, size_hint,
+			&job.st, &job.sh)) {
+		goto cleanup;
+	}
+
+	/* Now we need to calculate signature */
+	asignify_encrypt_mac_sign(ctx, sh, sig);
+
+	/* Now rewind to the signature place and overwrite the fake signature */
+	if (fseek(out, sig_pos, SEEK_SET) != 0) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+
+		goto cleanup;
+	}
+
+	asignify_encrypt_write_sig(sig, out, false);
+
+	ret = true;
+
+cleanup:
+	fclose(out);
+	fclose(in);
+	asignify_aesgcm_free(gs.g);
+	explicit_memzero(&job.st, sizeof(job.st));
+	return (ret);
+}
+
+/*
+ * Temporary output files replace the output only if decryption succeeds
+ */
+int
+asignify_encrypt_tmp_open(asignify_encrypt_t *ctx, const char *outf,
+	char **tmp)
+{
+	mode_t um;
+	int fd;
+
+	*tmp = xmalloc(strlen(outf) + sizeof(".XXXXXX"));
+	sprintf(*tmp, "%s.XXXXXX", outf);
+
+	if ((fd = mkstemp(*tmp)) == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		free(*tmp);
+		*tmp = NULL;
+		return (-1);
+	}
+
+	/* Use the same permissions as fopen does */
+	um = umask(0);
+	umask(um);
+	(void)fchmod(fd, 0666 & ~um);
+
+	return (fd);
+}
+
+bool
+asignify_encrypt_tmp_close(asignify_encrypt_t *ctx, int fd, char *tmp,
+	const char *outf, bool ret)
+{
+	if (close(fd) == -1 || (ret && rename(tmp, outf) == -1)) {
+		if (ret) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+			ret = false;
+		}
+	}
+
+	if (!ret) {
+		unlink(tmp);
+	}
+
+	free(tmp);
+
+	return (ret);
+}
+
+/*
+ * Decrypts to a temporary file whilst ciphertext is being authenticated, the
+ * output appears only if the signature is valid
+ */
+static bool
+asignify_encrypt_decrypt_parallel(asignify_encrypt_t *ctx, int in_fd,
+	off_t size, struct asignify_public_data *enc, const unsigned char *sig,
+	int rounds, const char *outf)
+{
+	struct asignify_encrypt_job job;
+	char *tmp;
+	int fd;
+	bool ret;
+
+	if (!asignify_encrypt_session_open(ctx, enc, rounds, &job.st)) {
+		return (false);
+	}
+
+	blake2b_init(&job.sh, BLAKE2B_OUTBYTES);
+	blake2b_update(&job.sh, enc->data, enc->data_len);
+	job.decrypt = true;
+
+	if ((fd = asignify_encrypt_tmp_open(ctx, outf, &tmp)) == -1) {
+		explicit_memzero(&job.st, sizeof(job.st));
+		return (false);
+	}
+
+	ret = asignify_encrypt_parallel(ctx, &job, in_fd, fd, 0, size);
+
+	if (ret && !asignify_encrypt_mac_verify(ctx, &job.sh, sig)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
+		ret = false;
+	}
+
+	ret = asignify_encrypt_tmp_close(ctx, fd, tmp, outf, ret);
+	explicit_memzero(&job.st, sizeof(job.st));
+
+	return (ret);
+}
+
+/*
+ * Chunks are authenticated by their tags before being written, and the
+ * signature over all tags is checked at the end (a temporary file is used
+ * in parallel mode to keep its promise of not touching output on errors)
+ */
+static bool
+asignify_encrypt_decrypt_gcm(asignify_encrypt_t *ctx, int in_fd,
+	off_t size, struct asignify_public_data *enc, const unsigned char *sig,
+	const char *outf)
+{
+	struct asignify_encrypt_gcm gs;
+	unsigned char payload[ENCRYPTED_SESSION_LEN];
+	FILE *out = NULL;
+	char *tmp = NULL;
+	int out_fd;
+	bool ret;
+
+	if (!asignify_encrypt_session_unseal(ctx, enc, payload)) {
+		return (false);
+	}
+
+	gs.g = asignify_aesgcm_init(payload + 8, payload, true);
+	gs.decrypt = true;
+	explicit_memzero(payload, sizeof(payload));
+
+	if (gs.g == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_CIPHER);
+		return (false);
+	}
+
+	if (ctx->nthreads > 1 && strcmp(outf, "-") != 0) {
+		out_fd = asignify_encrypt_tmp_open(ctx, outf, &tmp);
+	}
+	else if ((out = xfopen(outf, "w")) != NULL) {
+		out_fd = fileno(out);
+	}
+	else {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		out_fd = -1;
+	}
+
+	if (out_fd == -1) {
+		asignify_aesgcm_free(gs.g);
+		return (false);
+	}
+
+	blake2b_init(&gs.sh, BLAKE2B_OUTBYTES);
+	blake2b_update(&gs.sh, enc->data, enc->data_len);
+
+	ret = asignify_encrypt_gcm_stream(ctx, &gs, in_fd, out_fd, size);
+
+	if (ret && !asignify_encrypt_mac_verify(ctx, &gs.sh, sig)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
+		ret = false;
+	}
+
+	if (tmp != NULL) {
+		ret = asignify_encrypt_tmp_close(ctx, out_fd, tmp, outf, ret);
+	}
+	else {
+		fclose(out);
+	}
+
+	asignify_aesgcm_free(gs.g);
+
+	return (ret);
+}
+
+bool
+asignify_encrypt_decrypt_file(asignify_encrypt_t *ctx,
+	const char *inf, const char *outf)
+{
+	FILE *in, *out = NULL;
+	int in_fd;
+	ssize_t r;
+	off_t sig_pos = 0;
+	struct stat st;
+	unsigned char sig[crypto_sign_BYTES];
+	char *line = NULL;
+	size_t linelen = 0;
+	struct asignify_public_data *enc = NULL;
+	chacha_state enc_st;
+	int rounds;
+	bool ret = false;
+	struct asignify_pipe *rd;
+
+	if (!asignify_encrypt_check_keys(ctx)) {
+		return (false);
+	}
+
+	in = xfopen(inf, "r");
+
+	if (in == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	/* Since we need to seek, we must ensure that the file is a normal file */
+	in_fd = fileno(in);
+	if (fstat(in_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		goto cleanup;
+	}
+
+	if ((r = getline(&line, &linelen, in)) < 0) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		goto cleanup;
+	}
+
+	enc = asignify_encrypt_parse_header(ctx, line, r, &rounds, sig);
+	if (enc == NULL) {
+		goto cleanup;
+	}
+
+	if (ENCRYPTED_IS_VOLUMES(enc->version)) {
+		/* Volume indexes are decrypted with their volumes only */
+		ctx->error = xerr_string(ASIGNIFY_ERROR_MISUSE);
+		goto cleanup;
+	}
+
+	/* Payload is read directly from the descriptor since now */
+	sig_pos = ftell(in);
+
+	if (lseek(in_fd, sig_pos, SEEK_SET) != sig_pos) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		goto cleanup;
+	}
+
+	if (rounds == 0) {
+		ret = asignify_encrypt_decrypt_gcm(ctx, in_fd, st.st_size - sig_pos,
+			enc, sig, outf);
+		goto cleanup;
+	}
+
+	if (ctx->nthreads > 1 && strcmp(outf, "-") != 0) {
+		/* Output is written by the workers before it is authenticated */
+		ret = asignify_encrypt_decrypt_parallel(ctx, in_fd, st.st_size, enc,
+			sig, rounds, outf);
+		goto cleanup;
+	}
+
+	out = xfopen(outf, "w");
+	if (out == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		goto cleanup;
+	}
+
+	rd = asignify_pipe_reader(in_fd, st.st_size - sig_pos);
+	r = asignify_encrypt_mac_pass(ctx, rd, enc, sig, NULL, 0);
+	asignify_pipe_close(rd);
+
+	if (!r) {
+		goto cleanup;
+	}
+
+	if (lseek(in_fd, sig_pos, SEEK_SET) != sig_pos) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		goto cleanup;
+	}
+
+	/* We have successfully verified signature, so we can process with output */
+	if (!asignify_encrypt_session_open(ctx, enc, rounds, &enc_st)) {
+		goto cleanup;
+	}
+
+	/* Write decrypted data */
+	ret = asignify_encrypt_stream(ctx, in_fd, fileno(out),
+		st.st_size - sig_pos, &enc_st, NULL);
+
+cleanup:
+	if (out != NULL) {
+		fclose(out);
+	}
+	fclose(in);
+	free(line);
+	explicit_memzero(&enc_st, sizeof(enc_st));
+	asignify_public_data_free(enc);
+
+	return (ret);
+}
+
+bool
+asignify_encrypt_verify_file(asignify_encrypt_t *ctx, const char *inf)
+{
+	int fd, rounds;
+	struct stat st;
+	struct asignify_pipe *rd;
+	struct asignify_public_data *enc;
+	const unsigned char *buf, *nl;
+	unsigned char sig[crypto_sign_BYTES];
+	ssize_t r;
+	bool ret;
+
+	if (ctx == NULL || ctx->pubk == NULL || inf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if ((fd = xopen(inf, O_RDONLY, 0)) == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	/*
+	 * No seeking is required, so encrypted data could be read from pipes:
+	 * the header line is always shorter than the first buffer
+	 */
+	rd = asignify_pipe_reader(fd,
+		(fstat(fd, &st) != -1 && S_ISREG(st.st_mode)) ? st.st_size : -1);
+	asignify_pipe_set_cancel(rd, ctx->cancel);
+
+	if ((r = asignify_pipe_read(rd, &buf)) <= 0) {
+		ctx->error = xerr_string(r == 0 ? ASIGNIFY_ERROR_FORMAT :
+			asignify_io_error(ctx->cancel));
+		asignify_pipe_close(rd);
+		close(fd);
+		return (false);
+	}
+
+	if ((nl = memchr(buf, '\n', r)) == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		asignify_pipe_close(rd);
+		close(fd);
+		return (false);
+	}
+
+	enc = asignify_encrypt_parse_header(ctx, (const char *)buf, nl - buf + 1,
+		&rounds, sig);
+
+	if (enc == NULL) {
+		asignify_pipe_close(rd);
+		close(fd);
+		return (false);
+	}
+
+	if (rounds == 0) {
+		/* Signature covers only tags that cannot be checked without a key */
+		ctx->error = xerr_string(ASIGNIFY_ERROR_CIPHER);
+		asignify_pipe_close(rd);
+		close(fd);
+		asignify_public_data_free(enc);
+		return (false);
+	}
+
+	nl ++;
+	ret = asignify_encrypt_mac_pass(ctx, rd, enc, sig, nl, r - (nl - buf));
+
+	asignify_pipe_close(rd);
+	close(fd);
+	asignify_public_data_free(enc);
+
+	return (ret);
+}
+
+bool
+asignify_encrypt_seal_buf(asignify_encrypt_t *ctx, enum asignify_encrypt_type type,
+	unsigned int base, const unsigned char *data, size_t len, FILE *out)
+{
+	unsigned char session_key[ENCRYPTED_PAYLOAD_LEN],
+		sig[crypto_sign_BYTES], payload[ENCRYPTED_SESSION_LEN], *cipher;
+	blake2b_state sh;
+	chacha_state enc_st;
+	size_t clen;
+	int rounds;
+	bool ret = false;
+
+	if (!asignify_encrypt_check_keys(ctx)) {
+		return (false);
+	}
+
+	rounds = asignify_encrypt_rounds(type);
+	asignify_encrypt_session_new(ctx, session_key, payload);
+	chacha_init(&enc_st, (chacha_key *)(payload + 8), (chacha_iv *)payload,
+		rounds);
+	explicit_memzero(payload, sizeof(payload));
+
+	/* Signature goes before payload, so encrypt everything in memory */
+	cipher = xmalloc_aligned(64, len + 64);
+	clen = chacha_update(&enc_st, data, cipher, len);
+	clen += chacha_final(&enc_st, cipher + clen);
+
+	blake2b_init(&sh, BLAKE2B_OUTBYTES);
+	blake2b_update(&sh, session_key, sizeof(session_key));
+	blake2b_update(&sh, cipher, clen);
+	asignify_encrypt_mac_sign(ctx, &sh, sig);
+
+	if (asignify_encrypt_write_header(ctx, base + rounds, session_key, out) &&
+			asignify_encrypt_write_sig(sig, out, true) &&
+			(clen == 0 || fwrite(cipher, clen, 1, out) == 1)) {
+		ret = true;
+	}
+	else {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	}
+
+	free(cipher);
+
+	return (ret);
+}
+
+unsigned char *
+asignify_encrypt_open_buf(asignify_encrypt_t *ctx, unsigned int base,
+	const unsigned char *data, size_t len, size_t *outlen)
+{
+	char line[ASIGNIFY_MAX_LINE];
+	const char *p = (const char *)data;
+	struct asignify_public_data *enc;
+	unsigned char sig[crypto_sign_BYTES], *res = NULL;
+	blake2b_state sh;
+	chacha_state enc_st;
+	size_t clen;
+	ssize_t r;
+	int rounds;
+
+	if (!asignify_encrypt_check_keys(ctx)) {
+		return (NULL);
+	}
+
+	r = asignify_buf_getline(&p, p + len, line, sizeof(line));
+	if (r <= 0) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		return (NULL);
+	}
+
+	enc = asignify_encrypt_parse_header(ctx, line, r, &rounds, sig);
+	if (enc == NULL) {
+		return (NULL);
+	}
+
+	if (rounds == 0 || ENCRYPTED_IS_VOLUMES(enc->version) !=
+			(base == ASIGNIFY_SEAL_VOLUMES)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		asignify_public_data_free(enc);
+		return (NULL);
+	}
+
+	data += r;
+	len -= r;
+
+	blake2b_init(&sh, BLAKE2B_OUTBYTES);
+	blake2b_update(&sh, enc->data, enc->data_len);
+	blake2b_update(&sh, data, len);
+
+	if (!asignify_encrypt_mac_verify(ctx, &sh, sig)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
+	}
+	else if (asignify_encrypt_session_open(ctx, enc, rounds, &enc_st)) {
+		res = xmalloc_aligned(64, len + 64);
+		clen = chacha_update(&enc_st, data, res, len);
+		clen += chacha_final(&enc_st, res + clen);
+		*outlen = clen;
+	}
+
+	explicit_memzero(&enc_st, sizeof(enc_st));
+	asignify_public_data_free(enc);
+
+	return (res);
+}
+
+bool
+asignify_encrypt_is_volume_index(const char *file)
+{
+	char buf[sizeof(ENCRYPTED_MAGIC) + 16], *end;
+	unsigned long version;
+	ssize_t r;
+	int fd;
+
+	if (file == NULL || (fd = xopen(file, O_RDONLY, 0)) == -1) {
+		return (false);
+	}
+
+	r = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (r <= (ssize_t)sizeof(ENCRYPTED_MAGIC) - 1 ||
+			memcmp(buf, ENCRYPTED_MAGIC, sizeof(ENCRYPTED_MAGIC) - 1) != 0) {
+		return (false);
+	}
+
+	buf[r] = '\0';
+	version = strtoul(buf + sizeof(ENCRYPTED_MAGIC) - 1, &end, 10);
+
+	return (*end == ':' && ENCRYPTED_IS_VOLUMES(version));
+}
+
+enum asignify_encrypt_type
+asignify_encrypt_auto_type(void)
+{
+	/* Software AES is slower than chacha */
+	if (asignify_aesgcm_accelerated()) {
+		return (ASIGNIFY_ENCRYPT_AESGCM);
+	}
+
+	return (ASIGNIFY_ENCRYPT_SAFE);
+}
+
+void
+asignify_encrypt_set_threads(asignify_encrypt_t *ctx, unsigned int nthreads)
+{
+	long ncpu;
+
+	if (ctx == NULL) {
+		return;
+	}
+
+	if (nthreads == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? ncpu : 1;
+	}
+
+	ctx->nthreads = nthreads;
+}
+
+void
+asignify_encrypt_set_cancel(asignify_encrypt_t *ctx, const asignify_cancel_t *c)
+{
+	if (ctx != NULL) {
+		ctx->cancel = c;
+	}
 }
 
 const char*
@@ -0,0 +1,183 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "asignify.h"
+#include "asignify_internal.h"
+
+/*
+ * Digests files (manifests) consist of lines in the following format:
+ * ALG (filename) = value
+ * where value is a hex encoded digest or a decimal number for SIZE.
+ */
+bool
+asignify_manifest_parse(const char *data, size_t dlen,
+	asignify_manifest_cb cb, void *ud)
+{
+	enum stm_st {
+		PARSE_START = 0,
+		PARSE_ALG,
+		PARSE_OBRACE,
+		PARSE_FILE,
+		PARSE_EQSIGN,
+		PARSE_HASH,
+		PARSE_SPACES,
+		PARSE_ERROR,
+		PARSE_FINISH
+	} state = PARSE_START, next_state = PARSE_START;
+	const unsigned char *p, *end, *c, *fname = NULL;
+	unsigned char ch;
+	size_t fnlen = 0;
+	enum asignify_digest_type dig_type = ASIGNIFY_DIGEST_MAX;
+
+	p = (unsigned char *)data;
+	end = p + dlen;
+	c = p;
+
+	while (p <= end) {
+		/* Caller buffer is not required to be NUL terminated */
+		ch = (p < end) ? *p : '\0';
+
+		switch (state) {
+		case PARSE_START:
+			fname = NULL;
+			if (ch == '\0') {
+				state = PARSE_FINISH;
+			}
+			else if (isspace(ch)) {
+				next_state = PARSE_START;
+				state = PARSE_SPACES;
+			}
+			else {
+				/* We have algorithm definition */
+				c = p;
+				state = PARSE_ALG;
+			}
+			break;
+		case PARSE_ALG:
+			if (isgraph(ch)) {
+				p ++;
+			}
+			else {
+				if (ch == ' ') {
+					/* Check algorithm */
+					dig_type = asignify_digest_from_str((const char *)c, p - c);
+					if (dig_type == ASIGNIFY_DIGEST_MAX) {
+						state = PARSE_ERROR;
+					}
+					else {
+						state = PARSE_SPACES;
+						next_state = PARSE_OBRACE;
+					}
+				}
+				else {
+					state = PARSE_ERROR;
+				}
+			}
+			break;
+		case PARSE_OBRACE:
+			if (ch == '(') {
+				p++;
+				c = p;
+				state = PARSE_FILE;
+			}
+			else {
+				state = PARSE_ERROR;
+			}
+			break;
+		case PARSE_FILE:
+			if (isgraph(ch) && ch != ')') {
+				p ++;
+			}
+			else if (ch == ')' && p - c > 0) {
+				fname = c;
+				fnlen = p - c;
+				p ++;
+				c = p;
+				next_state = PARSE_EQSIGN;
+				state = PARSE_SPACES;
+			}
+			else {
+				state = PARSE_ERROR;
+			}
+			break;
+		case PARSE_EQSIGN:
+			if (ch == '=') {
+				p++;
+				c = p;
+				state = PARSE_SPACES;
+				next_state = PARSE_HASH;
+			}
+			else {
+				state = PARSE_ERROR;
+			}
+			break;
+		case PARSE_HASH:
+			if (isxdigit(ch)) {
+				p ++;
+			}
+			else if (ch == '\n' || ch == '\0') {
+				if (!cb((const char *)fname, fnlen, dig_type,
+						(const char *)c, p - c, ud)) {
+					state = PARSE_ERROR;
+				}
+				else {
+					state = PARSE_START;
+				}
+			}
+			else {
+				state = PARSE_ERROR;
+			}
+			break;
+		case PARSE_SPACES:
+			if (ch != '\0' && isspace(ch)) {
+				p ++;
+			}
+			else {
+				c = p;
+				state = next_state;
+			}
+			break;
+
+		case PARSE_FINISH:
+			/* All done */
+			return (true);
+			break;
+
+		case PARSE_ERROR:
+		default:
+			return (false);
+			break;
+		}
+	}
+
+	return (false);
+}
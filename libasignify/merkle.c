@@ -0,0 +1,479 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <ctype.h>
+
+#include "asignify.h"
+#include "asignify_internal.h"
+#include "kvec.h"
+
+/*
+ * Append-only logs are split to segments that are the leaves of a Merkle tree
+ * hashed as in RFC 6962: leaf = H(0x00 || data), node = H(0x01 || left ||
+ * right). Only the roots of the complete subtrees (frontier) are kept in a
+ * tree head, at most one per bit of the leaves count, so a head can be
+ * extended by the new data without reading the log from the beginning.
+ * The incomplete last segment (tail) is hashed as a leaf for the root only
+ * and it is hashed again when the head is extended.
+ */
+#define LOG_HEAD_MAGIC "asignify-log: 1"
+#define LOG_LEAF_PREFIX 0x00
+#define LOG_NODE_PREFIX 0x01
+
+struct asignify_log_state {
+	struct asignify_log_head *h;
+	struct asignify_digest_ctx *leaf;
+	uint64_t leaf_len;
+};
+
+static void
+asignify_log_node(const unsigned char *left, const unsigned char *right,
+	unsigned char *out)
+{
+	struct asignify_digest_ctx *dig;
+	unsigned char prefix = LOG_NODE_PREFIX, *res;
+
+	dig = asignify_digest_init(ASIGNIFY_DIGEST_BLAKE2);
+	asignify_digest_update(dig, &prefix, 1);
+	asignify_digest_update(dig, left, ASIGNIFY_LOG_HASHLEN);
+	asignify_digest_update(dig, right, ASIGNIFY_LOG_HASHLEN);
+	res = asignify_digest_final(dig);
+	memcpy(out, res, ASIGNIFY_LOG_HASHLEN);
+	free(res);
+}
+
+static struct asignify_digest_ctx *
+asignify_log_leaf_init(void)
+{
+	struct asignify_digest_ctx *dig;
+	unsigned char prefix = LOG_LEAF_PREFIX;
+
+	dig = asignify_digest_init(ASIGNIFY_DIGEST_BLAKE2);
+	asignify_digest_update(dig, &prefix, 1);
+
+	return (dig);
+}
+
+/* Appends a complete leaf to the frontier like an increment of a counter */
+static void
+asignify_log_push(struct asignify_log_head *h, struct asignify_digest_ctx *leaf)
+{
+	unsigned char *res;
+	uint64_t m;
+
+	res = asignify_digest_final(leaf);
+	memcpy(h->frontier[h->nfrontier ++], res, ASIGNIFY_LOG_HASHLEN);
+	free(res);
+
+	for (m = h->leaves; m & 1; m >>= 1) {
+		asignify_log_node(h->frontier[h->nfrontier - 2],
+			h->frontier[h->nfrontier - 1], h->frontier[h->nfrontier - 2]);
+		h->nfrontier --;
+	}
+
+	h->leaves ++;
+}
+
+static void
+asignify_log_root(struct asignify_log_state *st)
+{
+	struct asignify_log_head *h = st->h;
+	unsigned char acc[ASIGNIFY_LOG_HASHLEN], *res;
+	unsigned int i;
+
+	if (st->leaf_len > 0) {
+		res = asignify_digest_final(st->leaf);
+		i = h->nfrontier;
+	}
+	else {
+		asignify_digest_free(st->leaf);
+
+		if (h->nfrontier == 0) {
+			/* Empty tree */
+			res = asignify_digest_final(
+				asignify_digest_init(ASIGNIFY_DIGEST_BLAKE2));
+			i = 0;
+		}
+		else {
+			res = NULL;
+			i = h->nfrontier - 1;
+			memcpy(acc, h->frontier[i], sizeof(acc));
+		}
+	}
+
+	st->leaf = NULL;
+
+	if (res != NULL) {
+		memcpy(acc, res, sizeof(acc));
+		free(res);
+	}
+
+	while (i > 0) {
+		i --;
+		asignify_log_node(h->frontier[i], acc, acc);
+	}
+
+	memcpy(h->root, acc, sizeof(acc));
+}
+
+static void
+asignify_log_update(struct asignify_log_state *st, const unsigned char *buf,
+	size_t len)
+{
+	struct asignify_log_head *h = st->h;
+	const unsigned char *nl;
+	size_t take, skip;
+
+	while (len > 0) {
+		if (h->records) {
+			/* Segment ends by the first newline after the minimal size */
+			skip = 0;
+			if (st->leaf_len + 1 < h->segment) {
+				skip = h->segment - st->leaf_len - 1;
+			}
+
+			take = len;
+			if (skip < len && (nl = memchr(buf + skip, '\n', len - skip)) != NULL) {
+				take = nl - buf + 1;
+			}
+		}
+		else {
+			take = h->segment - st->leaf_len;
+			if (take > len) {
+				take = len;
+			}
+		}
+
+		asignify_digest_update(st->leaf, buf, take);
+		st->leaf_len += take;
+		buf += take;
+		len -= take;
+
+		if ((h->records && buf[-1] == '\n' && st->leaf_len >= h->segment) ||
+				(!h->records && st->leaf_len == h->segment)) {
+			asignify_log_push(h, st->leaf);
+			h->offset += st->leaf_len;
+			st->leaf = asignify_log_leaf_init();
+			st->leaf_len = 0;
+		}
+	}
+}
+
+struct asignify_log_head *
+asignify_log_head_new(const char *name, uint64_t segment, bool records)
+{
+	struct asignify_log_head *h;
+
+	if (name == NULL || strchr(name, '\n') != NULL ||
+			strlen(name) > ASIGNIFY_MAX_LINE / 2) {
+		return (NULL);
+	}
+
+	h = xmalloc0(sizeof(*h));
+	h->name = xstrdup(name);
+	h->segment = segment > 0 ? segment : ASIGNIFY_LOG_SEGMENT;
+	h->records = records;
+
+	return (h);
+}
+
+enum asignify_error
+asignify_log_hash(struct asignify_log_head *h, int fd, uint64_t size,
+	const asignify_cancel_t *cancel)
+{
+	struct asignify_log_state st;
+	struct asignify_pipe *p;
+	const unsigned char *buf;
+	uint64_t pos;
+	ssize_t r;
+	bool ret = true, eof = false;
+
+	if (size < h->offset) {
+		return (ASIGNIFY_ERROR_VERIFY_SIZE);
+	}
+
+	if (lseek(fd, h->offset, SEEK_SET) == (off_t)-1) {
+		return (ASIGNIFY_ERROR_FILE);
+	}
+
+	p = asignify_pipe_reader(fd, size - h->offset);
+	if (p == NULL) {
+		return (ASIGNIFY_ERROR_FILE);
+	}
+
+	asignify_pipe_set_cancel(p, cancel);
+	st.h = h;
+	st.leaf = asignify_log_leaf_init();
+	st.leaf_len = 0;
+	pos = h->offset;
+
+	/* Log may grow while we read it, so stop exactly at the requested size */
+	while (pos < size) {
+		r = asignify_pipe_read(p, &buf);
+
+		if (r <= 0) {
+			eof = (r == 0);
+			ret = false;
+			break;
+		}
+
+		if ((uint64_t)r > size - pos) {
+			r = size - pos;
+		}
+
+		asignify_log_update(&st, buf, r);
+		pos += r;
+	}
+
+	if (!asignify_pipe_close(p)) {
+		ret = false;
+	}
+
+	if (!ret) {
+		asignify_digest_free(st.leaf);
+
+		if (eof) {
+			return (ASIGNIFY_ERROR_VERIFY_SIZE);
+		}
+
+		return (asignify_io_error(cancel));
+	}
+
+	h->size = size;
+	asignify_log_root(&st);
+
+	return (ASIGNIFY_ERROR_OK);
+}
+
+struct asignify_log_head *
+asignify_log_advance(const struct asignify_log_head *prev, int fd,
+	uint64_t size, const asignify_cancel_t *cancel, enum asignify_error *err)
+{
+	struct asignify_log_head *h;
+
+	if (size < prev->size) {
+		*err = ASIGNIFY_ERROR_VERIFY_SIZE;
+		return (NULL);
+	}
+
+	h = xmalloc(sizeof(*h));
+	memcpy(h, prev, sizeof(*h));
+	h->name = xstrdup(prev->name);
+
+	/* Only the tail of the previous head needs to be checked */
+	*err = asignify_log_hash(h, fd, prev->size, cancel);
+
+	if (*err == ASIGNIFY_ERROR_OK &&
+			memcmp(h->root, prev->root, sizeof(h->root)) != 0) {
+		*err = ASIGNIFY_ERROR_VERIFY_DIGEST;
+	}
+
+	if (*err == ASIGNIFY_ERROR_OK) {
+		*err = asignify_log_hash(h, fd, size, cancel);
+	}
+
+	if (*err != ASIGNIFY_ERROR_OK) {
+		asignify_log_head_free(h);
+		return (NULL);
+	}
+
+	return (h);
+}
+
+static bool
+asignify_log_parse_num(const char *line, const char *key, uint64_t *res)
+{
+	size_t klen = strlen(key);
+	char *end;
+
+	if (strncmp(line, key, klen) != 0 || line[klen] != ':' ||
+			line[klen + 1] != ' ' || !isdigit((unsigned char)line[klen + 2])) {
+		return (false);
+	}
+
+	errno = 0;
+	*res = strtoumax(line + klen + 2, &end, 10);
+
+	return (errno == 0 && *end == '\n');
+}
+
+static bool
+asignify_log_parse_hash(const char *line, const char *key, unsigned char *res)
+{
+	size_t klen = strlen(key), blen;
+	const char *end;
+
+	if (strncmp(line, key, klen) != 0 || line[klen] != ':' ||
+			line[klen + 1] != ' ') {
+		return (false);
+	}
+
+	if (hex2bin(res, ASIGNIFY_LOG_HASHLEN, line + klen + 2,
+			ASIGNIFY_LOG_HASHLEN * 2, &blen, &end) != 0 ||
+			blen != ASIGNIFY_LOG_HASHLEN) {
+		return (false);
+	}
+
+	return (*end == '\n');
+}
+
+struct asignify_log_head *
+asignify_log_head_parse(const char *data, size_t len)
+{
+	struct asignify_log_head *h;
+	const char *pos = data, *end = data + len;
+	char line[ASIGNIFY_MAX_LINE];
+	uint64_t v;
+	ssize_t r;
+	unsigned int i;
+
+	if ((r = asignify_buf_getline(&pos, end, line, sizeof(line))) <= 0 ||
+			strcmp(line, LOG_HEAD_MAGIC "\n") != 0) {
+		return (NULL);
+	}
+
+	h = xmalloc0(sizeof(*h));
+
+	if ((r = asignify_buf_getline(&pos, end, line, sizeof(line))) <= 7 ||
+			strncmp(line, "name: ", 6) != 0 || line[r - 1] != '\n' ||
+			r - 7 > ASIGNIFY_MAX_LINE / 2) {
+		goto err;
+	}
+
+	line[r - 1] = '\0';
+	h->name = xstrdup(line + 6);
+
+	if (asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			!asignify_log_parse_num(line, "segment", &h->segment) ||
+			h->segment == 0) {
+		goto err;
+	}
+
+	if (asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0) {
+		goto err;
+	}
+	else if (strcmp(line, "mode: records\n") == 0) {
+		h->records = true;
+	}
+	else if (strcmp(line, "mode: fixed\n") != 0) {
+		goto err;
+	}
+
+	if (asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			!asignify_log_parse_num(line, "size", &h->size) ||
+			asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			!asignify_log_parse_num(line, "leaves", &h->leaves) ||
+			asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			!asignify_log_parse_num(line, "offset", &h->offset) ||
+			asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			!asignify_log_parse_hash(line, "root", h->root)) {
+		goto err;
+	}
+
+	while ((r = asignify_buf_getline(&pos, end, line, sizeof(line))) > 0) {
+		if (h->nfrontier >= ASIGNIFY_LOG_MAX_HEIGHT ||
+				!asignify_log_parse_hash(line, "node",
+				h->frontier[h->nfrontier])) {
+			goto err;
+		}
+		h->nfrontier ++;
+	}
+
+	if (r < 0) {
+		goto err;
+	}
+
+	/* A complete subtree per each bit of the leaves count */
+	for (i = 0, v = h->leaves; v != 0; v >>= 1) {
+		i += v & 1;
+	}
+
+	if (i != h->nfrontier || h->offset > h->size ||
+			h->offset / h->segment < h->leaves) {
+		goto err;
+	}
+
+	if (!h->records && (h->offset != h->leaves * h->segment ||
+			h->size - h->offset >= h->segment)) {
+		goto err;
+	}
+
+	return (h);
+
+err:
+	asignify_log_head_free(h);
+
+	return (NULL);
+}
+
+char *
+asignify_log_head_format(const struct asignify_log_head *h, size_t *len)
+{
+	kvec_t(char) out;
+	char line[ASIGNIFY_MAX_LINE], hex[ASIGNIFY_LOG_HASHLEN * 2 + 1];
+	unsigned int i;
+	int r;
+
+	kv_init(out);
+	r = snprintf(line, sizeof(line), LOG_HEAD_MAGIC "\n"
+		"name: %s\n"
+		"segment: %" PRIu64 "\n"
+		"mode: %s\n"
+		"size: %" PRIu64 "\n"
+		"leaves: %" PRIu64 "\n"
+		"offset: %" PRIu64 "\n"
+		"root: %s\n",
+		h->name, h->segment, h->records ? "records" : "fixed",
+		h->size, h->leaves, h->offset,
+		bin2hex(hex, sizeof(hex), h->root, sizeof(h->root)));
+	kv_push_a(char, out, line, r);
+
+	for (i = 0; i < h->nfrontier; i ++) {
+		r = snprintf(line, sizeof(line), "node: %s\n",
+			bin2hex(hex, sizeof(hex), h->frontier[i], ASIGNIFY_LOG_HASHLEN));
+		kv_push_a(char, out, line, r);
+	}
+
+	*len = kv_size(out);
+
+	return (out.a);
+}
+
+void
+asignify_log_head_free(struct asignify_log_head *h)
+{
+	if (h != NULL) {
+		free(h->name);
+		free(h);
+	}
+}
@@ -0,0 +1,1105 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "asignify_internal.h"
+
+/*
+ * Pipeline is a ring of large buffers shared between a caller and I/O
+ * threads. For readers the threads fill buffers from a descriptor while the
+ * caller consumes them, for writers the caller fills buffers and the thread
+ * flushes them. Without threads support (or for small inputs) the very same
+ * interface performs plain synchronous I/O.
+ *
+ * Readers of regular files may keep several preads in flight at increasing
+ * offsets: block N always goes to slot N % nbufs and the caller receives
+ * blocks strictly in order, so the stream looks sequential to it.
+ *
+ * Writers of regular files preallocate the expected size and pace writeback
+ * of dirty pages, so large outputs are neither fragmented nor flushed at
+ * once. Optionally, output bypasses the page cache (O_DIRECT): data is staged
+ * to write whole aligned pages whilst unaligned head and tail of the output
+ * are written through the cache.
+ */
+
+enum asignify_pipe_type {
+	ASIGNIFY_PIPE_READ = 0,
+	ASIGNIFY_PIPE_WRITE
+};
+
+/* Writeback windows: the previous one is waited for, the current one is started */
+struct asignify_pipe_wb {
+	off_t start;
+	off_t mid;
+};
+
+struct asignify_pipe_buf {
+	unsigned char *data;
+	size_t len;
+	bool ready; /* reader: block has been read */
+};
+
+struct asignify_pipe {
+	enum asignify_pipe_type type;
+	int fd;
+	size_t bufsize;
+	unsigned int nbufs;
+	struct asignify_pipe_buf *bufs;
+	/* Writer state */
+	unsigned int head; /* next slot to fill */
+	unsigned int tail; /* next slot to drain */
+	unsigned int count; /* number of filled slots */
+	/* Reader state */
+	bool seekable;
+	off_t base; /* offset of block 0 */
+	uint64_t next_block; /* next block to be claimed by a reader thread */
+	uint64_t cons_block; /* next block to be returned to the caller */
+	uint64_t last_block; /* the first short block (EOF) */
+	bool held; /* caller holds the slot of cons_block */
+	bool eof;
+	bool stop;
+	int error;
+	bool threaded;
+	unsigned int nthreads;
+	const asignify_cancel_t *cancel;
+	/* Output state, used by writer threads only */
+	off_t out_off; /* -1 if output is not a regular file */
+	struct asignify_pipe_wb wb;
+	int fd_flags;
+	bool direct;
+	unsigned char *stage;
+	size_t staged;
+#ifdef HAVE_PTHREAD
+	pthread_t *thrs;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond_data;
+	pthread_cond_t cond_space;
+#endif
+};
+
+static unsigned int io_depth = ASIGNIFY_PIPE_DEPTH;
+static size_t io_block_size = ASIGNIFY_PIPE_BUFSIZE;
+static bool io_direct = false;
+
+void
+asignify_set_io_params(unsigned int depth, size_t block_size)
+{
+	size_t bs = ASIGNIFY_PIPE_MIN_BLOCK;
+
+	if (depth > 0) {
+		io_depth = depth > ASIGNIFY_PIPE_MAX_DEPTH ?
+			ASIGNIFY_PIPE_MAX_DEPTH : depth;
+	}
+
+	if (block_size > 0) {
+		/* Round down to a power of two, as buffers are aligned allocations */
+		while (bs < ASIGNIFY_PIPE_MAX_BLOCK && bs * 2 <= block_size) {
+			bs *= 2;
+		}
+
+		io_block_size = bs;
+	}
+}
+
+void
+asignify_set_io_direct(bool direct)
+{
+	io_direct = direct;
+}
+
+static ssize_t
+asignify_pipe_pread_full(int fd, unsigned char *buf, size_t len, off_t off)
+{
+	size_t total = 0;
+	ssize_t r;
+
+	while (total < len) {
+		r = pread(fd, buf + total, len - total, off + total);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (-1);
+		}
+		else if (r == 0) {
+			break;
+		}
+
+		total += r;
+	}
+
+	return (total);
+}
+
+static ssize_t
+asignify_pipe_read_full(int fd, unsigned char *buf, size_t len)
+{
+	size_t total = 0;
+	ssize_t r;
+
+	while (total < len) {
+		r = read(fd, buf + total, len - total);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (-1);
+		}
+		else if (r == 0) {
+			break;
+		}
+
+		total += r;
+	}
+
+	return (total);
+}
+
+static bool
+asignify_pipe_write_full(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, buf, len);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (false);
+		}
+
+		buf += r;
+		len -= r;
+	}
+
+	return (true);
+}
+
+static bool
+asignify_pipe_pwrite_full(int fd, const unsigned char *buf, size_t len,
+	off_t off)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = pwrite(fd, buf, len, off);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (false);
+		}
+
+		buf += r;
+		off += r;
+		len -= r;
+	}
+
+	return (true);
+}
+
+static void
+asignify_pipe_preallocate(int fd, off_t off, off_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	/* Output may be shorter than expected, so the file size is kept */
+	if (len >= ASIGNIFY_PIPE_PREALLOC_MIN) {
+		(void)fallocate(fd, FALLOC_FL_KEEP_SIZE, off, len);
+	}
+#endif
+}
+
+/*
+ * Starts writeback of data written since the last window and waits for the
+ * previous window, so there are at most two windows of dirty pages
+ */
+static void
+asignify_pipe_writeback(int fd, struct asignify_pipe_wb *wb, off_t end)
+{
+#if defined(HAVE_SYNC_FILE_RANGE) && defined(SYNC_FILE_RANGE_WRITE)
+	if (end - wb->mid < ASIGNIFY_PIPE_WRITEBACK) {
+		return;
+	}
+
+	(void)sync_file_range(fd, wb->mid, end - wb->mid, SYNC_FILE_RANGE_WRITE);
+
+	if (wb->mid > wb->start) {
+		(void)sync_file_range(fd, wb->start, wb->mid - wb->start,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+			SYNC_FILE_RANGE_WAIT_AFTER);
+	}
+
+	wb->start = wb->mid;
+	wb->mid = end;
+#endif
+}
+
+#ifdef O_DIRECT
+static void
+asignify_pipe_direct_off(struct asignify_pipe *p)
+{
+	(void)fcntl(p->fd, F_SETFL, p->fd_flags);
+	p->direct = false;
+}
+
+/* Writes all whole pages staged, switching to O_DIRECT once it is aligned */
+static bool
+asignify_pipe_stage_flush(struct asignify_pipe *p)
+{
+	size_t n;
+	bool ret;
+
+	if (!p->direct) {
+		n = ASIGNIFY_PIPE_DIRECT_ALIGN -
+			p->out_off % ASIGNIFY_PIPE_DIRECT_ALIGN;
+
+		if (n == ASIGNIFY_PIPE_DIRECT_ALIGN) {
+			n = 0;
+		}
+		else if (p->staged < n) {
+			return (true);
+		}
+
+		if (!asignify_pipe_write_full(p->fd, p->stage, n)) {
+			return (false);
+		}
+
+		p->out_off += n;
+		p->staged -= n;
+		memmove(p->stage, p->stage + n, p->staged);
+
+		if (fcntl(p->fd, F_SETFL, p->fd_flags | O_DIRECT) == -1) {
+			/* Filesystem does not support direct I/O, e.g. tmpfs */
+			n = p->staged;
+			ret = asignify_pipe_write_full(p->fd, p->stage, n);
+			p->out_off += n;
+			p->staged = 0;
+			free(p->stage);
+			p->stage = NULL;
+
+			return (ret);
+		}
+
+		p->direct = true;
+	}
+
+	n = p->staged & ~(size_t)(ASIGNIFY_PIPE_DIRECT_ALIGN - 1);
+
+	if (n > 0) {
+		if (!asignify_pipe_write_full(p->fd, p->stage, n)) {
+			if (errno != EINVAL) {
+				return (false);
+			}
+
+			/* Alignment requirements are stricter than expected */
+			asignify_pipe_direct_off(p);
+
+			if (!asignify_pipe_write_full(p->fd, p->stage, n)) {
+				return (false);
+			}
+		}
+
+		p->out_off += n;
+		p->staged -= n;
+		memmove(p->stage, p->stage + n, p->staged);
+	}
+
+	return (true);
+}
+#endif
+
+/* Writes a block of output, called by the writer thread only */
+static bool
+asignify_pipe_output(struct asignify_pipe *p, const unsigned char *buf,
+	size_t len)
+{
+#ifdef O_DIRECT
+	size_t n, cap = p->bufsize + ASIGNIFY_PIPE_DIRECT_ALIGN;
+
+	while (p->stage != NULL && len > 0) {
+		n = cap - p->staged;
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(p->stage + p->staged, buf, n);
+		p->staged += n;
+		buf += n;
+		len -= n;
+
+		if (!asignify_pipe_stage_flush(p)) {
+			return (false);
+		}
+	}
+#endif
+
+	if (len > 0) {
+		if (!asignify_pipe_write_full(p->fd, buf, len)) {
+			return (false);
+		}
+
+		if (p->out_off != -1) {
+			p->out_off += len;
+			asignify_pipe_writeback(p->fd, &p->wb, p->out_off);
+		}
+	}
+
+	return (true);
+}
+
+/* Writes the unaligned tail of direct output through the page cache */
+static bool
+asignify_pipe_output_finish(struct asignify_pipe *p)
+{
+	bool ret = true;
+
+	if (p->stage != NULL) {
+#ifdef O_DIRECT
+		if (p->direct) {
+			asignify_pipe_direct_off(p);
+		}
+#endif
+
+		if (p->error == 0) {
+			ret = asignify_pipe_write_full(p->fd, p->stage, p->staged);
+		}
+
+		free(p->stage);
+		p->stage = NULL;
+	}
+
+	return (ret);
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+asignify_pipe_reader_thread(void *arg)
+{
+	struct asignify_pipe *p = arg;
+	struct asignify_pipe_buf *slot;
+	uint64_t blk;
+	ssize_t r;
+
+	for (;;) {
+		pthread_mutex_lock(&p->mtx);
+		/* Wait for the slot of the next block to be released by the caller */
+		while (!p->stop && p->error == 0 && p->next_block <= p->last_block &&
+				p->next_block >= p->cons_block + p->nbufs) {
+			pthread_cond_wait(&p->cond_space, &p->mtx);
+		}
+		if (p->stop || p->error != 0 || p->next_block > p->last_block) {
+			pthread_mutex_unlock(&p->mtx);
+			break;
+		}
+		blk = p->next_block ++;
+		slot = &p->bufs[blk % p->nbufs];
+		pthread_mutex_unlock(&p->mtx);
+
+		/* The slot is not visible to the caller until it is marked ready */
+		if (p->seekable) {
+			r = asignify_pipe_pread_full(p->fd, slot->data, p->bufsize,
+				p->base + (off_t)(blk * p->bufsize));
+		}
+		else {
+			r = asignify_pipe_read_full(p->fd, slot->data, p->bufsize);
+		}
+
+		pthread_mutex_lock(&p->mtx);
+		if (r == -1) {
+			p->error = errno;
+		}
+		else {
+			slot->len = r;
+			slot->ready = true;
+
+			if (r < (ssize_t)p->bufsize && blk < p->last_block) {
+				p->last_block = blk;
+			}
+		}
+		pthread_cond_broadcast(&p->cond_data);
+		/* Other threads might wait for a block after EOF */
+		pthread_cond_broadcast(&p->cond_space);
+		pthread_mutex_unlock(&p->mtx);
+	}
+
+	return (NULL);
+}
+
+static void *
+asignify_pipe_writer_thread(void *arg)
+{
+	struct asignify_pipe *p = arg;
+	struct asignify_pipe_buf *slot;
+	bool ok;
+
+	for (;;) {
+		pthread_mutex_lock(&p->mtx);
+		while (p->count == 0 && !p->eof) {
+			pthread_cond_wait(&p->cond_data, &p->mtx);
+		}
+		if (p->count == 0) {
+			pthread_mutex_unlock(&p->mtx);
+			break;
+		}
+		slot = &p->bufs[p->tail];
+		ok = (p->error == 0);
+		pthread_mutex_unlock(&p->mtx);
+
+		/* After an error we still drain buffers to unblock the caller */
+		if (ok && !asignify_pipe_output(p, slot->data, slot->len)) {
+			ok = false;
+		}
+
+		pthread_mutex_lock(&p->mtx);
+		if (!ok && p->error == 0) {
+			p->error = errno != 0 ? errno : EIO;
+		}
+		p->tail = (p->tail + 1) % p->nbufs;
+		p->count --;
+		pthread_cond_signal(&p->cond_space);
+		pthread_mutex_unlock(&p->mtx);
+	}
+
+	return (NULL);
+}
+#endif
+
+static struct asignify_pipe *
+asignify_pipe_new(enum asignify_pipe_type type, int fd, off_t size_hint)
+{
+	struct asignify_pipe *p;
+	unsigned int i;
+	struct stat st;
+
+	p = xmalloc0(sizeof(*p));
+	p->type = type;
+	p->fd = fd;
+	p->bufsize = io_block_size;
+	p->last_block = UINT64_MAX;
+	p->nthreads = 1;
+
+#ifdef HAVE_PTHREAD
+	/* Unknown size (e.g. a pipe) is treated as large */
+	p->threaded = (size_hint < 0 || size_hint >= (off_t)p->bufsize * 2);
+#endif
+
+	if (type == ASIGNIFY_PIPE_READ && fstat(fd, &st) != -1 &&
+			S_ISREG(st.st_mode) &&
+			(p->base = lseek(fd, 0, SEEK_CUR)) != (off_t)-1) {
+		p->seekable = true;
+	}
+
+	p->out_off = -1;
+
+	if (type == ASIGNIFY_PIPE_WRITE && fstat(fd, &st) != -1 &&
+			S_ISREG(st.st_mode) &&
+			(p->out_off = lseek(fd, 0, SEEK_CUR)) != (off_t)-1) {
+		p->wb.start = p->out_off;
+		p->wb.mid = p->out_off;
+
+		if (size_hint > 0) {
+			asignify_pipe_preallocate(fd, p->out_off, size_hint);
+		}
+
+#ifdef O_DIRECT
+		if (io_direct && (p->fd_flags = fcntl(fd, F_GETFL)) != -1) {
+			p->stage = xmalloc_aligned(ASIGNIFY_PIPE_DIRECT_ALIGN,
+				p->bufsize + ASIGNIFY_PIPE_DIRECT_ALIGN);
+		}
+#endif
+	}
+
+	if (p->threaded) {
+		if (p->seekable) {
+			/* Keep up to io_depth reads in flight */
+			p->nthreads = io_depth;
+		}
+		/* One block is held by the caller and one is spare */
+		p->nbufs = p->nthreads + 2;
+		if (p->nbufs < ASIGNIFY_PIPE_NBUFS) {
+			p->nbufs = ASIGNIFY_PIPE_NBUFS;
+		}
+	}
+	else {
+		/* Small files do not deserve megabytes of buffers */
+		while (p->bufsize > ASIGNIFY_PIPE_MIN_BLOCK && size_hint >= 0 &&
+				(off_t)(p->bufsize / 2) >= size_hint) {
+			p->bufsize /= 2;
+		}
+		p->nbufs = 1;
+	}
+
+	p->bufs = xmalloc0(sizeof(*p->bufs) * p->nbufs);
+
+	for (i = 0; i < p->nbufs; i ++) {
+		/* Aligned for chacha and other block based consumers */
+		p->bufs[i].data = xmalloc_aligned(64, p->bufsize);
+	}
+
+#ifdef HAVE_PTHREAD
+	if (p->threaded) {
+		pthread_mutex_init(&p->mtx, NULL);
+		pthread_cond_init(&p->cond_data, NULL);
+		pthread_cond_init(&p->cond_space, NULL);
+		p->thrs = xmalloc0(sizeof(*p->thrs) * p->nthreads);
+
+		for (i = 0; i < p->nthreads; i ++) {
+			if (pthread_create(&p->thrs[i], NULL,
+					type == ASIGNIFY_PIPE_READ ?
+						asignify_pipe_reader_thread :
+						asignify_pipe_writer_thread,
+					p) != 0) {
+				break;
+			}
+		}
+
+		if (i == 0) {
+			/* Fall back to synchronous I/O */
+			pthread_cond_destroy(&p->cond_space);
+			pthread_cond_destroy(&p->cond_data);
+			pthread_mutex_destroy(&p->mtx);
+			free(p->thrs);
+			p->thrs = NULL;
+			p->threaded = false;
+		}
+		else {
+			/* Fewer threads just means fewer reads in flight */
+			p->nthreads = i;
+		}
+	}
+#endif
+
+	return (p);
+}
+
+struct asignify_pipe *
+asignify_pipe_reader(int fd, off_t size_hint)
+{
+	if (fd == -1) {
+		return (NULL);
+	}
+
+	return (asignify_pipe_new(ASIGNIFY_PIPE_READ, fd, size_hint));
+}
+
+struct asignify_pipe *
+asignify_pipe_writer(int fd, off_t size_hint)
+{
+	if (fd == -1) {
+		return (NULL);
+	}
+
+	return (asignify_pipe_new(ASIGNIFY_PIPE_WRITE, fd, size_hint));
+}
+
+size_t
+asignify_pipe_bufsize(struct asignify_pipe *p)
+{
+	return (p->bufsize);
+}
+
+void
+asignify_pipe_set_cancel(struct asignify_pipe *p, const asignify_cancel_t *c)
+{
+	if (p != NULL) {
+		p->cancel = c;
+	}
+}
+
+/*
+ * Turns a fired cancellation token into a pipe error: reader threads stop
+ * claiming blocks and the writer thread drops whatever is still queued
+ */
+static bool
+asignify_pipe_cancelled(struct asignify_pipe *p)
+{
+	if (!asignify_cancel_check(p->cancel)) {
+		return (false);
+	}
+
+#ifdef HAVE_PTHREAD
+	if (p->threaded) {
+		pthread_mutex_lock(&p->mtx);
+		if (p->error == 0) {
+			p->error = ECANCELED;
+		}
+		pthread_cond_broadcast(&p->cond_data);
+		pthread_cond_broadcast(&p->cond_space);
+		pthread_mutex_unlock(&p->mtx);
+
+		return (true);
+	}
+#endif
+
+	if (p->error == 0) {
+		p->error = ECANCELED;
+	}
+
+	return (true);
+}
+
+ssize_t
+asignify_pipe_read(struct asignify_pipe *p, const unsigned char **data)
+{
+	ssize_t r;
+#ifdef HAVE_PTHREAD
+	struct asignify_pipe_buf *slot;
+#endif
+
+	if (p == NULL || p->type != ASIGNIFY_PIPE_READ) {
+		return (-1);
+	}
+
+	if (asignify_pipe_cancelled(p)) {
+		return (-1);
+	}
+
+	if (!p->threaded) {
+		if (p->eof) {
+			return (p->error != 0 ? -1 : 0);
+		}
+
+		r = asignify_pipe_read_full(p->fd, p->bufs[0].data, p->bufsize);
+
+		if (r < (ssize_t)p->bufsize) {
+			p->eof = true;
+			if (r == -1) {
+				p->error = errno;
+				return (-1);
+			}
+		}
+
+		*data = p->bufs[0].data;
+
+		return (r);
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&p->mtx);
+	if (p->held) {
+		/* Release the previous buffer to the reader threads */
+		p->held = false;
+		p->bufs[p->cons_block % p->nbufs].ready = false;
+		p->cons_block ++;
+		pthread_cond_broadcast(&p->cond_space);
+	}
+
+	slot = &p->bufs[p->cons_block % p->nbufs];
+
+	while (!slot->ready && p->error == 0 && p->cons_block <= p->last_block) {
+		pthread_cond_wait(&p->cond_data, &p->mtx);
+	}
+
+	if (p->error != 0) {
+		r = -1;
+	}
+	else if (slot->ready && slot->len > 0) {
+		p->held = true;
+		*data = slot->data;
+		r = slot->len;
+	}
+	else {
+		r = 0;
+	}
+	pthread_mutex_unlock(&p->mtx);
+#else
+	r = -1;
+#endif
+
+	return (r);
+}
+
+unsigned char *
+asignify_pipe_get_buf(struct asignify_pipe *p)
+{
+	unsigned char *res = NULL;
+
+	if (p == NULL || p->type != ASIGNIFY_PIPE_WRITE) {
+		return (NULL);
+	}
+
+	if (asignify_pipe_cancelled(p)) {
+		return (NULL);
+	}
+
+	if (!p->threaded) {
+		return (p->error == 0 ? p->bufs[0].data : NULL);
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&p->mtx);
+	while (p->count == p->nbufs && p->error == 0) {
+		pthread_cond_wait(&p->cond_space, &p->mtx);
+	}
+	if (p->error == 0) {
+		res = p->bufs[p->head].data;
+	}
+	pthread_mutex_unlock(&p->mtx);
+#endif
+
+	return (res);
+}
+
+bool
+asignify_pipe_write(struct asignify_pipe *p, size_t len)
+{
+	bool ret = false;
+
+	if (p == NULL || p->type != ASIGNIFY_PIPE_WRITE || len > p->bufsize) {
+		return (false);
+	}
+
+	if (!p->threaded) {
+		if (p->error == 0 &&
+				!asignify_pipe_output(p, p->bufs[0].data, len)) {
+			p->error = errno;
+		}
+
+		return (p->error == 0);
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&p->mtx);
+	if (p->error == 0) {
+		p->bufs[p->head].len = len;
+		p->head = (p->head + 1) % p->nbufs;
+		p->count ++;
+		pthread_cond_signal(&p->cond_data);
+		ret = true;
+	}
+	pthread_mutex_unlock(&p->mtx);
+#endif
+
+	return (ret);
+}
+
+bool
+asignify_pipe_close(struct asignify_pipe *p)
+{
+	bool ret;
+	unsigned int i;
+
+	if (p == NULL) {
+		return (false);
+	}
+
+	/* Cancelled output is not worth flushing */
+	(void)asignify_pipe_cancelled(p);
+
+#ifdef HAVE_PTHREAD
+	if (p->threaded) {
+		pthread_mutex_lock(&p->mtx);
+		if (p->type == ASIGNIFY_PIPE_READ) {
+			p->stop = true;
+			pthread_cond_broadcast(&p->cond_space);
+		}
+		else {
+			/* Writer flushes everything queued before exiting */
+			p->eof = true;
+			pthread_cond_signal(&p->cond_data);
+		}
+		pthread_mutex_unlock(&p->mtx);
+
+		for (i = 0; i < p->nthreads; i ++) {
+			pthread_join(p->thrs[i], NULL);
+		}
+
+		pthread_cond_destroy(&p->cond_space);
+		pthread_cond_destroy(&p->cond_data);
+		pthread_mutex_destroy(&p->mtx);
+		free(p->thrs);
+	}
+#endif
+
+	if (p->type == ASIGNIFY_PIPE_WRITE && !asignify_pipe_output_finish(p) &&
+			p->error == 0) {
+		p->error = errno != 0 ? errno : EIO;
+	}
+
+	ret = (p->error == 0);
+
+	for (i = 0; i < p->nbufs; i ++) {
+		free(p->bufs[i].data);
+	}
+
+	free(p->bufs);
+	free(p);
+
+	return (ret);
+}
+
+/*
+ * Parallel transform: workers claim blocks of a regular file, read, transform
+ * and write them at the same relative offset of the output, whilst the
+ * caller consumes finished blocks strictly in order (e.g. to calculate
+ * a MAC). Block N uses slot N % nslots, so the caller can hold a block back.
+ */
+struct asignify_pipe_tslot {
+	unsigned char *in;
+	unsigned char *out;
+	size_t len;
+	bool done;
+};
+
+struct asignify_pipe_transform_ctx {
+	int in_fd;
+	off_t in_off;
+	int out_fd;
+	off_t out_off;
+	off_t len;
+	size_t bufsize;
+	unsigned int nslots;
+	struct asignify_pipe_tslot *slots;
+	uint64_t nblocks;
+	uint64_t next_block;
+	uint64_t cons_block;
+	bool error;
+	bool stop;
+	asignify_pipe_transform_cb transform;
+	void *ud;
+	const asignify_cancel_t *cancel;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mtx;
+	pthread_cond_t cond_data;
+	pthread_cond_t cond_space;
+#endif
+};
+
+static bool
+asignify_pipe_transform_block(struct asignify_pipe_transform_ctx *t,
+	uint64_t blk, struct asignify_pipe_tslot *slot)
+{
+	off_t off = (off_t)(blk * t->bufsize);
+	size_t len;
+
+	if (asignify_cancel_check(t->cancel)) {
+		return (false);
+	}
+
+	len = (t->len - off) > (off_t)t->bufsize ? t->bufsize : t->len - off;
+	slot->len = len;
+
+	if (asignify_pipe_pread_full(t->in_fd, slot->in, len,
+			t->in_off + off) != (ssize_t)len) {
+		return (false);
+	}
+
+	if (!t->transform(t->ud, off, slot->in, slot->out, len)) {
+		return (false);
+	}
+
+	return (asignify_pipe_pwrite_full(t->out_fd, slot->out, len,
+		t->out_off + off));
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+asignify_pipe_transform_thread(void *arg)
+{
+	struct asignify_pipe_transform_ctx *t = arg;
+	struct asignify_pipe_tslot *slot;
+	uint64_t blk;
+	bool ok;
+
+	for (;;) {
+		pthread_mutex_lock(&t->mtx);
+		while (!t->stop && !t->error && t->next_block < t->nblocks &&
+				t->next_block >= t->cons_block + t->nslots) {
+			pthread_cond_wait(&t->cond_space, &t->mtx);
+		}
+		if (t->stop || t->error || t->next_block >= t->nblocks) {
+			pthread_mutex_unlock(&t->mtx);
+			break;
+		}
+		blk = t->next_block ++;
+		slot = &t->slots[blk % t->nslots];
+		pthread_mutex_unlock(&t->mtx);
+
+		ok = asignify_pipe_transform_block(t, blk, slot);
+
+		pthread_mutex_lock(&t->mtx);
+		if (ok) {
+			slot->done = true;
+		}
+		else {
+			t->error = true;
+		}
+		pthread_cond_broadcast(&t->cond_data);
+		pthread_mutex_unlock(&t->mtx);
+	}
+
+	return (NULL);
+}
+#endif
+
+bool
+asignify_pipe_transform(int in_fd, int out_fd, off_t out_off, off_t len,
+	unsigned int nthreads, asignify_pipe_transform_cb transform,
+	asignify_pipe_block_cb done, void *ud, const asignify_cancel_t *cancel)
+{
+	struct asignify_pipe_transform_ctx t;
+	struct asignify_pipe_tslot *slot;
+	struct asignify_pipe_wb wb;
+	unsigned int i, started = 0;
+	bool ret = true;
+#ifdef HAVE_PTHREAD
+	pthread_t *thrs = NULL;
+#endif
+
+	memset(&t, 0, sizeof(t));
+	t.in_fd = in_fd;
+	t.out_fd = out_fd;
+	t.out_off = out_off;
+	t.len = len;
+	t.bufsize = io_block_size;
+	t.nblocks = (len + t.bufsize - 1) / t.bufsize;
+	t.transform = transform;
+	t.ud = ud;
+	t.cancel = cancel;
+
+	if ((t.in_off = lseek(in_fd, 0, SEEK_CUR)) == (off_t)-1) {
+		return (false);
+	}
+
+	asignify_pipe_preallocate(out_fd, out_off, len);
+	wb.start = out_off;
+	wb.mid = out_off;
+
+	/* Each worker can have a block in flight while the caller lags behind */
+	t.nslots = nthreads > 0 ? nthreads * 2 : 1;
+	t.slots = xmalloc0(sizeof(*t.slots) * t.nslots);
+
+	for (i = 0; i < t.nslots; i ++) {
+		t.slots[i].in = xmalloc_aligned(64, t.bufsize);
+		t.slots[i].out = xmalloc_aligned(64, t.bufsize);
+	}
+
+#ifdef HAVE_PTHREAD
+	if (nthreads > 1 && t.nblocks > 1) {
+		pthread_mutex_init(&t.mtx, NULL);
+		pthread_cond_init(&t.cond_data, NULL);
+		pthread_cond_init(&t.cond_space, NULL);
+		thrs = xmalloc0(sizeof(*thrs) * nthreads);
+
+		for (i = 0; i < nthreads; i ++) {
+			if (pthread_create(&thrs[i], NULL, asignify_pipe_transform_thread,
+					&t) != 0) {
+				break;
+			}
+		}
+
+		started = i;
+	}
+#endif
+
+	while (t.cons_block < t.nblocks) {
+		slot = &t.slots[t.cons_block % t.nslots];
+
+		if (started == 0) {
+			/* Synchronous fallback */
+			if (!asignify_pipe_transform_block(&t, t.cons_block, slot)) {
+				ret = false;
+				break;
+			}
+		}
+#ifdef HAVE_PTHREAD
+		else {
+			pthread_mutex_lock(&t.mtx);
+			while (!slot->done && !t.error) {
+				pthread_cond_wait(&t.cond_data, &t.mtx);
+			}
+			ret = !t.error;
+			pthread_mutex_unlock(&t.mtx);
+
+			if (!ret) {
+				break;
+			}
+		}
+#endif
+
+		done(ud, slot->in, slot->out, slot->len);
+		/* All blocks up to this one have been written */
+		asignify_pipe_writeback(out_fd, &wb,
+			out_off + (off_t)(t.cons_block * t.bufsize + slot->len));
+
+#ifdef HAVE_PTHREAD
+		if (started > 0) {
+			pthread_mutex_lock(&t.mtx);
+			slot->done = false;
+			t.cons_block ++;
+			pthread_cond_broadcast(&t.cond_space);
+			pthread_mutex_unlock(&t.mtx);
+			continue;
+		}
+#endif
+		t.cons_block ++;
+	}
+
+#ifdef HAVE_PTHREAD
+	if (thrs != NULL) {
+		pthread_mutex_lock(&t.mtx);
+		t.stop = true;
+		pthread_cond_broadcast(&t.cond_space);
+		pthread_mutex_unlock(&t.mtx);
+
+		for (i = 0; i < started; i ++) {
+			pthread_join(thrs[i], NULL);
+		}
+
+		pthread_cond_destroy(&t.cond_space);
+		pthread_cond_destroy(&t.cond_data);
+		pthread_mutex_destroy(&t.mtx);
+		free(thrs);
+	}
+#endif
+
+	for (i = 0; i < t.nslots; i ++) {
+		explicit_memzero(t.slots[i].in, t.bufsize);
+		explicit_memzero(t.slots[i].out, t.bufsize);
+		free(t.slots[i].in);
+		free(t.slots[i].out);
+	}
+
+	free(t.slots);
+
+	return (ret);
+}
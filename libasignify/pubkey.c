@@ -139,6 +139,59 @@ asignify_pubkey_try_ssh(const char *buf, size_t buflen,
 	return (true);
 }
 
+/*
+ * Returns false if no more lines should be processed
+ */
+static bool
+asignify_pubkey_parse_line(const char *buf, size_t r, bool first,
+	struct asignify_public_data **res)
+{
+	if (r > sizeof(PUBKEY_MAGIC)) {
+		if (first && memcmp(buf, PUBKEY_MAGIC, sizeof(PUBKEY_MAGIC) - 1) == 0) {
+			*res = asignify_public_data_load(buf, r,
+					PUBKEY_MAGIC, sizeof(PUBKEY_MAGIC) - 1,
+					PUBKEY_VER_MAX, PUBKEY_VER_MAX,
+					KEY_ID_LEN, PUBKEY_KEY_LEN);
+			/* XXX: should we stop after the first public key read? */
+			return (false);
+		}
+	}
+	if (r > sizeof(SSH_KEY_MAGIC) &&
+			memcmp(buf, SSH_KEY_MAGIC, sizeof (SSH_KEY_MAGIC) - 1) == 0) {
+		/* Try ssh pubkey */
+		if (asignify_pubkey_try_ssh(buf, r, res)) {
+			/* XXX: need to read all SSH keys */
+			return (false);
+		}
+	}
+	else if (!asignify_pubkey_try_obsd(buf, r, res)) {
+		return (false);
+	}
+
+	return (true);
+}
+
+struct asignify_public_data*
+asignify_pubkey_load_buf(const char *buf, size_t len)
+{
+	struct asignify_public_data *res = NULL;
+	char line[ASIGNIFY_MAX_LINE];
+	const char *p = buf, *end = buf + len;
+	ssize_t r;
+	bool first = true;
+
+	while ((r = asignify_buf_getline(&p, end, line, sizeof(line))) > 0) {
+		if (!asignify_pubkey_parse_line(line, r, first, &res)) {
+			break;
+		}
+
+		first = false;
+	}
+
+	return (res);
+}
+
+#ifndef ASIGNIFY_VERIFY_ONLY
 struct asignify_public_data*
 asignify_pubkey_load(FILE *f)
 {
@@ -153,33 +206,18 @@ asignify_pubkey_load(FILE *f)
 	}
 
 	while ((r = getline(&buf, &buflen, f)) != -1) {
-		if (r > sizeof(PUBKEY_MAGIC)) {
-			if (first && memcmp(buf, PUBKEY_MAGIC, sizeof(PUBKEY_MAGIC) - 1) == 0) {
-				res = asignify_public_data_load(buf, r,
-						PUBKEY_MAGIC, sizeof(PUBKEY_MAGIC) - 1,
-						PUBKEY_VER_MAX, PUBKEY_VER_MAX,
-						KEY_ID_LEN, PUBKEY_KEY_LEN);
-				/* XXX: should we stop after the first public key read? */
-				break;
-			}
-		}
-		if (r > sizeof(SSH_KEY_MAGIC) &&
-				memcmp(buf, SSH_KEY_MAGIC, sizeof (SSH_KEY_MAGIC) - 1) == 0) {
-			/* Try ssh pubkey */
-			if (asignify_pubkey_try_ssh(buf, r, &res)) {
-				/* XXX: need to read all SSH keys */
-				break;
-			}
-		}
-		else if (!asignify_pubkey_try_obsd(buf, r, &res)) {
+		if (!asignify_pubkey_parse_line(buf, r, first, &res)) {
 			break;
 		}
 
 		first = false;
 	}
 
+	free(buf);
+
 	return (res);
 }
+#endif
 
 bool
 asignify_pubkey_check_signature(struct asignify_public_data *pk,
@@ -240,6 +278,7 @@ asignify_pubkey_check_signature(struct asignify_public_data *pk,
 	return (false);
 }
 
+#ifndef ASIGNIFY_VERIFY_ONLY
 bool
 asignify_pubkey_write(struct asignify_public_data *pk, FILE *f)
 {
@@ -265,3 +304,4 @@ asignify_pubkey_write(struct asignify_public_data *pk, FILE *f)
 
 	return (ret);
 }
+#endif
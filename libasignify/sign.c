@@ -26,6 +26,7 @@
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/param.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -34,6 +35,7 @@
 #include <inttypes.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "blake2.h"
 #include "sha2.h"
@@ -43,18 +45,66 @@
 #include "khash.h"
 #include "kvec.h"
 
+/*
+ * Digests lines are accumulated in a memory buffer. For sorted output, once
+ * the buffer exceeds the memory limit, its lines are sorted and spilled to a
+ * temporary file (run); all runs are merged when the signature is written.
+ * The signature itself is computed by streaming the (merged) lines, so the
+ * whole digests file is never kept in memory.
+ */
+struct asignify_sign_line {
+	const char *data;
+	size_t len;
+};
+
+struct asignify_sign_run {
+	FILE *f;
+	char *line;
+	size_t linelen;
+	ssize_t len;
+};
+
+/* File entry of the signature being updated */
+struct asignify_sign_prev {
+	char *lines[ASIGNIFY_DIGEST_MAX];
+	uintmax_t size;
+	uintmax_t mtime;
+	bool touched;
+};
+
+KHASH_INIT(asignify_sign_prev_hash, const char *, struct asignify_sign_prev *, 1,
+	kh_str_hash_func, kh_str_hash_equal);
+
 struct asignify_sign_ctx {
 	struct asignify_private_data *privk;
-	kvec_t(struct asignify_file) files;
+	khash_t(asignify_sign_prev_hash) *prev;
+	kvec_t(char) lines;
+	size_t nlines;
+	uint64_t total;
+	kvec_t(struct asignify_sign_run) runs;
+	/* Lines of the attestation being made */
+	kvec_t(char) attest;
+	time_t start;
+	bool sorted;
+	bool conflict;
+	size_t mem_limit;
+	char *tmpdir;
+	const asignify_cancel_t *cancel;
 	const char *error;
 };
 
+typedef bool (*asignify_sign_line_cb)(const char *data, size_t len, void *ud);
+typedef kvec_t(char) asignify_sign_text_t;
+
+#define SIGN_CANCEL_CHECK_LINES 4096
+
 asignify_sign_t*
 asignify_sign_init(void)
 {
 	asignify_sign_t *nctx;
 
 	nctx = xmalloc0(sizeof(*nctx));
+	nctx->start = time(NULL);
 
 	return (nctx);
 }
@@ -90,159 +140,1477 @@ asignify_sign_load_privkey(asignify_sign_t *ctx, const char *privf,
 	return (ret);
 }
 
-bool
-asignify_sign_add_file(asignify_sign_t *ctx, const char *f,
-	enum asignify_digest_type dt)
+/* Returns file name of a digests line: TYPE (name) = value */
+static void
+asignify_sign_line_name(const char *data, size_t len, const char **name,
+	size_t *nlen)
+{
+	const char *b, *e;
+
+	b = memchr(data, '(', len);
+
+	if (b != NULL) {
+		b ++;
+
+		for (e = data + len - 1; e > b; e --) {
+			if (*e == ')') {
+				*name = b;
+				*nlen = e - b;
+
+				return;
+			}
+		}
+	}
+
+	*name = data;
+	*nlen = len;
+}
+
+static int
+asignify_sign_line_cmp(const char *d1, size_t l1, const char *d2, size_t l2)
+{
+	const char *n1, *n2;
+	size_t nl1, nl2;
+	int r;
+
+	/* Group digests of the same file together */
+	asignify_sign_line_name(d1, l1, &n1, &nl1);
+	asignify_sign_line_name(d2, l2, &n2, &nl2);
+
+	if ((r = memcmp(n1, n2, MIN(nl1, nl2))) != 0) {
+		return (r);
+	}
+	if (nl1 != nl2) {
+		return (nl1 < nl2 ? -1 : 1);
+	}
+	if ((r = memcmp(d1, d2, MIN(l1, l2))) != 0) {
+		return (r);
+	}
+
+	return (l1 < l2 ? -1 : (l1 > l2));
+}
+
+static int
+asignify_sign_line_qcmp(const void *a, const void *b)
+{
+	const struct asignify_sign_line *l1 = a, *l2 = b;
+
+	return (asignify_sign_line_cmp(l1->data, l1->len, l2->data, l2->len));
+}
+
+/*
+ * Compares adjacent sorted lines: returns 1 for duplicates, -1 for different
+ * values of the same digest of the same file and 0 otherwise
+ */
+static int
+asignify_sign_line_dup(const char *d1, size_t l1, const char *d2, size_t l2)
+{
+	const char *n1, *n2;
+	size_t nl1, nl2, k1, k2;
+
+	asignify_sign_line_name(d1, l1, &n1, &nl1);
+	asignify_sign_line_name(d2, l2, &n2, &nl2);
+	/* Key is everything up to the closing brace */
+	k1 = n1 - d1 + nl1;
+	k2 = n2 - d2 + nl2;
+
+	if (k1 != k2 || memcmp(d1, d2, k1) != 0) {
+		return (0);
+	}
+
+	return ((l1 == l2 && memcmp(d1, d2, l1) == 0) ? 1 : -1);
+}
+
+/* Returns sorted array of lines stored in the memory buffer */
+static struct asignify_sign_line *
+asignify_sign_sort_lines(asignify_sign_t *ctx)
+{
+	struct asignify_sign_line *res;
+	const char *p, *end, *nl;
+	size_t i = 0;
+
+	res = xmalloc(sizeof(*res) * (ctx->nlines + 1));
+	p = ctx->lines.a;
+	end = p + kv_size(ctx->lines);
+
+	while (p < end && i < ctx->nlines) {
+		nl = memchr(p, '\n', end - p);
+		res[i].data = p;
+		res[i].len = nl - p + 1;
+		p = nl + 1;
+		i ++;
+	}
+
+	qsort(res, ctx->nlines, sizeof(*res), asignify_sign_line_qcmp);
+
+	return (res);
+}
+
+static FILE *
+asignify_sign_tmpfile(asignify_sign_t *ctx)
 {
+	char path[PATH_MAX];
+	const char *dir = ctx->tmpdir;
 	int fd;
-	struct stat st;
-	unsigned char *calc_digest;
-	struct asignify_file check_file;
-	struct asignify_file_digest *dig;
+	FILE *f;
 
-	if (ctx == NULL || f == NULL || dt >= ASIGNIFY_DIGEST_MAX) {
-		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+	if (dir == NULL && (dir = getenv("TMPDIR")) == NULL) {
+		dir = "/tmp";
+	}
+
+	if (snprintf(path, sizeof(path), "%s/asignify-sort.XXXXXX", dir) >=
+			(int)sizeof(path)) {
+		return (NULL);
+	}
+
+	if ((fd = mkstemp(path)) == -1) {
+		return (NULL);
+	}
+
+	/* Runs are never needed after the context is freed */
+	unlink(path);
+
+	if ((f = fdopen(fd, "w+")) == NULL) {
+		close(fd);
+	}
+
+	return (f);
+}
+
+/* Writes sorted lines of the memory buffer to a new run */
+static bool
+asignify_sign_spill(asignify_sign_t *ctx)
+{
+	struct asignify_sign_line *sorted;
+	struct asignify_sign_run run;
+	size_t i;
+	bool ret = true;
+
+	memset(&run, 0, sizeof(run));
+
+	if ((run.f = asignify_sign_tmpfile(ctx)) == NULL) {
 		return (false);
 	}
 
-	fd = xopen(f, O_RDONLY, 0);
-	if (fd == -1) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	sorted = asignify_sign_sort_lines(ctx);
+
+	for (i = 0; i < ctx->nlines && ret; i ++) {
+		ret = (fwrite(sorted[i].data, sorted[i].len, 1, run.f) == 1);
+	}
+
+	free(sorted);
+
+	if (!ret || fflush(run.f) != 0) {
+		fclose(run.f);
 		return (false);
 	}
 
-	check_file.fname = xstrdup(f);
+	kv_push(struct asignify_sign_run, ctx->runs, run);
+	kv_size(ctx->lines) = 0;
+	ctx->nlines = 0;
 
-	if (dt == ASIGNIFY_DIGEST_SIZE) {
-		fstat(fd, &st);
-		check_file.size = st.st_size;
-		check_file.digests = 0;
+	return (true);
+}
+
+static bool
+asignify_sign_run_next(struct asignify_sign_run *run)
+{
+	run->len = getline(&run->line, &run->linelen, run->f);
+
+	return (run->len > 0);
+}
+
+static bool
+asignify_sign_heap_less(asignify_sign_t *ctx, unsigned int a, unsigned int b)
+{
+	struct asignify_sign_run *r1 = &kv_A(ctx->runs, a),
+		*r2 = &kv_A(ctx->runs, b);
+
+	return (asignify_sign_line_cmp(r1->line, r1->len, r2->line, r2->len) < 0);
+}
+
+static void
+asignify_sign_heap_down(asignify_sign_t *ctx, unsigned int *heap,
+	unsigned int n, unsigned int i)
+{
+	unsigned int c, tmp;
+
+	while ((c = i * 2 + 1) < n) {
+		if (c + 1 < n && asignify_sign_heap_less(ctx, heap[c + 1], heap[c])) {
+			c ++;
+		}
+		if (!asignify_sign_heap_less(ctx, heap[c], heap[i])) {
+			break;
+		}
+		tmp = heap[i];
+		heap[i] = heap[c];
+		heap[c] = tmp;
+		i = c;
 	}
-	else {
-		calc_digest = asignify_digest_fd(dt, fd);
+}
 
-		if (calc_digest == NULL) {
-			close(fd);
-			ctx->error = xerr_string(ASIGNIFY_ERROR_SIZE);
+/* Passes all digests lines in the output order to cb */
+static bool
+asignify_sign_emit(asignify_sign_t *ctx, asignify_sign_line_cb cb, void *ud)
+{
+	unsigned int *heap, n = 0, i;
+	struct asignify_sign_run *run;
+	uint64_t cnt = 0;
+	kvec_t(char) prev;
+	int dup;
+	bool ret = true;
+
+	if (kv_size(ctx->runs) == 0) {
+		/* Memory buffer is already in the output order */
+		return (kv_size(ctx->lines) == 0 ||
+			cb(ctx->lines.a, kv_size(ctx->lines), ud));
+	}
+
+	heap = xmalloc(sizeof(*heap) * kv_size(ctx->runs));
+	kv_init(prev);
+
+	for (i = 0; i < kv_size(ctx->runs); i ++) {
+		run = &kv_A(ctx->runs, i);
+
+		if (fseeko(run->f, 0, SEEK_SET) != 0) {
+			free(heap);
 			return (false);
 		}
-		dig = xmalloc0(sizeof(*dig));
-		dig->digest_type = dt;
-		dig->digest = calc_digest;
-		check_file.size = 0;
-		check_file.digests = dig;
-		close(fd);
+		if (asignify_sign_run_next(run)) {
+			heap[n ++] = i;
+		}
+	}
+
+	for (i = n / 2; i > 0; i --) {
+		asignify_sign_heap_down(ctx, heap, n, i - 1);
+	}
+
+	while (n > 0) {
+		if (++cnt % SIGN_CANCEL_CHECK_LINES == 0 &&
+				asignify_cancel_check(ctx->cancel)) {
+			ret = false;
+			break;
+		}
+
+		run = &kv_A(ctx->runs, heap[0]);
+		dup = kv_size(prev) > 0 ? asignify_sign_line_dup(prev.a,
+			kv_size(prev), run->line, run->len) : 0;
+
+		if (dup == -1) {
+			ctx->conflict = true;
+			ret = false;
+			break;
+		}
+		else if (dup == 0) {
+			if (!cb(run->line, run->len, ud)) {
+				ret = false;
+				break;
+			}
+
+			kv_size(prev) = 0;
+			kv_push_a(char, prev, run->line, run->len);
+		}
+
+		if (!asignify_sign_run_next(run)) {
+			if (ferror(run->f)) {
+				ret = false;
+				break;
+			}
+			heap[0] = heap[-- n];
+		}
+
+		asignify_sign_heap_down(ctx, heap, n, 0);
 	}
 
-	kv_push(struct asignify_file, ctx->files, check_file);
+	kv_destroy(prev);
+	free(heap);
+
+	return (ret);
+}
+
+static bool
+asignify_sign_digest_cb(const char *data, size_t len, void *ud)
+{
+	asignify_digest_update(ud, (const unsigned char *)data, len);
+
+	return (true);
+}
+
+static bool
+asignify_sign_write_cb(const char *data, size_t len, void *ud)
+{
+	return (fwrite(data, len, 1, ud) == 1);
+}
+
+static bool
+asignify_sign_reader_cb(struct asignify_digest_ctx *dig, void *ud)
+{
+	return (asignify_sign_emit(ud, asignify_sign_digest_cb, dig));
+}
+
+static bool
+asignify_sign_push_line(asignify_sign_t *ctx, const char *line, size_t len)
+{
+	kv_push_a(char, ctx->lines, line, len);
+	ctx->nlines ++;
+	ctx->total ++;
+
+	if (ctx->sorted && kv_size(ctx->lines) +
+			ctx->nlines * sizeof(struct asignify_sign_line) > ctx->mem_limit) {
+		if (!asignify_sign_spill(ctx)) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+			return (false);
+		}
+	}
 
 	return (true);
 }
 
-bool
-asignify_sign_write_signature(asignify_sign_t *ctx, const char *sigf)
+/* Formats digests line, digest is NULL for SIZE and MTIME */
+static int
+asignify_sign_format_line(char *line, size_t len, const char *fname,
+	size_t fnlen, enum asignify_digest_type dt, const unsigned char *digest,
+	uintmax_t num)
 {
-	kvec_t(char) out;
-	char sig_pad[crypto_sign_BYTES + sizeof(unsigned int)];
-	char line[PATH_MAX + 256], hex[256];
-	struct asignify_file *f;
-	int i, r;
-	bool ret = false;
-	struct asignify_public_data *sig = NULL;
-	FILE *outf;
+	char hex[256];
 
-	if (ctx == NULL || ctx->privk == NULL || kv_size(ctx->files) == 0) {
-		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+	if (asignify_digest_len(dt) == 0) {
+		return (snprintf(line, len, "%s (%.*s) = %ju\n",
+			asignify_digest_name(dt), (int)fnlen, fname, num));
+	}
+
+	bin2hex(hex, sizeof(hex) - 1, digest, asignify_digest_len(dt));
+
+	return (snprintf(line, len, "%s (%.*s) = %s\n",
+		asignify_digest_name(dt), (int)fnlen, fname, hex));
+}
+
+static bool
+asignify_sign_push_digest(asignify_sign_t *ctx, const char *fname,
+	size_t fnlen, enum asignify_digest_type dt, const unsigned char *digest,
+	uintmax_t num)
+{
+	char line[PATH_MAX + 256];
+	int r;
+
+	r = asignify_sign_format_line(line, sizeof(line), fname, fnlen, dt,
+		digest, num);
+
+	if (r >= (int)sizeof(line)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_SIZE);
 		return (false);
 	}
 
-	kv_init(out);
-	kv_reserve(char, out, kv_size(ctx->files) * PATH_MAX + crypto_sign_BYTES);
-
-	memset(sig_pad, 0, sizeof(sig_pad));
-	memcpy(sig_pad + crypto_sign_BYTES, &ctx->privk->version,
-		sizeof(unsigned int));
-	kv_push_a(char, out, sig_pad, sizeof(sig_pad));
-
-	for (i = 0; i < kv_size(ctx->files); i ++) {
-		f = &kv_A(ctx->files, i);
-		if (f->size != 0) {
-			r = snprintf(line, sizeof(line), "SIZE (%s) = %zu\n", f->fname,
-				f->size);
-			if (r >= sizeof(line)) {
-				ctx->error = xerr_string(ASIGNIFY_ERROR_SIZE);
-				kv_destroy(out);
-				return (false);
+	return (asignify_sign_push_line(ctx, line, r));
+}
+
+/* Validates value of a digests line */
+static bool
+asignify_sign_parse_value(enum asignify_digest_type type, const char *value,
+	size_t vlen, unsigned char *digest, size_t digestlen, uintmax_t *num)
+{
+	char buf[32], *end;
+	unsigned int dlen;
+
+	dlen = asignify_digest_len(type);
+
+	if (dlen == 0) {
+		if (vlen == 0 || vlen >= sizeof(buf)) {
+			return (false);
+		}
+
+		memcpy(buf, value, vlen);
+		buf[vlen] = '\0';
+		errno = 0;
+		*num = strtoumax(buf, &end, 10);
+
+		return (*end == '\0' && errno == 0);
+	}
+
+	return (dlen <= digestlen && vlen == dlen * 2 &&
+		hex2bin(digest, dlen, value, vlen, NULL, NULL) == 0);
+}
+
+/*
+ * Frees entries of the updated signature, if merge is true, lines of the
+ * files that were not re-added are added to the new signature
+ */
+static bool
+asignify_sign_merge_prev(asignify_sign_t *ctx, bool merge)
+{
+	struct asignify_sign_prev *pf;
+	const char *key;
+	bool ret = true;
+	unsigned int i;
+
+	if (ctx->prev == NULL) {
+		return (true);
+	}
+
+	kh_foreach(ctx->prev, key, pf, {
+		for (i = 0; i < ASIGNIFY_DIGEST_MAX; i ++) {
+			if (merge && ret && !pf->touched && pf->lines[i] != NULL) {
+				ret = asignify_sign_push_line(ctx, pf->lines[i],
+					strlen(pf->lines[i]));
 			}
+
+			free(pf->lines[i]);
 		}
-		else {
-			bin2hex(hex, sizeof(hex) - 1, f->digests->digest,
-				asignify_digest_len(f->digests->digest_type));
-			r = snprintf(line, sizeof(line), "%s (%s) = %s\n",
-				asignify_digest_name(f->digests->digest_type),
-				f->fname,
-				hex);
-			if (r >= sizeof(line)) {
-				ctx->error = xerr_string(ASIGNIFY_ERROR_SIZE);
+
+		free((char *)key);
+		free(pf);
+	});
+
+	kh_destroy(asignify_sign_prev_hash, ctx->prev);
+	ctx->prev = NULL;
+
+	return (ret);
+}
+
+/* Brings digests to the output order before emitting them */
+static bool
+asignify_sign_prepare(asignify_sign_t *ctx)
+{
+	struct asignify_sign_line *sorted;
+	kvec_t(char) out;
+	size_t i, n = 0;
+
+	if (!ctx->sorted || ctx->nlines == 0) {
+		return (true);
+	}
+
+	if (kv_size(ctx->runs) > 0) {
+		/* Merge reads runs only */
+		if (!asignify_sign_spill(ctx)) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+			return (false);
+		}
+
+		return (true);
+	}
+
+	sorted = asignify_sign_sort_lines(ctx);
+	kv_init(out);
+	kv_reserve(char, out, kv_size(ctx->lines));
+
+	for (i = 0; i < ctx->nlines; i ++) {
+		if (i > 0) {
+			switch (asignify_sign_line_dup(sorted[i - 1].data,
+					sorted[i - 1].len, sorted[i].data, sorted[i].len)) {
+			case 1:
+				continue;
+			case -1:
+				free(sorted);
 				kv_destroy(out);
+				ctx->error = xerr_string(ASIGNIFY_ERROR_CONFLICT);
 				return (false);
+			default:
+				break;
 			}
 		}
-		kv_push_a(char, out, line, r);
+
+		kv_push_a(char, out, sorted[i].data, sorted[i].len);
+		n ++;
 	}
 
-	sig = asignify_private_data_sign(ctx->privk, (unsigned char *)out.a,
-		kv_size(out));
+	free(sorted);
+	kv_destroy(ctx->lines);
+	memcpy(&ctx->lines, &out, sizeof(out));
+	ctx->nlines = n;
 
-	if (sig != NULL) {
-		outf = xfopen(sigf, "w");
+	return (true);
+}
 
-		if (outf == NULL) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		}
-		else {
-			ret = asignify_signature_write(sig, out.a + sizeof(sig_pad),
-				kv_size(out) - sizeof(sig_pad), outf);
-		}
-		fclose(outf);
+static enum asignify_error
+asignify_sign_emit_error(asignify_sign_t *ctx)
+{
+	if (ctx->conflict) {
+		return (ASIGNIFY_ERROR_CONFLICT);
 	}
-	else {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_MISUSE);
+
+	return (asignify_io_error(ctx->cancel));
+}
+
+bool
+asignify_sign_set_sorted(asignify_sign_t *ctx, size_t memlimit,
+	const char *tmpdir)
+{
+	if (ctx == NULL || ctx->total > 0) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
 	}
 
-	kv_destroy(out);
+	ctx->sorted = true;
+	ctx->mem_limit = memlimit > 0 ? memlimit : ASIGNIFY_SIGN_MEM_LIMIT;
+	free(ctx->tmpdir);
+	ctx->tmpdir = tmpdir != NULL ? xstrdup(tmpdir) : NULL;
 
-	return (ret);
+	return (true);
 }
 
-const char*
-asignify_sign_get_error(asignify_sign_t *ctx)
+/*
+ * Returns line of the updated signature if the file has the same size and
+ * mtime as it had when that signature was made
+ */
+static const char *
+asignify_sign_prev_line(asignify_sign_t *ctx, const char *f,
+	const struct stat *st, enum asignify_digest_type dt)
 {
-	if (ctx == NULL) {
-		return (xerr_string(ASIGNIFY_ERROR_MISUSE));
+	struct asignify_sign_prev *pf;
+	khiter_t k;
+
+	if (ctx->prev == NULL) {
+		return (NULL);
 	}
 
-	return (ctx->error);
+	k = kh_get(asignify_sign_prev_hash, ctx->prev, f);
+
+	if (k == kh_end(ctx->prev)) {
+		return (NULL);
+	}
+
+	pf = kh_value(ctx->prev, k);
+	/* Re-added files replace their old lines */
+	pf->touched = true;
+
+	if (pf->lines[ASIGNIFY_DIGEST_SIZE] == NULL ||
+			pf->lines[ASIGNIFY_DIGEST_MTIME] == NULL ||
+			pf->size != (uintmax_t)st->st_size ||
+			pf->mtime != (uintmax_t)st->st_mtime) {
+		return (NULL);
+	}
+
+	return (pf->lines[dt]);
 }
 
-void
-asignify_sign_free(asignify_sign_t *ctx)
+bool
+asignify_sign_add_file(asignify_sign_t *ctx, const char *f,
+	enum asignify_digest_type dt)
 {
-	struct asignify_file *f;
-	int i;
+	int fd;
+	struct stat st;
+	unsigned char *calc_digest = NULL;
+	const char *prev;
+	uintmax_t num = 0;
+	bool ret;
 
-	if (ctx) {
-		asignify_private_data_free(ctx->privk);
+	if (ctx == NULL || f == NULL || dt >= ASIGNIFY_DIGEST_MAX) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
 
-		for (i = 0; i < kv_size(ctx->files); i ++) {
-			f = &kv_A(ctx->files, i);
-			if (f->digests) {
-				free(f->digests->digest);
-				free(f->digests);
-			}
-			free(f->fname);
-		}
-		kv_destroy(ctx->files);
+	fd = xopen(f, O_RDONLY, 0);
+	if (fd == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	prev = asignify_sign_prev_line(ctx, f, &st, dt);
+
+	if (dt == ASIGNIFY_DIGEST_SIZE) {
+		num = st.st_size;
+	}
+	else if (dt == ASIGNIFY_DIGEST_MTIME) {
+		if (st.st_mtime >= ctx->start) {
+			/*
+			 * File could be changed after hashing within the same second,
+			 * so its mtime cannot prove that it is unchanged
+			 */
+			close(fd);
+			return (true);
+		}
+		num = st.st_mtime;
+	}
+	else if (prev != NULL) {
+		/* Unchanged file: do not rehash it */
+		close(fd);
+		return (asignify_sign_push_line(ctx, prev, strlen(prev)));
+	}
+	else {
+		calc_digest = asignify_digest_fd_cancel(dt, fd, ctx->cancel);
+
+		if (calc_digest == NULL) {
+			close(fd);
+			ctx->error = xerr_string(asignify_cancel_check(ctx->cancel) ?
+				ASIGNIFY_ERROR_CANCELLED : ASIGNIFY_ERROR_SIZE);
+			return (false);
+		}
+	}
+
+	close(fd);
+	ret = asignify_sign_push_digest(ctx, f, strlen(f), dt, calc_digest, num);
+	free(calc_digest);
+
+	return (ret);
+}
+
+bool
+asignify_sign_add_file_digests(asignify_sign_t *ctx, const char *f,
+	unsigned int types, unsigned int extra,
+	struct asignify_file_digests *digests)
+{
+	int fd;
+	struct stat st;
+	unsigned char *calc[ASIGNIFY_DIGEST_SIZE];
+	const char *prev[ASIGNIFY_DIGEST_SIZE], *value;
+	unsigned int i, need = 0, all;
+	uintmax_t num;
+	bool ret = true;
+
+	all = types | extra;
+
+	if (digests != NULL) {
+		memset(digests, 0, sizeof(*digests));
+	}
+
+	if (ctx == NULL || f == NULL || types == 0 ||
+			(all & ~(ASIGNIFY_DIGEST_BIT(ASIGNIFY_DIGEST_SIZE) - 1))) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	fd = xopen(f, O_RDONLY, 0);
+	if (fd == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	memset(calc, 0, sizeof(calc));
+
+	/* Digests of unchanged files are taken from the updated signature */
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		prev[i] = NULL;
+
+		if (!(all & ASIGNIFY_DIGEST_BIT(i))) {
+			continue;
+		}
+
+		prev[i] = asignify_sign_prev_line(ctx, f, &st, i);
+
+		if (prev[i] != NULL && digests != NULL) {
+			value = strrchr(prev[i], '=') + 2;
+
+			if (!asignify_sign_parse_value(i, value, strcspn(value, "\n"),
+					digests->digest[i], sizeof(digests->digest[i]), &num)) {
+				prev[i] = NULL;
+			}
+		}
+
+		if (prev[i] == NULL) {
+			need |= ASIGNIFY_DIGEST_BIT(i);
+		}
+		else if (digests != NULL) {
+			digests->types |= ASIGNIFY_DIGEST_BIT(i);
+		}
+	}
+
+	/* All other digests are computed by a single read of the file */
+	if (need != 0 && !asignify_digest_fd_multi(fd, need, calc, ctx->cancel)) {
+		close(fd);
+		ctx->error = xerr_string(asignify_cancel_check(ctx->cancel) ?
+			ASIGNIFY_ERROR_CANCELLED : ASIGNIFY_ERROR_SIZE);
+		return (false);
+	}
+
+	close(fd);
+
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		if (ret && (types & ASIGNIFY_DIGEST_BIT(i))) {
+			ret = prev[i] != NULL ?
+				asignify_sign_push_line(ctx, prev[i], strlen(prev[i])) :
+				asignify_sign_push_digest(ctx, f, strlen(f), i, calc[i], 0);
+		}
+
+		if (calc[i] != NULL) {
+			if (digests != NULL) {
+				digests->types |= ASIGNIFY_DIGEST_BIT(i);
+				memcpy(digests->digest[i], calc[i], asignify_digest_len(i));
+			}
+
+			free(calc[i]);
+		}
+	}
+
+	if (!ret && digests != NULL) {
+		memset(digests, 0, sizeof(*digests));
+	}
+
+	return (ret);
+}
+
+static bool
+asignify_sign_manifest_cb(const char *fname, size_t fnlen,
+	enum asignify_digest_type type, const char *value, size_t vlen, void *ud)
+{
+	asignify_sign_t *ctx = ud;
+	unsigned char digest[BLAKE2B_OUTBYTES];
+	uintmax_t num = 0;
+
+	if (!asignify_sign_parse_value(type, value, vlen, digest, sizeof(digest),
+			&num)) {
+		return (false);
+	}
+
+	/* Lines are written in the canonical form whatever the input spacing is */
+	return (asignify_sign_push_digest(ctx, fname, fnlen, type, digest, num));
+}
+
+static bool
+asignify_sign_prev_cb(const char *fname, size_t fnlen,
+	enum asignify_digest_type type, const char *value, size_t vlen, void *ud)
+{
+	asignify_sign_t *ctx = ud;
+	struct asignify_sign_prev *pf;
+	unsigned char digest[BLAKE2B_OUTBYTES];
+	char line[PATH_MAX + 256], *key;
+	uintmax_t num = 0;
+	khiter_t k;
+	int r;
+
+	if (!asignify_sign_parse_value(type, value, vlen, digest, sizeof(digest),
+			&num)) {
+		return (false);
+	}
+
+	r = asignify_sign_format_line(line, sizeof(line), fname, fnlen, type,
+		digest, num);
+
+	if (r >= (int)sizeof(line)) {
+		return (false);
+	}
+
+	key = xmalloc(fnlen + 1);
+	memcpy(key, fname, fnlen);
+	key[fnlen] = '\0';
+	k = kh_put(asignify_sign_prev_hash, ctx->prev, key, &r);
+
+	if (r == -1) {
+		free(key);
+		return (false);
+	}
+	else if (r == 0) {
+		/* We already have the node */
+		free(key);
+		pf = kh_value(ctx->prev, k);
+	}
+	else {
+		pf = xmalloc0(sizeof(*pf));
+		kh_value(ctx->prev, k) = pf;
+	}
+
+	if (type == ASIGNIFY_DIGEST_SIZE) {
+		pf->size = num;
+	}
+	else if (type == ASIGNIFY_DIGEST_MTIME) {
+		pf->mtime = num;
+	}
+
+	free(pf->lines[type]);
+	pf->lines[type] = xstrdup(line);
+
+	return (true);
+}
+
+/*
+ * Reads a signature made by the public half of our secret key, returns
+ * the whole file and the offset of the signed data in it
+ */
+static unsigned char *
+asignify_sign_load_own(asignify_sign_t *ctx, const char *sigf, size_t *dlen,
+	size_t *off)
+{
+	struct asignify_public_data *pk, *sig;
+	unsigned char *data;
+	int fd;
+	bool ret = false;
+
+	fd = xopen(sigf, O_RDONLY, 0);
+	if (fd == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (NULL);
+	}
+
+	data = xread_fd(fd, ASIGNIFY_MAX_SIGNATURE_SIZE, dlen);
+	close(fd);
+
+	if (data == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (NULL);
+	}
+
+	pk = xmalloc0(sizeof(*pk));
+	pk->version = ctx->privk->version;
+	pk->id_len = ctx->privk->id_len;
+	pk->id = xmalloc(pk->id_len);
+	memcpy(pk->id, ctx->privk->id, pk->id_len);
+	pk->data_len = crypto_sign_PUBLICKEYBYTES;
+	pk->data = xmalloc(pk->data_len);
+	memcpy(pk->data, ctx->privk->data +
+		crypto_sign_SECRETKEYBYTES - crypto_sign_PUBLICKEYBYTES,
+		pk->data_len);
+
+	sig = asignify_signature_load_buf((const char *)data, *dlen, pk, off);
+
+	if (sig == NULL || *off == *dlen) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+	}
+	else if (!asignify_pubkey_check_signature(pk, sig, data + *off,
+			*dlen - *off)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
+	}
+	else {
+		ret = true;
+	}
+
+	asignify_public_data_free(sig);
+	asignify_public_data_free(pk);
+
+	if (!ret) {
+		free(data);
+		return (NULL);
+	}
+
+	return (data);
+}
+
+bool
+asignify_sign_load_update(asignify_sign_t *ctx, const char *sigf)
+{
+	unsigned char *data;
+	size_t dlen, off;
+	bool ret;
+
+	if (ctx == NULL || ctx->privk == NULL || sigf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	data = asignify_sign_load_own(ctx, sigf, &dlen, &off);
+
+	if (data == NULL) {
+		return (false);
+	}
+
+	if (ctx->prev == NULL) {
+		ctx->prev = kh_init(asignify_sign_prev_hash);
+	}
+
+	ret = asignify_manifest_parse((const char *)data + off, dlen - off,
+		asignify_sign_prev_cb, ctx);
+
+	if (!ret) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+	}
+
+	free(data);
+
+	return (ret);
+}
+
+bool
+asignify_sign_add_digests(asignify_sign_t *ctx, const char *digestsf)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t linelen = 0;
+	ssize_t r;
+	bool ret = true;
+
+	if (ctx == NULL || digestsf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if ((f = xfopen(digestsf, "r")) == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	ctx->error = NULL;
+
+	/* Lines are parsed one by one, so input size is not limited */
+	while (ret && (r = getline(&line, &linelen, f)) > 0) {
+		if (!asignify_manifest_parse(line, r, asignify_sign_manifest_cb, ctx)) {
+			if (ctx->error == NULL) {
+				ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+			}
+			ret = false;
+		}
+	}
+
+	if (ret && ferror(f)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		ret = false;
+	}
+
+	free(line);
+
+	if (f != stdin) {
+		fclose(f);
+	}
+
+	return (ret);
+}
+
+bool
+asignify_sign_write_digests(asignify_sign_t *ctx, const char *outf)
+{
+	FILE *f;
+	bool ret;
+
+	if (ctx == NULL) {
+		return (false);
+	}
+
+	if (!asignify_sign_merge_prev(ctx, true)) {
+		return (false);
+	}
+
+	if (ctx->total == 0) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if (!asignify_sign_prepare(ctx)) {
+		return (false);
+	}
+
+	if ((f = xfopen(outf, "w")) == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	ret = asignify_sign_emit(ctx, asignify_sign_write_cb, f);
+
+	if (f != stdout) {
+		if (fclose(f) != 0) {
+			ret = false;
+		}
+	}
+	else if (fflush(f) != 0) {
+		ret = false;
+	}
+
+	if (!ret) {
+		ctx->error = xerr_string(asignify_sign_emit_error(ctx));
+	}
+
+	return (ret);
+}
+
+bool
+asignify_sign_write_signature(asignify_sign_t *ctx, const char *sigf)
+{
+	struct asignify_public_data *sig = NULL;
+	enum asignify_error err;
+	bool ret = false;
+	FILE *outf;
+
+	if (ctx == NULL || ctx->privk == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if (!asignify_sign_merge_prev(ctx, true)) {
+		return (false);
+	}
+
+	if (ctx->total == 0) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if (!asignify_sign_prepare(ctx)) {
+		return (false);
+	}
+
+	sig = asignify_private_data_sign_stream(ctx->privk,
+		asignify_sign_reader_cb, ctx, &err);
+
+	if (sig == NULL) {
+		ctx->error = xerr_string(err == ASIGNIFY_ERROR_CHANGED ?
+			err : asignify_sign_emit_error(ctx));
+		return (false);
+	}
+
+	outf = xfopen(sigf, "w");
+
+	if (outf == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	}
+	else {
+		ret = asignify_signature_write_line(sig, outf) &&
+			asignify_sign_emit(ctx, asignify_sign_write_cb, outf);
+
+		if (fclose(outf) != 0) {
+			ret = false;
+		}
+
+		if (!ret) {
+			ctx->error = xerr_string(asignify_sign_emit_error(ctx));
+		}
+	}
+
+	asignify_public_data_free(sig);
+
+	return (ret);
+}
+
+static bool
+asignify_sign_head_reader_cb(struct asignify_digest_ctx *dig, void *ud)
+{
+	struct asignify_sign_line *head = ud;
+
+	asignify_digest_update(dig, (const unsigned char *)head->data, head->len);
+
+	return (true);
+}
+
+bool
+asignify_sign_log(asignify_sign_t *ctx, const char *logf, const char *headf,
+	const char *prevf, size_t segment, bool records)
+{
+	struct asignify_log_head *prev = NULL, *h = NULL;
+	struct asignify_public_data *sig;
+	enum asignify_error err = ASIGNIFY_ERROR_OK;
+	struct asignify_sign_line head;
+	unsigned char *data;
+	char *text;
+	size_t dlen, off, tlen;
+	struct stat st;
+	FILE *outf;
+	int fd;
+	bool ret = false;
+
+	if (ctx == NULL || ctx->privk == NULL || logf == NULL || headf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if (prevf != NULL) {
+		data = asignify_sign_load_own(ctx, prevf, &dlen, &off);
+
+		if (data == NULL) {
+			return (false);
+		}
+
+		prev = asignify_log_head_parse((const char *)data + off, dlen - off);
+		free(data);
+
+		if (prev == NULL) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+			return (false);
+		}
+
+		if (strcmp(prev->name, logf) != 0) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_NO_DIGEST);
+			asignify_log_head_free(prev);
+			return (false);
+		}
+	}
+
+	fd = xopen(logf, O_RDONLY, 0);
+
+	if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		err = ASIGNIFY_ERROR_FILE;
+	}
+	else if (prev != NULL) {
+		h = asignify_log_advance(prev, fd, st.st_size, ctx->cancel, &err);
+	}
+	else if ((h = asignify_log_head_new(logf, segment, records)) == NULL) {
+		err = ASIGNIFY_ERROR_MISUSE;
+	}
+	else {
+		err = asignify_log_hash(h, fd, st.st_size, ctx->cancel);
+	}
+
+	if (fd != -1) {
+		close(fd);
+	}
+
+	asignify_log_head_free(prev);
+
+	if (err != ASIGNIFY_ERROR_OK) {
+		ctx->error = xerr_string(err);
+		asignify_log_head_free(h);
+		return (false);
+	}
+
+	text = asignify_log_head_format(h, &tlen);
+	asignify_log_head_free(h);
+
+	head.data = text;
+	head.len = tlen;
+	sig = asignify_private_data_sign_stream(ctx->privk,
+		asignify_sign_head_reader_cb, &head, &err);
+
+	if (sig == NULL) {
+		ctx->error = xerr_string(err);
+		free(text);
+		return (false);
+	}
+
+	outf = xfopen(headf, "w");
+
+	if (outf == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	}
+	else {
+		ret = asignify_signature_write(sig, text, tlen, outf);
+
+		if (fclose(outf) != 0) {
+			ret = false;
+		}
+
+		if (!ret) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		}
+	}
+
+	asignify_public_data_free(sig);
+	free(text);
+
+	return (ret);
+}
+
+/* Returns length of a line including newline */
+static size_t
+asignify_sign_line_len(const char *p, const char *end)
+{
+	const char *nl;
+
+	nl = memchr(p, '\n', end - p);
+
+	return (nl != NULL ? nl - p + 1 : end - p);
+}
+
+static void
+asignify_sign_delta_flush(asignify_sign_text_t *out, char op, uint64_t count)
+{
+	char line[64];
+	int r;
+
+	if (count > 0) {
+		r = snprintf(line, sizeof(line), "%c %" PRIu64 "\n", op, count);
+		kv_push_a(char, *out, line, r);
+	}
+}
+
+/*
+ * Lines are merged in the order of sorted signatures, so any pair of
+ * signatures gives a correct delta, and sorted ones give the smallest
+ */
+static void
+asignify_sign_delta_ops(asignify_sign_text_t *out, const char *base,
+	size_t blen, const char *target, size_t tlen)
+{
+	const char *b = base, *bend = base + blen;
+	const char *t = target, *tend = target + tlen;
+	size_t bl = 0, tl = 0;
+	uint64_t count = 0;
+	char op = '=', next;
+
+	while (b < bend || t < tend) {
+		bl = b < bend ? asignify_sign_line_len(b, bend) : 0;
+		tl = t < tend ? asignify_sign_line_len(t, tend) : 0;
+
+		if (bl > 0 && tl > 0 && bl == tl && memcmp(b, t, bl) == 0) {
+			next = '=';
+		}
+		else if (tl == 0 || (bl > 0 &&
+				asignify_sign_line_cmp(b, bl - 1, t, tl - 1) < 0)) {
+			next = '-';
+		}
+		else {
+			next = '+';
+		}
+
+		if (next != op) {
+			asignify_sign_delta_flush(out, op, count);
+			op = next;
+			count = 0;
+		}
+
+		if (next == '+') {
+			kv_push_a(char, *out, "+ ", 2);
+			kv_push_a(char, *out, t, tl);
+		}
+		else {
+			count ++;
+		}
+
+		if (next != '+') {
+			b += bl;
+		}
+		if (next != '-') {
+			t += tl;
+		}
+	}
+
+	asignify_sign_delta_flush(out, op, count);
+}
+
+static void
+asignify_sign_delta_hash(const char *data, size_t len, char *hex,
+	size_t hexlen)
+{
+	struct asignify_digest_ctx *dig;
+	unsigned char *res;
+
+	dig = asignify_digest_init(ASIGNIFY_DIGEST_BLAKE2);
+	asignify_digest_update(dig, (const unsigned char *)data, len);
+	res = asignify_digest_final(dig);
+	bin2hex(hex, hexlen, res, ASIGNIFY_DELTA_HASHLEN);
+	free(res);
+}
+
+bool
+asignify_sign_delta(asignify_sign_t *ctx, const char *basef,
+	const char *targetf, const char *deltaf)
+{
+	struct asignify_public_data *sig;
+	enum asignify_error err;
+	struct asignify_sign_line delta;
+	unsigned char *base, *target;
+	const char *p;
+	asignify_sign_text_t text;
+	char line[ASIGNIFY_MAX_LINE];
+	char bhex[ASIGNIFY_DELTA_HASHLEN * 2 + 1];
+	char thex[ASIGNIFY_DELTA_HASHLEN * 2 + 1];
+	size_t blen, boff, tlen, toff;
+	unsigned int nsig = 0;
+	FILE *outf;
+	bool ret = false;
+	int r;
+
+	if (ctx == NULL || ctx->privk == NULL || basef == NULL ||
+			targetf == NULL || deltaf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if ((base = asignify_sign_load_own(ctx, basef, &blen, &boff)) == NULL) {
+		return (false);
+	}
+
+	if ((target = asignify_sign_load_own(ctx, targetf, &tlen, &toff)) == NULL) {
+		free(base);
+		return (false);
+	}
+
+	if (target[tlen - 1] != '\n') {
+		/* Inserted lines are always terminated */
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		free(base);
+		free(target);
+		return (false);
+	}
+
+	for (p = (const char *)target; p < (const char *)target + toff; p ++) {
+		nsig += *p == '\n';
+	}
+
+	asignify_sign_delta_hash((const char *)base + boff, blen - boff,
+		bhex, sizeof(bhex));
+	asignify_sign_delta_hash((const char *)target + toff, tlen - toff,
+		thex, sizeof(thex));
+
+	kv_init(text);
+	r = snprintf(line, sizeof(line), ASIGNIFY_DELTA_MAGIC "\n"
+		"base: %s\n"
+		"target: %s\n"
+		"signature: %u\n", bhex, thex, nsig);
+	kv_push_a(char, text, line, r);
+	/* Target signature lines make the result a complete signature */
+	kv_push_a(char, text, target, toff);
+	asignify_sign_delta_ops(&text, (const char *)base + boff,
+		blen - boff, (const char *)target + toff, tlen - toff);
+	free(base);
+	free(target);
+
+	delta.data = text.a;
+	delta.len = kv_size(text);
+	sig = asignify_private_data_sign_stream(ctx->privk,
+		asignify_sign_head_reader_cb, &delta, &err);
+
+	if (sig == NULL) {
+		ctx->error = xerr_string(err);
+		kv_destroy(text);
+		return (false);
+	}
+
+	outf = xfopen(deltaf, "w");
+
+	if (outf == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	}
+	else {
+		ret = asignify_signature_write(sig, delta.data, delta.len, outf);
+
+		if (outf != stdout) {
+			if (fclose(outf) != 0) {
+				ret = false;
+			}
+		}
+		else if (fflush(outf) != 0) {
+			ret = false;
+		}
+
+		if (!ret) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		}
+	}
+
+	asignify_public_data_free(sig);
+	kv_destroy(text);
+
+	return (ret);
+}
+
+bool
+asignify_sign_attest_file(asignify_sign_t *ctx, const char *name,
+	const struct asignify_file_id *id)
+{
+	char line[ASIGNIFY_MAX_LINE];
+	int r;
+
+	if (ctx == NULL || name == NULL || id == NULL || *name == '\0' ||
+			strchr(name, '\n') != NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	r = snprintf(line, sizeof(line), "file: %" PRIu64 " %" PRIu64 " %" PRIu64
+		" %" PRId64 " %" PRId64 " %s\n", id->dev, id->ino, id->size,
+		id->mtime, id->ctime, name);
+
+	if (r < 0 || r >= (int)sizeof(line)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_SIZE);
+		return (false);
+	}
+
+	kv_push_a(char, ctx->attest, line, r);
+
+	return (true);
+}
+
+bool
+asignify_sign_write_attestation(asignify_sign_t *ctx, const char *attf,
+	const unsigned char *sigdigest, size_t len)
+{
+	struct asignify_public_data *sig;
+	enum asignify_error err;
+	struct asignify_sign_line att;
+	kvec_t(char) text;
+	char line[ASIGNIFY_MAX_LINE], hex[ASIGNIFY_ATTEST_HASHLEN * 2 + 1];
+	FILE *outf;
+	bool ret = false;
+	int r;
+
+	if (ctx == NULL || ctx->privk == NULL || attf == NULL ||
+			sigdigest == NULL || len != ASIGNIFY_ATTEST_HASHLEN) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	kv_init(text);
+	r = snprintf(line, sizeof(line), ASIGNIFY_ATTEST_MAGIC "\n"
+		"signatures: %s\n", bin2hex(hex, sizeof(hex), sigdigest, len));
+	kv_push_a(char, text, line, r);
+
+	if (kv_size(ctx->attest) > 0) {
+		kv_push_a(char, text, ctx->attest.a, kv_size(ctx->attest));
+	}
+
+	att.data = text.a;
+	att.len = kv_size(text);
+	sig = asignify_private_data_sign_stream(ctx->privk,
+		asignify_sign_head_reader_cb, &att, &err);
+
+	if (sig == NULL) {
+		ctx->error = xerr_string(err);
+		kv_destroy(text);
+		return (false);
+	}
+
+	outf = xfopen(attf, "w");
+
+	if (outf == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	}
+	else {
+		ret = asignify_signature_write(sig, att.data, att.len, outf);
+
+		if (outf != stdout) {
+			if (fclose(outf) != 0) {
+				ret = false;
+			}
+		}
+		else if (fflush(outf) != 0) {
+			ret = false;
+		}
+
+		if (!ret) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		}
+	}
+
+	asignify_public_data_free(sig);
+	kv_destroy(text);
+
+	return (ret);
+}
+
+void
+asignify_sign_set_cancel(asignify_sign_t *ctx, const asignify_cancel_t *c)
+{
+	if (ctx != NULL) {
+		ctx->cancel = c;
+	}
+}
+
+const char*
+asignify_sign_get_error(asignify_sign_t *ctx)
+{
+	if (ctx == NULL) {
+		return (xerr_string(ASIGNIFY_ERROR_MISUSE));
+	}
+
+	return (ctx->error);
+}
+
+void
+asignify_sign_free(asignify_sign_t *ctx)
+{
+	struct asignify_sign_run *run;
+	size_t i;
+
+	if (ctx) {
+		asignify_private_data_free(ctx->privk);
+		(void)asignify_sign_merge_prev(ctx, false);
+
+		for (i = 0; i < kv_size(ctx->runs); i ++) {
+			run = &kv_A(ctx->runs, i);
+			fclose(run->f);
+			free(run->line);
+		}
+
+		kv_destroy(ctx->runs);
+		kv_destroy(ctx->lines);
+		kv_destroy(ctx->attest);
+		free(ctx->tmpdir);
 		free(ctx);
 	}
 }
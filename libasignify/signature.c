@@ -83,43 +83,50 @@ asignify_sig_try_obsd(const char *buf, size_t buflen,
 }
 
 struct asignify_public_data*
-asignify_signature_load(FILE *f, struct asignify_public_data *pk)
+asignify_signature_load_buf(const char *buf, size_t len,
+	struct asignify_public_data *pk, size_t *consumed)
 {
 	struct asignify_public_data *res = NULL;
-	char *buf = NULL;
-	size_t buflen = 0;
+	char line[ASIGNIFY_MAX_LINE];
+	const char *p = buf, *end = buf + len;
 	ssize_t r;
 	bool first = true;
 
-	if (f == NULL) {
+	if (buf == NULL || pk == NULL) {
 		abort();
 	}
 
-	while ((r = getline(&buf, &buflen, f)) != -1) {
+	while ((r = asignify_buf_getline(&p, end, line, sizeof(line))) > 0) {
 		if (first && r > sizeof(SIG_MAGIC)) {
 			first = false;
 
-			if (memcmp(buf, SIG_MAGIC, sizeof(SIG_MAGIC) - 1) == 0) {
-				res = asignify_public_data_load(buf, r,
+			if (memcmp(line, SIG_MAGIC, sizeof(SIG_MAGIC) - 1) == 0) {
+				res = asignify_public_data_load(line, r,
 					SIG_MAGIC, sizeof(SIG_MAGIC) - 1,
 					SIG_VER_MAX, SIG_VER_MAX,
 					pk->id_len, SIG_LEN);
 				break;
 			}
 			else {
-				if (!asignify_sig_try_obsd(buf, r, &res)) {
+				if (!asignify_sig_try_obsd(line, r, &res)) {
 					break;
 				}
 			}
 		}
-		if (!asignify_sig_try_obsd(buf, r, &res)) {
+		if (!asignify_sig_try_obsd(line, r, &res)) {
 			break;
 		}
 	}
 
+	if (consumed != NULL) {
+		/* Signed data starts after the signature line */
+		*consumed = p - buf;
+	}
+
 	return (res);
 }
 
+#ifndef ASIGNIFY_VERIFY_ONLY
 struct asignify_public_data*
 asignify_private_data_sign(struct asignify_private_data *privk,
 	unsigned char *buf, size_t len)
@@ -147,14 +154,132 @@ asignify_private_data_sign(struct asignify_private_data *privk,
 	return (res);
 }
 
+/*
+ * Runs reader once, and returns BLAKE2b digest of the data it has fed to dig,
+ * so that both passes of the signer can be compared
+ */
+static unsigned char *
+asignify_sign_stream_pass(struct asignify_digest_ctx *dig,
+	asignify_sign_reader reader, void *ud)
+{
+	struct asignify_digest_ctx *tee;
+	unsigned char *res;
+
+	tee = asignify_digest_init(ASIGNIFY_DIGEST_BLAKE2);
+	asignify_digest_tee(dig, tee);
+
+	if (!reader(dig, ud)) {
+		asignify_digest_tee(dig, NULL);
+		asignify_digest_free(tee);
+		return (NULL);
+	}
+
+	asignify_digest_tee(dig, NULL);
+	res = asignify_digest_final(tee);
+
+	return (res);
+}
+
+struct asignify_public_data*
+asignify_private_data_sign_stream(struct asignify_private_data *privk,
+	asignify_sign_reader reader, void *ud, enum asignify_error *err)
+{
+	struct asignify_public_data *res = NULL;
+	struct asignify_digest_ctx *dig;
+	unsigned char d[crypto_hash_BYTES], r[crypto_hash_BYTES],
+		sig[crypto_sign_BYTES], *h, *m1, *m2;
+	bool same;
+
+	if (privk == NULL || reader == NULL) {
+		*err = ASIGNIFY_ERROR_MISUSE;
+		return (NULL);
+	}
+
+	/*
+	 * Ed25519 hashes the message twice: first to derive the nonce and then
+	 * to bind the nonce commitment and the public key to the message
+	 */
+	crypto_hash(d, privk->data, 32);
+	dig = asignify_digest_init(ASIGNIFY_DIGEST_SHA512);
+	asignify_digest_update(dig, d + 32, 32);
+	asignify_digest_update(dig, (const unsigned char *)&privk->version,
+		sizeof(unsigned int));
+	explicit_memzero(d, sizeof(d));
+
+	m1 = asignify_sign_stream_pass(dig, reader, ud);
+
+	if (m1 == NULL) {
+		asignify_digest_free(dig);
+		*err = ASIGNIFY_ERROR_FILE;
+		return (NULL);
+	}
+
+	h = asignify_digest_final(dig);
+	crypto_sign_ed25519_detached_r(sig, r, h);
+	explicit_memzero(h, crypto_hash_BYTES);
+	free(h);
+
+	dig = asignify_digest_init(ASIGNIFY_DIGEST_SHA512);
+	asignify_digest_update(dig, sig, 32);
+	asignify_digest_update(dig, privk->data + 32, 32);
+	asignify_digest_update(dig, (const unsigned char *)&privk->version,
+		sizeof(unsigned int));
+
+	m2 = asignify_sign_stream_pass(dig, reader, ud);
+
+	if (m2 == NULL) {
+		asignify_digest_free(dig);
+		explicit_memzero(r, sizeof(r));
+		free(m1);
+		*err = ASIGNIFY_ERROR_FILE;
+		return (NULL);
+	}
+
+	h = asignify_digest_final(dig);
+	same = memcmp(m1, m2, asignify_digest_len(ASIGNIFY_DIGEST_BLAKE2)) == 0;
+	free(m1);
+	free(m2);
+
+	/*
+	 * The nonce is derived from the first pass, so signing different data in
+	 * the second one would reuse it and reveal the secret key
+	 */
+	if (!same) {
+		explicit_memzero(r, sizeof(r));
+		explicit_memzero(sig, sizeof(sig));
+		free(h);
+		*err = ASIGNIFY_ERROR_CHANGED;
+		return (NULL);
+	}
+
+	crypto_sign_ed25519_detached_s(sig, r, h, privk->data);
+	explicit_memzero(r, sizeof(r));
+	free(h);
+
+	res = xmalloc0(sizeof(*res));
+	res->version = privk->version;
+	res->id_len = privk->id_len;
+	res->data_len = crypto_sign_BYTES;
+
+	asignify_alloc_public_data_fields(res);
+
+	if (privk->id_len > 0) {
+		memcpy(res->id, privk->id, res->id_len);
+	}
+
+	memcpy(res->data, sig, res->data_len);
+	*err = ASIGNIFY_ERROR_OK;
+
+	return (res);
+}
+
 bool
-asignify_signature_write(struct asignify_public_data *sig, const void *buf,
-	size_t len, FILE *f)
+asignify_signature_write_line(struct asignify_public_data *sig, FILE *f)
 {
 	char *b64data, *b64id = NULL;
 	bool ret = false;
 
-	if (sig == NULL || f == NULL || buf == NULL) {
+	if (sig == NULL || f == NULL) {
 		return (false);
 	}
 
@@ -179,9 +304,25 @@ asignify_signature_write(struct asignify_public_data *sig, const void *buf,
 		/* XXX: support openbsd signatures format */
 	}
 
+	return (ret);
+}
+
+bool
+asignify_signature_write(struct asignify_public_data *sig, const void *buf,
+	size_t len, FILE *f)
+{
+	bool ret;
+
+	if (buf == NULL) {
+		return (false);
+	}
+
+	ret = asignify_signature_write_line(sig, f);
+
 	if (ret) {
 		ret = (fwrite(buf, len, 1, f) > 0);
 	}
 
 	return (ret);
 }
+#endif
@@ -816,6 +816,37 @@ int crypto_sign_open(u8 *m,u64 *mlen,const u8 *sm,u64 n,const u8 *pk)
   return 0;
 }
 
+/*
+ * p = [s1]q + [s2]B by a single double-and-add chain (Straus-Shamir trick):
+ * it is not constant time, so it is used for public data only
+ */
+sv scalarmult_vartime2(gf p[4],gf q[4],const u8 *s1,const u8 *s2)
+{
+  gf b[4],qb[4];
+  int i,b1,b2;
+
+  set25519(b[0],X);
+  set25519(b[1],Y);
+  set25519(b[2],gf1);
+  M(b[3],X,Y);
+  FOR(i,4) set25519(qb[i],q[i]);
+  add(qb,b);
+
+  set25519(p[0],gf0);
+  set25519(p[1],gf1);
+  set25519(p[2],gf1);
+  set25519(p[3],gf0);
+
+  for (i = 255;i >= 0;--i) {
+    add(p,p);
+    b1 = (s1[i/8]>>(i&7))&1;
+    b2 = (s2[i/8]>>(i&7))&1;
+    if (b1 && b2) add(p,qb);
+    else if (b1) add(p,q);
+    else if (b2) add(p,b);
+  }
+}
+
 int
 crypto_sign_verify_detached(const u8 *sig, const u8 *h, const u8 *pk)
 {
@@ -831,10 +862,7 @@ crypto_sign_verify_detached(const u8 *sig, const u8 *h, const u8 *pk)
 
     FOR(i, 64) hh[i] = h[i];
     reduce(hh);
-    scalarmult(p,q,hh);
-
-    scalarbase(q,sig + 32);
-    add(p,q);
+    scalarmult_vartime2(p,q,hh,sig + 32);
     pack(t,p);
 
     if (crypto_verify_32(sig, t)) {
@@ -844,6 +872,49 @@ crypto_sign_verify_detached(const u8 *sig, const u8 *h, const u8 *pk)
     return 0;
 }
 
+/*
+ * Two halves of crypto_sign for messages that are hashed incrementally:
+ * rh = H(sk_hash[32..63] || M) gives the nonce and R (first half of sig),
+ * h = H(R || A || M) gives S (second half of sig)
+ */
+int
+crypto_sign_ed25519_detached_r(u8 *sig, u8 *r, const u8 *rh)
+{
+  gf p[4];
+  int i;
+
+  FOR(i,64) r[i] = rh[i];
+  reduce(r);
+  scalarbase(p,r);
+  pack(sig,p);
+
+  return 0;
+}
+
+int
+crypto_sign_ed25519_detached_s(u8 *sig, const u8 *r, const u8 *h,
+	const u8 *sk)
+{
+  u8 d[64], hh[64];
+  i64 i,j,x[64];
+
+  crypto_hash(d, sk, 32);
+  d[0] &= 248;
+  d[31] &= 127;
+  d[31] |= 64;
+
+  FOR(i,64) hh[i] = h[i];
+  reduce(hh);
+
+  FOR(i,64) x[i] = 0;
+  FOR(i,32) x[i] = (u64) r[i];
+  FOR(i,32) FOR(j,32) x[i+j] += hh[i] * (u64) d[j];
+  modL(sig + 32,x);
+  explicit_memzero(d, sizeof d);
+
+  return 0;
+}
+
 int
 crypto_sign_ed25519_sk_to_curve25519(unsigned char *curve25519_sk,
 	const unsigned char *ed25519_sk)
@@ -37,7 +37,6 @@
 
 #ifdef HAVE_OPENSSL
 #include <openssl/rand.h>
-#include <openssl/evp.h>
 #endif
 #ifdef HAVE_BSD_STDLIB_H
 #include <bsd/stdlib.h>
@@ -46,9 +45,6 @@
 #include <linux/random.h>
 #endif
 
-#include "sha2.h"
-#include "blake2.h"
-
 #include "asignify_internal.h"
 
 const char* err_str[ASIGNIFY_ERROR_MAX] = {
@@ -63,6 +59,11 @@ const char* err_str[ASIGNIFY_ERROR_MAX] = {
 	[ASIGNIFY_ERROR_NO_DIGEST] = "digest is missing for the file specified",
 	[ASIGNIFY_ERROR_WRONG_KEYPAIR] = "cannot encrypt using related keypair",
 	[ASIGNIFY_ERROR_WRONG_KEY] = "wrong key specified",
+	[ASIGNIFY_ERROR_CANCELLED] = "operation cancelled",
+	[ASIGNIFY_ERROR_CONFLICT] = "conflicting digests for a file",
+	[ASIGNIFY_ERROR_COMPRESSION] = "unsupported compression format",
+	[ASIGNIFY_ERROR_CIPHER] = "unsupported cipher",
+	[ASIGNIFY_ERROR_CHANGED] = "data changed while signing",
 	[ASIGNIFY_ERROR_SIZE] = "size mismatch"
 };
 
@@ -127,7 +128,7 @@ randombytes(unsigned char *buf, uint64_t len)
 #endif
 }
 
-
+#ifndef ASIGNIFY_VERIFY_ONLY
 FILE *
 xfopen(const char *fname, const char *mode)
 {
@@ -165,6 +166,7 @@ xfopen(const char *fname, const char *mode)
 
 	return (res);
 }
+#endif
 
 int
 xopen(const char *fname, int oflags, mode_t mode)
@@ -203,6 +205,100 @@ xopen(const char *fname, int oflags, mode_t mode)
 	return (fd);
 }
 
+unsigned char *
+xread_fd(int fd, size_t maxlen, size_t *len)
+{
+	struct stat st;
+	ssize_t r;
+	size_t total = 0, alloced;
+	unsigned char *res, *tmp;
+
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		return (NULL);
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		if (st.st_size > maxlen) {
+			return (NULL);
+		}
+		alloced = st.st_size + 1;
+	}
+	else {
+		alloced = 4096;
+	}
+
+	res = xmalloc(alloced);
+
+	for (;;) {
+		if (total + 1 == alloced) {
+			if (alloced > maxlen) {
+				free(res);
+				return (NULL);
+			}
+
+			alloced *= 2;
+			if ((tmp = realloc(res, alloced)) == NULL) {
+				abort();
+			}
+			res = tmp;
+		}
+
+		r = read(fd, res + total, alloced - total - 1);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			free(res);
+			return (NULL);
+		}
+		else if (r == 0) {
+			break;
+		}
+
+		total += r;
+	}
+
+	if (total > maxlen) {
+		free(res);
+		return (NULL);
+	}
+
+	res[total] = '\0';
+	*len = total;
+
+	return (res);
+}
+
+ssize_t
+asignify_buf_getline(const char **pos, const char *end, char *line,
+	size_t linelen)
+{
+	const char *p = *pos, *nl;
+	size_t len;
+
+	if (p >= end) {
+		return (0);
+	}
+
+	if ((nl = memchr(p, '\n', end - p)) != NULL) {
+		len = nl - p + 1;
+	}
+	else {
+		len = end - p;
+	}
+
+	if (len >= linelen) {
+		return (-1);
+	}
+
+	memcpy(line, p, len);
+	line[len] = '\0';
+	*pos = p + len;
+
+	return (len);
+}
+
 void *
 xmalloc(size_t len)
 {
@@ -369,220 +465,3 @@ bin2hex(char * const hex, const size_t hex_maxlen,
     return hex;
 }
 
-
-unsigned int
-asignify_digest_len(enum asignify_digest_type type)
-{
-	unsigned int ret;
-
-	switch(type) {
-	case ASIGNIFY_DIGEST_SHA512:
-		ret = SHA512_DIGEST_LENGTH;
-		break;
-	case ASIGNIFY_DIGEST_SHA256:
-		ret = SHA256_DIGEST_LENGTH;
-		break;
-	case ASIGNIFY_DIGEST_BLAKE2:
-		ret = BLAKE2B_OUTBYTES;
-		break;
-	default:
-		ret = 0;
-		break;
-	}
-
-	return (ret);
-}
-
-const char *
-asignify_digest_name(enum asignify_digest_type type)
-{
-	const char *ret;
-
-	switch(type) {
-	case ASIGNIFY_DIGEST_SHA512:
-		ret = "SHA512";
-		break;
-	case ASIGNIFY_DIGEST_SHA256:
-		ret = "SHA256";
-		break;
-	case ASIGNIFY_DIGEST_BLAKE2:
-		ret = "BLAKE2";
-		break;
-	case ASIGNIFY_DIGEST_SIZE:
-		ret = "SIZE";
-		break;
-	default:
-		ret = "";
-		break;
-	}
-
-	return (ret);
-}
-
-static void *
-asignify_digest_init(enum asignify_digest_type type)
-{
-#ifdef HAVE_OPENSSL
-	EVP_MD_CTX *mdctx;
-#else
-	SHA2_CTX *st;
-#endif
-	blake2b_state *bst;
-
-	void *res = NULL;
-
-	switch(type) {
-	case ASIGNIFY_DIGEST_SHA512:
-#ifdef HAVE_OPENSSL
-		mdctx = EVP_MD_CTX_create();
-		EVP_DigestInit_ex(mdctx, EVP_sha512(), NULL);
-		res = mdctx;
-#else
-		st = xmalloc(sizeof(*st));
-		SHA512Init(st);
-		res = st;
-#endif
-		break;
-	case ASIGNIFY_DIGEST_SHA256:
-#ifdef HAVE_OPENSSL
-		mdctx = EVP_MD_CTX_create();
-		EVP_DigestInit(mdctx, EVP_sha256());
-		res = mdctx;
-#else
-		st = xmalloc(sizeof(*st));
-		SHA256Init(st);
-		res = st;
-#endif
-		break;
-	case ASIGNIFY_DIGEST_BLAKE2:
-		bst = xmalloc_aligned(64, sizeof(*bst));
-		blake2b_init(bst, BLAKE2B_OUTBYTES);
-		res = bst;
-		break;
-	default:
-		abort();
-		break;
-	}
-
-	return (res);
-}
-
-static void
-asignify_digest_update(enum asignify_digest_type type, void *ctx,
-	const unsigned char *buf, size_t len)
-{
-#ifdef HAVE_OPENSSL
-	EVP_MD_CTX *mdctx;
-#else
-	SHA2_CTX *st;
-#endif
-	blake2b_state *bst;
-
-	switch(type) {
-		case ASIGNIFY_DIGEST_SHA512:
-#ifdef HAVE_OPENSSL
-			mdctx = (EVP_MD_CTX *)ctx;
-			EVP_DigestUpdate(mdctx, buf, len);
-#else
-			st = (SHA2_CTX *)ctx;
-			SHA512Update(st, buf, len);
-#endif
-			break;
-		case ASIGNIFY_DIGEST_SHA256:
-#ifdef HAVE_OPENSSL
-			mdctx = (EVP_MD_CTX *)ctx;
-			EVP_DigestUpdate(mdctx, buf, len);
-#else
-			st = (SHA2_CTX *)ctx;
-			SHA256Update(st, buf, len);
-#endif
-			break;
-		case ASIGNIFY_DIGEST_BLAKE2:
-			bst = (blake2b_state *)ctx;
-			blake2b_update(bst, buf, len);
-			break;
-		default:
-			abort();
-			break;
-	}
-
-}
-
-static unsigned char*
-asignify_digest_final(enum asignify_digest_type type, void *ctx)
-{
-	unsigned int len = asignify_digest_len(type);
-	unsigned char *res;
-#ifdef HAVE_OPENSSL
-	EVP_MD_CTX *mdctx;
-#else
-	SHA2_CTX *st;
-#endif
-	blake2b_state *bst;
-
-	res = xmalloc(len);
-	switch(type) {
-		case ASIGNIFY_DIGEST_SHA512:
-#ifdef HAVE_OPENSSL
-			mdctx = (EVP_MD_CTX *)ctx;
-			EVP_DigestFinal(mdctx, res, &len);
-			EVP_MD_CTX_destroy(mdctx);
-#else
-			st = (SHA2_CTX *)ctx;
-			SHA512Final(res, st);
-			free(st);
-#endif
-			break;
-		case ASIGNIFY_DIGEST_SHA256:
-#ifdef HAVE_OPENSSL
-			mdctx = (EVP_MD_CTX *)ctx;
-			EVP_DigestFinal(mdctx, res, &len);
-			EVP_MD_CTX_destroy(mdctx);
-#else
-			st = (SHA2_CTX *)ctx;
-			SHA256Final(res, st);
-			free(st);
-#endif
-			break;
-		case ASIGNIFY_DIGEST_BLAKE2:
-			bst = (blake2b_state *)ctx;
-			blake2b_final(bst, res, len);
-			free(bst);
-			break;
-		default:
-			abort();
-			break;
-	}
-
-	return (res);
-}
-
-unsigned char*
-asignify_digest_fd(enum asignify_digest_type type, int fd)
-{
-	int r;
-#if BUFSIZ >= 2048
-	unsigned char buf[BUFSIZ];
-#else
-	/* BUFSIZ is insanely small */
-	unsigned char buf[4096];
-#endif
-	void *dgst;
-
-	if (fd == -1 || type >= ASIGNIFY_DIGEST_SIZE ||
-			(dgst = asignify_digest_init(type)) == NULL) {
-		return (NULL);
-	}
-
-	if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
-		/* XXX: not correct if openssl is used */
-		free(dgst);
-		return (NULL);
-	}
-
-	while ((r = read(fd, buf, sizeof(buf))) > 0) {
-		asignify_digest_update(type, dgst, buf, r);
-	}
-
-	return (asignify_digest_final(type, dgst));
-}
@@ -35,9 +35,11 @@
 #include <inttypes.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
-#include "blake2.h"
-#include "sha2.h"
 #include "asignify.h"
 #include "asignify_internal.h"
 #include "khash.h"
@@ -46,6 +48,8 @@
 KHASH_INIT(asignify_verify_hnode, const char *, struct asignify_file *, 1,
 	kh_str_hash_func, kh_str_hash_equal);
 
+typedef kvec_t(char) asignify_verify_text_t;
+
 struct asignify_pubkey_chain {
 	struct asignify_public_data *pk;
 	struct asignify_pubkey_chain *next;
@@ -54,103 +58,68 @@ struct asignify_pubkey_chain {
 struct asignify_verify_ctx {
 	struct asignify_pubkey_chain *pk_chain;
 	khash_t(asignify_verify_hnode) *files;
+	const asignify_cancel_t *cancel;
+	bool decompress;
+	enum asignify_digest_policy digest_policy;
+	enum asignify_digest_type digest_prefer;
+	/* Limits for untrusted signatures, zero means no limit */
+	size_t max_memory;
+	unsigned int max_entries;
+	unsigned int max_path;
+	size_t mem_used;
+	unsigned int nentries;
+	/* Chained digest of all signatures loaded */
+	unsigned char sig_digest[ASIGNIFY_ATTEST_HASHLEN];
 	const char *error;
 };
 
-static unsigned char *
-asignify_verify_load_sig(struct asignify_verify_ctx *ctx, FILE *f, size_t *len)
-{
-	const size_t maxlen = 1 << 30;
-	struct stat st;
-	int r;
-#if BUFSIZ >= 2048
-	unsigned char buf[BUFSIZ];
-#else
-	/* BUFSIZ is insanely small */
-	unsigned char buf[4096];
-#endif
-	kvec_t(unsigned char) res;
-
-	if (ctx == NULL || f == NULL || fstat(fileno(f), &st) == -1) {
-		return (NULL);
-	}
-
-	if (S_ISREG(st.st_mode) && st.st_size > maxlen) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-		return (NULL);
-	}
-
-	kv_init(res);
-
-	while ((r = fread(buf, 1, sizeof(buf), f)) > 0) {
-		kv_push_a(unsigned char, res, buf, r);
-	}
-
-	*len = kv_size(res);
-	kv_push(unsigned char, res, '\0');
-
-	return (res.a);
-}
-
-enum asignify_digest_type
-asignify_digest_from_str(const char *data, ssize_t dlen)
-{
-	if (dlen == sizeof("SHA512") - 1) {
-		if (strncasecmp(data, "sha512", dlen) == 0) {
-			return (ASIGNIFY_DIGEST_SHA512);
-		}
-		else if (strncasecmp(data, "sha256", dlen) == 0) {
-			return (ASIGNIFY_DIGEST_SHA256);
-		}
-		else if (strncasecmp(data, "blake2", dlen) == 0) {
-			return (ASIGNIFY_DIGEST_BLAKE2);
-		}
-	}
-	else if (dlen == sizeof("SIZE") - 1) {
-		if (strncasecmp(data, "size", dlen) == 0) {
-			return (ASIGNIFY_DIGEST_SIZE);
-		}
-	}
-
-	return (ASIGNIFY_DIGEST_MAX);
-}
+/* Digests of a decompressed stream are calculated in a single pass */
+struct asignify_verify_stream {
+	struct asignify_digest_ctx **dig;
+	unsigned int ndig;
+	uint64_t size;
+	uint64_t limit;
+	bool oversized;
+};
 
 static bool
 asignify_verify_parse_digest(const char *data, ssize_t dlen,
 	enum asignify_digest_type type, struct asignify_file *f)
 {
-	const unsigned int digests_sizes[ASIGNIFY_DIGEST_MAX] = {
-		[ASIGNIFY_DIGEST_SHA512] = SHA512_DIGEST_STRING_LENGTH - 1,
-		[ASIGNIFY_DIGEST_SHA256] = SHA256_DIGEST_STRING_LENGTH - 1,
-		[ASIGNIFY_DIGEST_BLAKE2] = BLAKE2B_OUTBYTES * 2,
-		[ASIGNIFY_DIGEST_SIZE] = 0
-	};
 	char *errstr;
 	uint64_t flen;
-	struct asignify_file_digest *dig;
+	struct asignify_file_digest *dig, *cur;
 	unsigned int dig_len;
+	int check;
 
 	if (dlen <= 0 || type >= ASIGNIFY_DIGEST_MAX || f == NULL) {
 		return (false);
 	}
 
-	if (digests_sizes[type] > 0 && digests_sizes[type] != dlen) {
+	dig_len = asignify_digest_len(type);
+
+	if (dig_len > 0 && dig_len * 2 != dlen) {
 		return (false);
 	}
 
-	if (type == ASIGNIFY_DIGEST_SIZE) {
+	if (type == ASIGNIFY_DIGEST_SIZE || type == ASIGNIFY_DIGEST_MTIME) {
 		/* Special case for size */
 		errno = 0;
 		flen = strtoumax (data, &errstr, 10);
 		if (errstr != data + dlen || errno != 0) {
 			return (false);
 		}
-		f->size = flen;
+		/* Mtime is just a hint for signing and it is not verified */
+		if (type == ASIGNIFY_DIGEST_SIZE) {
+			if (f->size != 0 && f->size != flen) {
+				return (false);
+			}
+			f->size = flen;
+		}
 	}
 	else {
 		dig = xmalloc(sizeof(*dig));
 		dig->digest_type = type;
-		dig_len = asignify_digest_len(type);
 
 		if (dig_len == 0) {
 			free(dig);
@@ -165,6 +134,20 @@ asignify_verify_parse_digest(const char *data, ssize_t dlen,
 			return (false);
 		}
 
+		/*
+		 * Repeated lines are dropped, so a file is hashed at most once per
+		 * algorithm however many times it is listed
+		 */
+		for (cur = f->digests; cur != NULL; cur = cur->next) {
+			if (cur->digest_type == type) {
+				check = memcmp(cur->digest, dig->digest, dig_len);
+				free(dig->digest);
+				free(dig);
+
+				return (check == 0);
+			}
+		}
+
 		dig->next = f->digests;
 		f->digests = dig;
 	}
@@ -173,175 +156,84 @@ asignify_verify_parse_digest(const char *data, ssize_t dlen,
 }
 
 static bool
-asignify_verify_parse_files(struct asignify_verify_ctx *ctx, const char *data,
-	size_t dlen)
+asignify_verify_manifest_cb(const char *fname, size_t fnlen,
+	enum asignify_digest_type type, const char *value, size_t vlen, void *ud)
 {
-	enum stm_st {
-		PARSE_START = 0,
-		PARSE_ALG,
-		PARSE_OBRACE,
-		PARSE_FILE,
-		PARSE_EQSIGN,
-		PARSE_HASH,
-		PARSE_SPACES,
-		PARSE_ERROR,
-		PARSE_FINISH
-	} state = PARSE_START, next_state = PARSE_START;
-	const unsigned char *p, *end, *c;
+	struct asignify_verify_ctx *ctx = ud;
+	struct asignify_file *cur_file;
 	char *fbuf;
 	khiter_t k;
 	int r;
-	struct asignify_file *cur_file = NULL;
-	enum asignify_digest_type dig_type = ASIGNIFY_DIGEST_MAX;
-
-	p = (unsigned char *)data;
-	end = p + dlen;
-	c = p;
-
-	while (p <= end) {
-		switch (state) {
-		case PARSE_START:
-			cur_file = NULL;
-			if (*p == '\0') {
-				state = PARSE_FINISH;
-			}
-			else if (isspace(*p)) {
-				next_state = PARSE_START;
-				state = PARSE_SPACES;
-			}
-			else {
-				/* We have algorithm definition */
-				c = p;
-				state = PARSE_ALG;
-			}
-			break;
-		case PARSE_ALG:
-			if (isgraph(*p)) {
-				p ++;
-			}
-			else {
-				if (*p == ' ') {
-					/* Check algorithm */
-					dig_type = asignify_digest_from_str((const char *)c, p - c);
-					if (dig_type == ASIGNIFY_DIGEST_MAX) {
-						state = PARSE_ERROR;
-					}
-					else {
-						state = PARSE_SPACES;
-						next_state = PARSE_OBRACE;
-					}
-				}
-				else {
-					state = PARSE_ERROR;
-				}
-			}
-			break;
-		case PARSE_OBRACE:
-			if (*p == '(') {
-				p++;
-				c = p;
-				state = PARSE_FILE;
-			}
-			else {
-				state = PARSE_ERROR;
-			}
-			break;
-		case PARSE_FILE:
-			if (isgraph(*p) && *p != ')') {
-				p ++;
-			}
-			else {
-				if (*p == ')') {
-					/* Check file */
-					if (p - c > 0) {
-
-						fbuf = xmalloc(p - c + 1);
-						memcpy(fbuf, c, p - c);
-						fbuf[p - c] = '\0';
-						k = kh_get(asignify_verify_hnode, ctx->files, fbuf);
-
-						if (k != kh_end(ctx->files)) {
-							/* We already have the node */
-							free(fbuf);
-							fbuf = NULL;
-							cur_file = kh_value(ctx->files, k);
-						}
-						else {
-							cur_file = xmalloc0(sizeof(*cur_file));
-							cur_file->fname = fbuf;
-							k = kh_put(asignify_verify_hnode, ctx->files,
-								cur_file->fname, &r);
-							fbuf = NULL;
-
-							if (r == -1) {
-								state = PARSE_ERROR;
-							}
-							else {
-								kh_value(ctx->files, k) = cur_file;
-							}
-						}
-						if (state != PARSE_ERROR) {
-							p ++;
-							c = p;
-							next_state = PARSE_EQSIGN;
-							state = PARSE_SPACES;
-						}
-					}
-					else {
-						state = PARSE_ERROR;
-					}
-				}
-			}
-			break;
-		case PARSE_EQSIGN:
-			if (*p == '=') {
-				p++;
-				c = p;
-				state = PARSE_SPACES;
-				next_state = PARSE_HASH;
-			}
-			else {
-				state = PARSE_ERROR;
-			}
-			break;
-		case PARSE_HASH:
-			if (isxdigit(*p)) {
-				p ++;
-			}
-			else if (*p == '\n' || *p == '\0') {
-				if (!asignify_verify_parse_digest((const char *)c, p - c,
-						dig_type, cur_file)) {
-					state = PARSE_ERROR;
-				}
-				else {
-					state = PARSE_START;
-				}
-			}
-			break;
-		case PARSE_SPACES:
-			if (*p != '\0' && isspace(*p)) {
-				p ++;
-			}
-			else {
-				c = p;
-				state = next_state;
-			}
-			break;
 
-		case PARSE_FINISH:
-			/* All done */
-			return (true);
-			break;
+	if ((ctx->max_entries > 0 && ++ctx->nentries > ctx->max_entries) ||
+			(ctx->max_path > 0 && fnlen > ctx->max_path)) {
+		return (false);
+	}
 
-		case PARSE_ERROR:
-		default:
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+	ctx->mem_used += sizeof(struct asignify_file_digest) +
+		asignify_digest_len(type);
+
+	fbuf = xmalloc(fnlen + 1);
+	memcpy(fbuf, fname, fnlen);
+	fbuf[fnlen] = '\0';
+	k = kh_get(asignify_verify_hnode, ctx->files, fbuf);
+
+	if (k != kh_end(ctx->files)) {
+		/* We already have the node */
+		free(fbuf);
+		cur_file = kh_value(ctx->files, k);
+	}
+	else {
+		ctx->mem_used += sizeof(*cur_file) + fnlen + 1 +
+			sizeof(const char *) + sizeof(cur_file);
+		cur_file = xmalloc0(sizeof(*cur_file));
+		cur_file->fname = fbuf;
+		k = kh_put(asignify_verify_hnode, ctx->files, cur_file->fname, &r);
+
+		if (r == -1) {
+			free(fbuf);
+			free(cur_file);
 			return (false);
-			break;
 		}
+
+		kh_value(ctx->files, k) = cur_file;
 	}
 
-	return (false);
+	if (ctx->max_memory > 0 && ctx->mem_used > ctx->max_memory) {
+		return (false);
+	}
+
+	return (asignify_verify_parse_digest(value, vlen, type, cur_file));
+}
+
+static bool
+asignify_verify_parse_files(struct asignify_verify_ctx *ctx, const char *data,
+	size_t dlen)
+{
+	if (!asignify_manifest_parse(data, dlen, asignify_verify_manifest_cb,
+			ctx)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		return (false);
+	}
+
+	return (true);
+}
+
+/* Signature body and digests parsed from it share the memory limit */
+static size_t
+asignify_verify_max_size(const struct asignify_verify_ctx *ctx)
+{
+	size_t left;
+
+	if (ctx->max_memory == 0) {
+		return (ASIGNIFY_MAX_SIGNATURE_SIZE);
+	}
+
+	left = ctx->max_memory > ctx->mem_used ?
+		ctx->max_memory - ctx->mem_used : 0;
+
+	return (left < ASIGNIFY_MAX_SIGNATURE_SIZE ?
+		left : ASIGNIFY_MAX_SIGNATURE_SIZE);
 }
 
 asignify_verify_t*
@@ -355,168 +247,1382 @@ asignify_verify_init(void)
 }
 
 
+static void
+asignify_verify_add_pubkey(struct asignify_verify_ctx *ctx,
+	struct asignify_public_data *pk)
+{
+	struct asignify_pubkey_chain *chain;
+
+	chain = xmalloc(sizeof(*chain));
+	chain->pk = pk;
+	chain->next = ctx->pk_chain;
+	ctx->pk_chain = chain;
+}
+
 bool
-asignify_verify_load_pubkey(asignify_verify_t *ctx, const char *pubf)
+asignify_verify_load_pubkey_buf(asignify_verify_t *ctx, const char *buf,
+	size_t len)
 {
-	FILE *f;
-	bool ret = true;
 	struct asignify_public_data *pk;
-	struct asignify_pubkey_chain *chain;
 
-	if (ctx == NULL) {
+	if (ctx == NULL || buf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	pk = asignify_pubkey_load_buf(buf, len);
+	if (pk == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
 		return (false);
 	}
 
-	f = xfopen(pubf, "r");
-	if (f == NULL) {
+	asignify_verify_add_pubkey(ctx, pk);
+
+	return (true);
+}
+
+static struct asignify_public_data *
+asignify_verify_read_pubkey(asignify_verify_t *ctx, const char *pubf)
+{
+	int fd;
+	struct asignify_public_data *pk = NULL;
+	unsigned char *data;
+	size_t dlen;
+
+	fd = xopen(pubf, O_RDONLY, 0);
+	if (fd == -1) {
 		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
 	}
 	else {
-		pk = asignify_pubkey_load(f);
-		if (pk == NULL) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
-			ret = false;
+		data = xread_fd(fd, ASIGNIFY_MAX_PUBKEY_SIZE, &dlen);
+		if (data == NULL) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
 		}
-		else if (ret) {
-			chain = xmalloc(sizeof(*chain));
-			chain->pk = pk;
-			chain->next = ctx->pk_chain;
-			ctx->pk_chain = chain;
+		else {
+			pk = asignify_pubkey_load_buf((const char *)data, dlen);
+			free(data);
+
+			if (pk == NULL) {
+				ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+			}
 		}
-		fclose(f);
+		close(fd);
 	}
 
-	return (ret);
+	return (pk);
 }
 
 bool
-asignify_verify_load_signature(asignify_verify_t *ctx, const char *sigf)
+asignify_verify_load_pubkey(asignify_verify_t *ctx, const char *pubf)
 {
-	struct asignify_public_data *sig;
-	struct asignify_pubkey_chain *chain;
-	unsigned char *data;
-	size_t dlen;
-	FILE *f;
-	bool ret = false;
+	struct asignify_public_data *pk;
 
-	if (ctx == NULL || ctx->pk_chain == NULL) {
-		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+	if (ctx == NULL) {
 		return (false);
 	}
 
-	f = xfopen(sigf, "r");
-	if (f == NULL) {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	if ((pk = asignify_verify_read_pubkey(ctx, pubf)) == NULL) {
+		return (false);
 	}
-	else {
-		/* XXX: we assume that all pk in chain are the same */
-		sig = asignify_signature_load(f, ctx->pk_chain->pk);
-		if (ctx->pk_chain == NULL) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
-		}
-		else {
-			data = asignify_verify_load_sig(ctx, f, &dlen);
-			if (data == NULL || dlen == 0) {
-				fclose(f);
-				return (false);
-			}
 
-			chain = ctx->pk_chain;
-			while (chain != NULL && !ret) {
-				ret = asignify_pubkey_check_signature(chain->pk, sig, data, dlen);
-				chain = chain->next;
-			}
-			if (!ret) {
-				asignify_public_data_free(sig);
-				free(data);
-				ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
-				fclose(f);
-				return (false);
-			}
+	asignify_verify_add_pubkey(ctx, pk);
 
-			/* We are now safe to parse digests */
-			asignify_public_data_free(sig);
-			ctx->files = kh_init(asignify_verify_hnode);
+	return (true);
+}
 
-			if (asignify_verify_parse_files(ctx, (const char *)data, dlen)) {
-				ret = true;
-			}
-			free(data);
+bool
+asignify_verify_load_builtin_pubkeys(asignify_verify_t *ctx)
+{
+#ifdef ASIGNIFY_TRUST_ANCHORS
+	static const char anchors[] = ASIGNIFY_TRUST_ANCHORS;
+	char line[ASIGNIFY_MAX_LINE];
+	const char *p = anchors, *end = anchors + sizeof(anchors) - 1;
+	struct asignify_public_data *pk;
+	ssize_t r;
+	bool ret = false;
+
+	if (ctx == NULL) {
+		return (false);
+	}
+
+	/* Each line is a separate key, comments are skipped by the parser */
+	while ((r = asignify_buf_getline(&p, end, line, sizeof(line))) > 0) {
+		pk = asignify_pubkey_load_buf(line, r);
+
+		if (pk != NULL) {
+			asignify_verify_add_pubkey(ctx, pk);
+			ret = true;
 		}
-		fclose(f);
+	}
+
+	if (!ret) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_NO_PUBKEY);
 	}
 
 	return (ret);
+#else
+	CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_NO_PUBKEY);
+
+	return (false);
+#endif
 }
 
-bool
-asignify_verify_file(asignify_verify_t *ctx, const char *checkf)
+/*
+ * Checks signature by any key in chain and sets off to the signed data, does
+ * not modify ctx
+ */
+static enum asignify_error
+asignify_verify_signed_check(const asignify_verify_t *ctx,
+	const struct asignify_pubkey_chain *pk_chain, const char *buf,
+	size_t len, size_t *off)
 {
-	khiter_t k;
-	struct stat st;
-	int fd, check;
-	struct asignify_file *f;
-	struct asignify_file_digest *d;
-	unsigned char *calc_digest;
+	struct asignify_public_data *sig;
+	const struct asignify_pubkey_chain *chain;
+	bool ret = false;
 
-	if (ctx == NULL || ctx->files == NULL) {
-		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
-		return (false);
+	if (len > asignify_verify_max_size(ctx)) {
+		return (ASIGNIFY_ERROR_SIZE);
 	}
 
-	k = kh_get(asignify_verify_hnode, ctx->files, checkf);
+	/* XXX: we assume that all pk in chain are the same */
+	sig = asignify_signature_load_buf(buf, len, pk_chain->pk, off);
+	if (sig == NULL) {
+		return (ASIGNIFY_ERROR_FORMAT);
+	}
 
-	if (k != kh_end(ctx->files)) {
-		fd = xopen(checkf, O_RDONLY, 0);
+	if (*off == len) {
+		asignify_public_data_free(sig);
+		return (ASIGNIFY_ERROR_FORMAT);
+	}
 
-		f = kh_value(ctx->files, k);
+	chain = pk_chain;
+	while (chain != NULL && !ret) {
+		ret = asignify_pubkey_check_signature(chain->pk, sig,
+			(const unsigned char *)buf + *off, len - *off);
+		chain = chain->next;
+	}
 
-		if (fstat(fd, &st) == -1 || S_ISDIR(st.st_mode)) {
-			close(fd);
-			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
-			return (false);
-		}
+	asignify_public_data_free(sig);
 
-		if (f->size > 0 && f->size != st.st_size) {
-			ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY_SIZE);
-			close(fd);
-			return (false);
-		}
+	return (ret ? ASIGNIFY_ERROR_OK : ASIGNIFY_ERROR_VERIFY);
+}
 
-		d = f->digests;
-		while (d) {
-			calc_digest = asignify_digest_fd(d->digest_type, fd);
+static bool
+asignify_verify_signed_data(asignify_verify_t *ctx,
+	const struct asignify_pubkey_chain *pk_chain, const char *buf,
+	size_t len, size_t *off)
+{
+	enum asignify_error err;
 
-			if (calc_digest == NULL) {
-				close(fd);
-				ctx->error = xerr_string(ASIGNIFY_ERROR_SIZE);
-				return (false);
-			}
-			else {
-				check = memcmp(calc_digest, d->digest,
-					asignify_digest_len(d->digest_type));
-				free(calc_digest);
-
-				if (check != 0) {
-					ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY_DIGEST);
-					close(fd);
-					return (false);
-				}
-			}
-			d = d->next;
-		}
+	err = asignify_verify_signed_check(ctx, pk_chain, buf, len, off);
 
-		close(fd);
+	if (err != ASIGNIFY_ERROR_OK) {
+		ctx->error = xerr_string(err);
+		return (false);
+	}
+
+	return (true);
+}
+
+/* Reads a signature file unless it exceeds the limits, does not modify ctx */
+static unsigned char *
+asignify_verify_read_signature_r(const asignify_verify_t *ctx,
+	const char *sigf, size_t *dlen, enum asignify_error *err)
+{
+	unsigned char *data = NULL;
+	struct stat st;
+	int fd;
 
-		return (true);
+	fd = xopen(sigf, O_RDONLY, 0);
+	if (fd == -1) {
+		*err = ASIGNIFY_ERROR_FILE;
+	}
+	else if (fstat(fd, &st) != -1 && S_ISREG(st.st_mode) &&
+			(uint64_t)st.st_size > asignify_verify_max_size(ctx)) {
+		/* Do not even read signatures that are too large */
+		*err = ASIGNIFY_ERROR_SIZE;
+		close(fd);
 	}
 	else {
-		ctx->error = xerr_string(ASIGNIFY_ERROR_NO_DIGEST);
+		data = xread_fd(fd, asignify_verify_max_size(ctx), dlen);
+		if (data == NULL) {
+			*err = ASIGNIFY_ERROR_FILE;
+		}
+		close(fd);
 	}
 
-	return (false);
+	return (data);
 }
 
+static unsigned char *
+asignify_verify_read_signature(asignify_verify_t *ctx, const char *sigf,
+	size_t *dlen)
+{
+	unsigned char *data;
+	enum asignify_error err;
+
+	data = asignify_verify_read_signature_r(ctx, sigf, dlen, &err);
+
+	if (data == NULL) {
+		ctx->error = xerr_string(err);
+	}
+
+	return (data);
+}
+
+/* Attestations are bound to all signatures in the order of loading */
+static void
+asignify_verify_chain_digest(asignify_verify_t *ctx, const char *buf,
+	size_t len)
+{
+	struct asignify_digest_ctx *dig;
+	unsigned char *res;
+
+	dig = asignify_digest_init(ASIGNIFY_DIGEST_BLAKE2);
+	asignify_digest_update(dig, ctx->sig_digest, sizeof(ctx->sig_digest));
+	asignify_digest_update(dig, (const unsigned char *)buf, len);
+	res = asignify_digest_final(dig);
+	memcpy(ctx->sig_digest, res, sizeof(ctx->sig_digest));
+	free(res);
+}
+
+bool
+asignify_verify_load_signature_buf(asignify_verify_t *ctx, const char *buf,
+	size_t len)
+{
+	size_t off;
+
+	if (ctx == NULL || ctx->pk_chain == NULL || buf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if (len > asignify_verify_max_size(ctx)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_SIZE);
+		return (false);
+	}
+
+	if (!asignify_verify_signed_data(ctx, ctx->pk_chain, buf, len, &off)) {
+		return (false);
+	}
+
+	asignify_verify_chain_digest(ctx, buf, len);
+
+	/* We are now safe to parse digests */
+	if (ctx->files == NULL) {
+		ctx->files = kh_init(asignify_verify_hnode);
+	}
+
+	return (asignify_verify_parse_files(ctx, buf + off, len - off));
+}
+
+bool
+asignify_verify_load_signature(asignify_verify_t *ctx, const char *sigf)
+{
+	unsigned char *data;
+	size_t dlen;
+	bool ret = false;
+
+	if (ctx == NULL || ctx->pk_chain == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	data = asignify_verify_read_signature(ctx, sigf, &dlen);
+	if (data != NULL) {
+		ret = asignify_verify_load_signature_buf(ctx,
+			(const char *)data, dlen);
+		free(data);
+	}
+
+	return (ret);
+}
+
+bool
+asignify_verify_signature_r(const asignify_verify_t *ctx, const char *sigf,
+	struct asignify_verify_result *res)
+{
+	enum asignify_error err = ASIGNIFY_ERROR_OK;
+	unsigned char *data = NULL;
+	size_t dlen = 0, off;
+
+	if (ctx == NULL || ctx->pk_chain == NULL || sigf == NULL) {
+		err = ASIGNIFY_ERROR_MISUSE;
+	}
+	else if ((data = asignify_verify_read_signature_r(ctx, sigf, &dlen,
+			&err)) != NULL) {
+		err = asignify_verify_signed_check(ctx, ctx->pk_chain,
+			(const char *)data, dlen, &off);
+		free(data);
+	}
+
+	if (res != NULL) {
+		memset(res, 0, sizeof(*res));
+		res->size = dlen;
+		res->error = err == ASIGNIFY_ERROR_OK ? NULL : xerr_string(err);
+	}
+
+	return (err == ASIGNIFY_ERROR_OK);
+}
+
+struct asignify_verify_batch {
+	const asignify_verify_t *ctx;
+	const char **sigs;
+	struct asignify_verify_result *results;
+	size_t n;
+	size_t next;
+	size_t valid;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mtx;
+#endif
+};
+
+/* Signatures are taken by workers in small runs to reduce locking */
+#define ASIGNIFY_VERIFY_BATCH_RUN 16
+
+static void *
+asignify_verify_batch_worker(void *ud)
+{
+	struct asignify_verify_batch *b = ud;
+	size_t i, start, end, valid = 0;
+
+	for (;;) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&b->mtx);
+#endif
+		start = b->next;
+		end = b->n - start > ASIGNIFY_VERIFY_BATCH_RUN ?
+			start + ASIGNIFY_VERIFY_BATCH_RUN : b->n;
+		b->next = end;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&b->mtx);
+#endif
+
+		if (start == end) {
+			break;
+		}
+
+		for (i = start; i < end; i ++) {
+			if (b->ctx != NULL && asignify_cancel_check(b->ctx->cancel)) {
+				memset(&b->results[i], 0, sizeof(b->results[i]));
+				b->results[i].error = xerr_string(ASIGNIFY_ERROR_CANCELLED);
+			}
+			else if (asignify_verify_signature_r(b->ctx, b->sigs[i],
+					&b->results[i])) {
+				valid ++;
+			}
+		}
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&b->mtx);
+#endif
+	b->valid += valid;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&b->mtx);
+#endif
+
+	return (NULL);
+}
+
+size_t
+asignify_verify_signatures(const asignify_verify_t *ctx, const char **sigs,
+	size_t n, unsigned int nthreads, struct asignify_verify_result *results)
+{
+	struct asignify_verify_batch b;
+#ifdef HAVE_PTHREAD
+	pthread_t *thrs = NULL;
+	unsigned int i, started = 0;
+	long ncpu;
+#endif
+
+	if (sigs == NULL || results == NULL) {
+		return (0);
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.ctx = ctx;
+	b.sigs = sigs;
+	b.results = results;
+	b.n = n;
+
+#ifdef HAVE_PTHREAD
+	if (nthreads == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? ncpu : 1;
+	}
+
+	if (nthreads > (n + ASIGNIFY_VERIFY_BATCH_RUN - 1) /
+			ASIGNIFY_VERIFY_BATCH_RUN) {
+		nthreads = (n + ASIGNIFY_VERIFY_BATCH_RUN - 1) /
+			ASIGNIFY_VERIFY_BATCH_RUN;
+	}
+
+	pthread_mutex_init(&b.mtx, NULL);
+
+	/* The caller is one of the workers */
+	if (nthreads > 1) {
+		thrs = xmalloc0(sizeof(*thrs) * (nthreads - 1));
+
+		for (i = 0; i < nthreads - 1; i ++) {
+			if (pthread_create(&thrs[i], NULL, asignify_verify_batch_worker,
+					&b) != 0) {
+				break;
+			}
+		}
+
+		started = i;
+	}
+#endif
+
+	asignify_verify_batch_worker(&b);
+
+#ifdef HAVE_PTHREAD
+	for (i = 0; i < started; i ++) {
+		pthread_join(thrs[i], NULL);
+	}
+
+	free(thrs);
+	pthread_mutex_destroy(&b.mtx);
+#endif
+
+	return (b.valid);
+}
+
+static void
+asignify_verify_clear_attestation(asignify_verify_t *ctx)
+{
+	khiter_t k;
+	struct asignify_file *f;
+
+	for (k = kh_begin(ctx->files); k != kh_end(ctx->files); ++k) {
+		if (kh_exist(ctx->files, k)) {
+			f = kh_value(ctx->files, k);
+			free(f->attest);
+			f->attest = NULL;
+		}
+	}
+}
+
+/*
+ * Attestation lines are `file: dev ino size mtime ctime name`, files that
+ * are not listed in signatures are ignored
+ */
+static bool
+asignify_verify_parse_attestation(asignify_verify_t *ctx, const char *data,
+	size_t len)
+{
+	const char *pos = data, *end = data + len;
+	char line[ASIGNIFY_MAX_LINE], *name;
+	unsigned char digest[ASIGNIFY_ATTEST_HASHLEN];
+	const char *hend;
+	struct asignify_file_id id;
+	struct asignify_file *f;
+	khiter_t k;
+	size_t blen;
+	ssize_t r;
+	int n;
+
+	if (asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			strcmp(line, ASIGNIFY_ATTEST_MAGIC "\n") != 0) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		return (false);
+	}
+
+	if (asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			strncmp(line, "signatures: ", 12) != 0 ||
+			hex2bin(digest, sizeof(digest), line + 12,
+			sizeof(digest) * 2, &blen, &hend) != 0 ||
+			blen != sizeof(digest) || *hend != '\n') {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		return (false);
+	}
+
+	if (memcmp(digest, ctx->sig_digest, sizeof(digest)) != 0) {
+		/* Attestation has been made for other signatures */
+		ctx->error = xerr_string(ASIGNIFY_ERROR_VERIFY);
+		return (false);
+	}
+
+	while ((r = asignify_buf_getline(&pos, end, line, sizeof(line))) > 0) {
+		n = 0;
+
+		if (line[r - 1] != '\n' || sscanf(line, "file: %" SCNu64 " %" SCNu64
+				" %" SCNu64 " %" SCNd64 " %" SCNd64 " %n", &id.dev, &id.ino,
+				&id.size, &id.mtime, &id.ctime, &n) != 5 || n == 0 ||
+				n >= r - 1) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+			return (false);
+		}
+
+		line[r - 1] = '\0';
+		name = line + n;
+		k = kh_get(asignify_verify_hnode, ctx->files, name);
+
+		if (k != kh_end(ctx->files)) {
+			f = kh_value(ctx->files, k);
+
+			if (f->attest == NULL) {
+				f->attest = xmalloc(sizeof(*f->attest));
+			}
+
+			memcpy(f->attest, &id, sizeof(id));
+		}
+	}
+
+	if (r < 0) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		return (false);
+	}
+
+	return (true);
+}
+
+const unsigned char*
+asignify_verify_get_signatures_digest(asignify_verify_t *ctx, size_t *len)
+{
+	if (ctx == NULL || ctx->files == NULL || len == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (NULL);
+	}
+
+	*len = sizeof(ctx->sig_digest);
+
+	return (ctx->sig_digest);
+}
+
+bool
+asignify_verify_load_attestation(asignify_verify_t *ctx, const char *pubf,
+	const char *attf)
+{
+	struct asignify_pubkey_chain chain;
+	unsigned char *data;
+	size_t dlen, off;
+	bool ret = false;
+
+	if (ctx == NULL || ctx->files == NULL || pubf == NULL || attf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	/* Attestations are signed by verifiers rather than by signatures keys */
+	if ((chain.pk = asignify_verify_read_pubkey(ctx, pubf)) == NULL) {
+		return (false);
+	}
+
+	chain.next = NULL;
+	asignify_verify_clear_attestation(ctx);
+	data = asignify_verify_read_signature(ctx, attf, &dlen);
+
+	if (data != NULL) {
+		if (asignify_verify_signed_data(ctx, &chain, (const char *)data,
+				dlen, &off)) {
+			ret = asignify_verify_parse_attestation(ctx,
+				(const char *)data + off, dlen - off);
+		}
+
+		free(data);
+	}
+
+	if (!ret) {
+		asignify_verify_clear_attestation(ctx);
+	}
+
+	asignify_public_data_free(chain.pk);
+
+	return (ret);
+}
+
+static bool
+asignify_verify_delta_hash(const char *line, const char *key,
+	unsigned char *hash)
+{
+	size_t klen = strlen(key), blen;
+	const char *end;
+
+	if (strncmp(line, key, klen) != 0 || line[klen] != ':' ||
+			line[klen + 1] != ' ') {
+		return (false);
+	}
+
+	if (hex2bin(hash, ASIGNIFY_DELTA_HASHLEN, line + klen + 2,
+			ASIGNIFY_DELTA_HASHLEN * 2, &blen, &end) != 0 ||
+			blen != ASIGNIFY_DELTA_HASHLEN) {
+		return (false);
+	}
+
+	return (*end == '\n');
+}
+
+/*
+ * Applies operations of a delta to the base body, the result (preceded by
+ * the target signature lines) is appended to out and hashed to digest
+ */
+static enum asignify_error
+asignify_verify_delta_ops(const char *ops, size_t olen, const char *base,
+	size_t blen, struct asignify_digest_ctx *dig, asignify_verify_text_t *out)
+{
+	const char *p = ops, *end = ops + olen, *nl, *start;
+	const char *b = base, *bend = base + blen;
+	uint64_t count;
+	char *errstr;
+
+	while (p < end) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL || nl - p < 2 ||
+				p[1] != ' ') {
+			return (ASIGNIFY_ERROR_FORMAT);
+		}
+
+		if (p[0] == '+') {
+			asignify_digest_update(dig, (const unsigned char *)p + 2,
+				nl - p - 1);
+			kv_push_a(char, *out, p + 2, nl - p - 1);
+			p = nl + 1;
+			continue;
+		}
+		else if (p[0] != '=' && p[0] != '-') {
+			return (ASIGNIFY_ERROR_FORMAT);
+		}
+
+		errno = 0;
+		count = strtoumax(p + 2, &errstr, 10);
+
+		if (errstr != nl || errno != 0 || count == 0) {
+			return (ASIGNIFY_ERROR_FORMAT);
+		}
+
+		for (start = b; count > 0; count --) {
+			if (b >= bend) {
+				/* Delta has been made for a longer base */
+				return (ASIGNIFY_ERROR_VERIFY_DIGEST);
+			}
+
+			b = memchr(b, '\n', bend - b);
+			b = b != NULL ? b + 1 : bend;
+		}
+
+		if (p[0] == '=') {
+			asignify_digest_update(dig, (const unsigned char *)start,
+				b - start);
+			kv_push_a(char, *out, start, b - start);
+		}
+
+		p = nl + 1;
+	}
+
+	return (b == bend ? ASIGNIFY_ERROR_OK : ASIGNIFY_ERROR_VERIFY_DIGEST);
+}
+
+bool
+asignify_verify_apply_delta(asignify_verify_t *ctx, const char *basef,
+	const char *deltaf, const char *outf)
+{
+	unsigned char *delta = NULL, *base = NULL, *res;
+	unsigned char bhash[ASIGNIFY_DELTA_HASHLEN], thash[ASIGNIFY_DELTA_HASHLEN];
+	struct asignify_public_data *sig;
+	struct asignify_digest_ctx *dig;
+	enum asignify_error err = ASIGNIFY_ERROR_FORMAT;
+	asignify_verify_text_t out;
+	const char *pos, *end;
+	char line[ASIGNIFY_MAX_LINE];
+	size_t dlen, doff, blen, boff, i;
+	unsigned int nsig, n;
+	ssize_t r;
+	int fd;
+
+	if (ctx == NULL || ctx->pk_chain == NULL || basef == NULL ||
+			deltaf == NULL || outf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	delta = asignify_verify_read_signature(ctx, deltaf, &dlen);
+	if (delta == NULL || !asignify_verify_signed_data(ctx, ctx->pk_chain,
+			(const char *)delta, dlen, &doff)) {
+		free(delta);
+		return (false);
+	}
+
+	kv_init(out);
+	pos = (const char *)delta + doff;
+	end = (const char *)delta + dlen;
+
+	if (asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			strcmp(line, ASIGNIFY_DELTA_MAGIC "\n") != 0 ||
+			asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			!asignify_verify_delta_hash(line, "base", bhash) ||
+			asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			!asignify_verify_delta_hash(line, "target", thash) ||
+			asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0 ||
+			sscanf(line, "signature: %u", &nsig) != 1 || nsig == 0) {
+		goto out;
+	}
+
+	/* Target signature lines are copied as is */
+	for (n = 0; n < nsig; n ++) {
+		if (asignify_buf_getline(&pos, end, line, sizeof(line)) <= 0) {
+			goto out;
+		}
+
+		kv_push_a(char, out, line, strlen(line));
+	}
+
+	/* Base is a local copy, it is trusted if its digest matches */
+	base = asignify_verify_read_signature(ctx, basef, &blen);
+
+	if (base == NULL) {
+		free(delta);
+		kv_destroy(out);
+		return (false);
+	}
+
+	sig = asignify_signature_load_buf((const char *)base, blen,
+		ctx->pk_chain->pk, &boff);
+
+	if (sig == NULL) {
+		goto out;
+	}
+
+	asignify_public_data_free(sig);
+	dig = asignify_digest_init(ASIGNIFY_DIGEST_BLAKE2);
+	asignify_digest_update(dig, base + boff, blen - boff);
+	res = asignify_digest_final(dig);
+
+	if (memcmp(res, bhash, sizeof(bhash)) != 0) {
+		err = ASIGNIFY_ERROR_VERIFY_DIGEST;
+		free(res);
+		goto out;
+	}
+
+	free(res);
+	dig = asignify_digest_init(ASIGNIFY_DIGEST_BLAKE2);
+	err = asignify_verify_delta_ops(pos, end - pos, (const char *)base + boff,
+		blen - boff, dig, &out);
+	res = asignify_digest_final(dig);
+
+	if (err == ASIGNIFY_ERROR_OK && memcmp(res, thash, sizeof(thash)) != 0) {
+		err = ASIGNIFY_ERROR_VERIFY_DIGEST;
+	}
+
+	free(res);
+
+	/* Base has been read completely, so it can be overwritten */
+	if (err == ASIGNIFY_ERROR_OK && (fd = xopen(outf,
+			O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+		err = ASIGNIFY_ERROR_FILE;
+	}
+	else if (err == ASIGNIFY_ERROR_OK) {
+		/* Verify-only builds have no stdio */
+		for (i = 0; i < kv_size(out); i += r) {
+			if ((r = write(fd, out.a + i, kv_size(out) - i)) <= 0) {
+				if (r == -1 && errno == EINTR) {
+					r = 0;
+					continue;
+				}
+				err = ASIGNIFY_ERROR_FILE;
+				break;
+			}
+		}
+
+		if (close(fd) == -1) {
+			err = ASIGNIFY_ERROR_FILE;
+		}
+	}
+
+out:
+	if (err != ASIGNIFY_ERROR_OK) {
+		ctx->error = xerr_string(err);
+	}
+
+	free(delta);
+	free(base);
+	kv_destroy(out);
+
+	return (err == ASIGNIFY_ERROR_OK);
+}
+
+/* Loads a signed log head, heads are not added to the files checked */
+static struct asignify_log_head *
+asignify_verify_load_head(asignify_verify_t *ctx, const char *headf)
+{
+	struct asignify_log_head *h = NULL;
+	unsigned char *data;
+	size_t dlen, off;
+
+	data = asignify_verify_read_signature(ctx, headf, &dlen);
+	if (data == NULL) {
+		return (NULL);
+	}
+
+	if (asignify_verify_signed_data(ctx, ctx->pk_chain, (const char *)data,
+			dlen, &off)) {
+		h = asignify_log_head_parse((const char *)data + off, dlen - off);
+
+		if (h == NULL) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		}
+	}
+
+	free(data);
+
+	return (h);
+}
+
+bool
+asignify_verify_log(asignify_verify_t *ctx, const char *logf,
+	const char *headf, const char *prevf)
+{
+	struct asignify_log_head *head, *prev = NULL, *h = NULL;
+	enum asignify_error err = ASIGNIFY_ERROR_OK;
+	struct stat st;
+	int fd;
+
+	if (ctx == NULL || ctx->pk_chain == NULL || logf == NULL ||
+			headf == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if ((head = asignify_verify_load_head(ctx, headf)) == NULL) {
+		return (false);
+	}
+
+	if (prevf != NULL && (prev = asignify_verify_load_head(ctx, prevf)) == NULL) {
+		asignify_log_head_free(head);
+		return (false);
+	}
+
+	if (strcmp(head->name, logf) != 0 || (prev != NULL &&
+			(strcmp(prev->name, head->name) != 0 ||
+			prev->segment != head->segment ||
+			prev->records != head->records))) {
+		err = ASIGNIFY_ERROR_NO_DIGEST;
+	}
+	else if ((fd = xopen(logf, O_RDONLY, 0)) == -1) {
+		err = ASIGNIFY_ERROR_FILE;
+	}
+	else {
+		if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+			err = ASIGNIFY_ERROR_FILE;
+		}
+		else if ((uint64_t)st.st_size < head->size) {
+			err = ASIGNIFY_ERROR_VERIFY_SIZE;
+		}
+		else if (prev != NULL) {
+			h = asignify_log_advance(prev, fd, head->size, ctx->cancel, &err);
+		}
+		else {
+			h = asignify_log_head_new(head->name, head->segment,
+				head->records);
+			err = asignify_log_hash(h, fd, head->size, ctx->cancel);
+		}
+
+		close(fd);
+	}
+
+	if (err == ASIGNIFY_ERROR_OK && (h->leaves != head->leaves ||
+			h->offset != head->offset ||
+			memcmp(h->root, head->root, sizeof(h->root)) != 0 ||
+			memcmp(h->frontier, head->frontier,
+			sizeof(h->frontier[0]) * h->nfrontier) != 0)) {
+		err = ASIGNIFY_ERROR_VERIFY_DIGEST;
+	}
+
+	asignify_log_head_free(h);
+	asignify_log_head_free(prev);
+	asignify_log_head_free(head);
+
+	if (err != ASIGNIFY_ERROR_OK) {
+		ctx->error = xerr_string(err);
+		return (false);
+	}
+
+	return (true);
+}
+
+/* Returns the only digest to check according to policy, NULL to check all */
+static const struct asignify_file_digest *
+asignify_verify_pick_digest(const asignify_verify_t *ctx,
+	const struct asignify_file *f)
+{
+	const struct asignify_file_digest *d, *best = NULL;
+
+	if (ctx->digest_policy == ASIGNIFY_DIGEST_POLICY_ALL) {
+		return (NULL);
+	}
+
+	for (d = f->digests; d != NULL; d = d->next) {
+		if (ctx->digest_policy == ASIGNIFY_DIGEST_POLICY_PREFER &&
+				d->digest_type == ctx->digest_prefer) {
+			return (d);
+		}
+
+		if (best == NULL || asignify_digest_speed(d->digest_type) >
+				asignify_digest_speed(best->digest_type)) {
+			best = d;
+		}
+	}
+
+	return (best);
+}
+
+/*
+ * Returns types of digests to compute: checked ones and extra ones that are
+ * not recorded (recorded digests of a valid file are returned as recorded)
+ */
+static unsigned int
+asignify_verify_digest_types(const asignify_verify_t *ctx,
+	const struct asignify_file *f, unsigned int extra)
+{
+	const struct asignify_file_digest *d, *pick;
+	unsigned int types = 0;
+
+	pick = asignify_verify_pick_digest(ctx, f);
+
+	for (d = f->digests; d != NULL; d = d->next) {
+		if (pick == NULL || d == pick) {
+			types |= ASIGNIFY_DIGEST_BIT(d->digest_type);
+		}
+
+		extra &= ~ASIGNIFY_DIGEST_BIT(d->digest_type);
+	}
+
+	return (types | extra);
+}
+
+/*
+ * Compares computed digests with recorded ones and frees them, digests of a
+ * valid file are copied to out
+ */
+static enum asignify_error
+asignify_verify_digests_finish(const struct asignify_file *f,
+	unsigned char **calc, enum asignify_error err,
+	struct asignify_file_digests *out)
+{
+	const struct asignify_file_digest *d;
+	unsigned int i;
+
+	for (d = f->digests; d != NULL && err == ASIGNIFY_ERROR_OK; d = d->next) {
+		if (calc[d->digest_type] != NULL && memcmp(calc[d->digest_type],
+				d->digest, asignify_digest_len(d->digest_type)) != 0) {
+			err = ASIGNIFY_ERROR_VERIFY_DIGEST;
+		}
+	}
+
+	if (out != NULL) {
+		memset(out, 0, sizeof(*out));
+	}
+
+	if (out != NULL && err == ASIGNIFY_ERROR_OK) {
+		for (d = f->digests; d != NULL; d = d->next) {
+			out->types |= ASIGNIFY_DIGEST_BIT(d->digest_type);
+			memcpy(out->digest[d->digest_type], d->digest,
+				asignify_digest_len(d->digest_type));
+		}
+
+		for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+			if (calc[i] != NULL) {
+				out->types |= ASIGNIFY_DIGEST_BIT(i);
+				memcpy(out->digest[i], calc[i], asignify_digest_len(i));
+			}
+		}
+	}
+
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		free(calc[i]);
+	}
+
+	return (err);
+}
+
+static bool
+asignify_verify_stream_cb(void *ud, const unsigned char *buf, size_t len)
+{
+	struct asignify_verify_stream *vs = ud;
+	unsigned int i;
+
+	vs->size += len;
+
+	/* Do not waste time on decompression bombs */
+	if (vs->limit > 0 && vs->size > vs->limit) {
+		vs->oversized = true;
+		return (false);
+	}
+
+	for (i = 0; i < vs->ndig; i ++) {
+		/* Digests skipped by the digest policy are not initialized */
+		if (vs->dig[i] != NULL) {
+			asignify_digest_update(vs->dig[i], buf, len);
+		}
+	}
+
+	return (true);
+}
+
+static enum asignify_error
+asignify_verify_decompressed(const asignify_verify_t *ctx, const char *checkf,
+	const struct asignify_file *f, unsigned int extra, uint64_t *size,
+	struct asignify_file_digests *out)
+{
+	struct asignify_verify_stream vs;
+	struct asignify_decompress *dec = NULL;
+	struct asignify_digest_ctx *dig[ASIGNIFY_DIGEST_SIZE];
+	struct asignify_pipe *pipe;
+	struct stat st;
+	const unsigned char *buf;
+	unsigned char *calc[ASIGNIFY_DIGEST_SIZE];
+	unsigned int i, types;
+	enum asignify_error err = ASIGNIFY_ERROR_OK;
+	ssize_t r;
+	int fd;
+
+	fd = xopen(checkf, O_RDONLY, 0);
+
+	if (fd == -1 || fstat(fd, &st) == -1 || S_ISDIR(st.st_mode)) {
+		if (fd != -1) {
+			close(fd);
+		}
+		return (ASIGNIFY_ERROR_FILE);
+	}
+
+	memset(&vs, 0, sizeof(vs));
+	memset(dig, 0, sizeof(dig));
+	memset(calc, 0, sizeof(calc));
+	vs.limit = f->size;
+	vs.dig = dig;
+	vs.ndig = ASIGNIFY_DIGEST_SIZE;
+	types = asignify_verify_digest_types(ctx, f, extra);
+
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		if (!(types & ASIGNIFY_DIGEST_BIT(i))) {
+			continue;
+		}
+
+		if ((dig[i] = asignify_digest_init(i)) == NULL) {
+			err = ASIGNIFY_ERROR_SIZE;
+			break;
+		}
+	}
+
+	/* Compressed data is read by a separate thread while we are inflating */
+	pipe = asignify_pipe_reader(fd, S_ISREG(st.st_mode) ? st.st_size : -1);
+	asignify_pipe_set_cancel(pipe, ctx->cancel);
+
+	while (err == ASIGNIFY_ERROR_OK &&
+			(r = asignify_pipe_read(pipe, &buf)) != 0) {
+		if (r == -1) {
+			err = asignify_io_error(ctx->cancel);
+			break;
+		}
+
+		if (dec == NULL) {
+			dec = asignify_decompress_init(
+				asignify_compression_detect(buf, r));
+
+			if (dec == NULL) {
+				err = ASIGNIFY_ERROR_COMPRESSION;
+				break;
+			}
+		}
+
+		if (!asignify_decompress_update(dec, buf, r,
+				asignify_verify_stream_cb, &vs)) {
+			err = vs.oversized ?
+				ASIGNIFY_ERROR_VERIFY_SIZE : ASIGNIFY_ERROR_FORMAT;
+		}
+	}
+
+	asignify_pipe_close(pipe);
+	close(fd);
+
+	if (err == ASIGNIFY_ERROR_OK) {
+		if (dec == NULL) {
+			/* Empty files cannot be valid compressed streams */
+			err = ASIGNIFY_ERROR_COMPRESSION;
+		}
+		else if (!asignify_decompress_finish(dec)) {
+			err = ASIGNIFY_ERROR_FORMAT;
+		}
+		else if (f->size > 0 && f->size != vs.size) {
+			err = ASIGNIFY_ERROR_VERIFY_SIZE;
+		}
+	}
+
+	asignify_decompress_free(dec);
+
+	for (i = 0; i < ASIGNIFY_DIGEST_SIZE; i ++) {
+		if (dig[i] == NULL) {
+			continue;
+		}
+
+		if (err != ASIGNIFY_ERROR_OK) {
+			asignify_digest_free(dig[i]);
+		}
+		else {
+			calc[i] = asignify_digest_final(dig[i]);
+		}
+	}
+
+	*size = vs.size;
+
+	return (asignify_verify_digests_finish(f, calc, err, out));
+}
+
+/* Returns an entry for a file name without compression suffix */
+static struct asignify_file *
+asignify_verify_find_uncompressed(const asignify_verify_t *ctx,
+	const char *checkf)
+{
+	static const char *suffixes[] = {".gz", ".zst"};
+	struct asignify_file *f = NULL;
+	size_t len, slen;
+	unsigned int i;
+	char *fname;
+	khiter_t k;
+
+	len = strlen(checkf);
+
+	for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i ++) {
+		slen = strlen(suffixes[i]);
+
+		if (len > slen && strcmp(checkf + len - slen, suffixes[i]) == 0) {
+			fname = xmalloc(len - slen + 1);
+			memcpy(fname, checkf, len - slen);
+			fname[len - slen] = '\0';
+			k = kh_get(asignify_verify_hnode, ctx->files, fname);
+			free(fname);
+
+			if (k != kh_end(ctx->files)) {
+				f = kh_value(ctx->files, k);
+			}
+			break;
+		}
+	}
+
+	return (f);
+}
+
+static void
+asignify_verify_file_id(const struct stat *st, struct asignify_file_id *id)
+{
+	id->dev = st->st_dev;
+	id->ino = st->st_ino;
+	id->size = st->st_size;
+	id->mtime = st->st_mtime;
+	id->ctime = st->st_ctime;
+}
+
+static bool
+asignify_verify_same_id(const struct asignify_file_id *a,
+	const struct asignify_file_id *b)
+{
+	return (a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+		a->mtime == b->mtime && a->ctime == b->ctime);
+}
+
+/*
+ * Loaded context is never modified here, so it can be shared by threads
+ */
+static enum asignify_error
+asignify_verify_check(const asignify_verify_t *ctx, const char *checkf,
+	unsigned int extra, struct asignify_verify_result *res,
+	struct asignify_file_digests *out)
+{
+	khiter_t k;
+	struct stat st;
+	int fd;
+	struct asignify_file *f;
+	const struct asignify_file_digest *d;
+	unsigned char *calc[ASIGNIFY_DIGEST_SIZE];
+	unsigned int types;
+	enum asignify_error err;
+	time_t start;
+
+	memset(res, 0, sizeof(*res));
+	memset(calc, 0, sizeof(calc));
+
+	if (out != NULL) {
+		memset(out, 0, sizeof(*out));
+	}
+
+	k = kh_get(asignify_verify_hnode, ctx->files, checkf);
+
+	if (k != kh_end(ctx->files)) {
+		start = time(NULL);
+		fd = xopen(checkf, O_RDONLY, 0);
+
+		f = kh_value(ctx->files, k);
+
+		if (fstat(fd, &st) == -1 || S_ISDIR(st.st_mode)) {
+			close(fd);
+			return (ASIGNIFY_ERROR_FILE);
+		}
+
+		res->size = st.st_size;
+
+		if (f->size > 0 && f->size != st.st_size) {
+			close(fd);
+			return (ASIGNIFY_ERROR_VERIFY_SIZE);
+		}
+
+		asignify_verify_file_id(&st, &res->id);
+		types = asignify_verify_digest_types(ctx, f, extra);
+
+		if (S_ISREG(st.st_mode) && f->attest != NULL &&
+				asignify_verify_same_id(f->attest, &res->id)) {
+			/*
+			 * File has been already checked and it is unchanged, so only
+			 * extra digests that are not recorded have to be computed
+			 */
+			res->attested = true;
+			res->has_id = true;
+
+			for (d = f->digests; d != NULL; d = d->next) {
+				types &= ~ASIGNIFY_DIGEST_BIT(d->digest_type);
+			}
+		}
+
+		if (types != 0 &&
+				!asignify_digest_fd_multi(fd, types, calc, ctx->cancel)) {
+			close(fd);
+			return (asignify_cancel_check(ctx->cancel) ?
+				ASIGNIFY_ERROR_CANCELLED : ASIGNIFY_ERROR_SIZE);
+		}
+
+		close(fd);
+		err = asignify_verify_digests_finish(f, calc, ASIGNIFY_ERROR_OK, out);
+
+		if (err == ASIGNIFY_ERROR_OK && !res->attested) {
+			/*
+			 * File could be changed after hashing within the same second,
+			 * so its identity cannot prove that it is unchanged
+			 */
+			res->has_id = S_ISREG(st.st_mode) && st.st_mtime < start &&
+				st.st_ctime < start;
+		}
+
+		return (err);
+	}
+	else if (ctx->decompress &&
+			(f = asignify_verify_find_uncompressed(ctx, checkf)) != NULL) {
+		return (asignify_verify_decompressed(ctx, checkf, f, extra,
+			&res->size, out));
+	}
+
+	return (ASIGNIFY_ERROR_NO_DIGEST);
+}
+
+bool
+asignify_verify_file(asignify_verify_t *ctx, const char *checkf)
+{
+	enum asignify_error err;
+	struct asignify_verify_result res;
+
+	if (ctx == NULL || ctx->files == NULL) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	err = asignify_verify_check(ctx, checkf, 0, &res, NULL);
+
+	if (err != ASIGNIFY_ERROR_OK) {
+		ctx->error = xerr_string(err);
+		return (false);
+	}
+
+	return (true);
+}
+
+bool
+asignify_verify_file_r(const asignify_verify_t *ctx, const char *checkf,
+	struct asignify_verify_result *res)
+{
+	enum asignify_error err;
+	struct asignify_verify_result cur;
+
+	memset(&cur, 0, sizeof(cur));
+
+	if (ctx == NULL || ctx->files == NULL || checkf == NULL) {
+		err = ASIGNIFY_ERROR_MISUSE;
+	}
+	else {
+		err = asignify_verify_check(ctx, checkf, 0, &cur, NULL);
+	}
+
+	if (res != NULL) {
+		memcpy(res, &cur, sizeof(cur));
+		res->error = err == ASIGNIFY_ERROR_OK ? NULL : xerr_string(err);
+	}
+
+	return (err == ASIGNIFY_ERROR_OK);
+}
+
+bool
+asignify_verify_file_digests(const asignify_verify_t *ctx, const char *checkf,
+	unsigned int extra, struct asignify_verify_result *res,
+	struct asignify_file_digests *digests)
+{
+	enum asignify_error err;
+	struct asignify_verify_result cur;
+
+	memset(&cur, 0, sizeof(cur));
+
+	if (digests != NULL) {
+		memset(digests, 0, sizeof(*digests));
+	}
+
+	if (ctx == NULL || ctx->files == NULL || checkf == NULL ||
+			(extra & ~(ASIGNIFY_DIGEST_BIT(ASIGNIFY_DIGEST_SIZE) - 1))) {
+		err = ASIGNIFY_ERROR_MISUSE;
+	}
+	else {
+		err = asignify_verify_check(ctx, checkf, extra, &cur, digests);
+	}
+
+	if (res != NULL) {
+		memcpy(res, &cur, sizeof(cur));
+		res->error = err == ASIGNIFY_ERROR_OK ? NULL : xerr_string(err);
+	}
+
+	return (err == ASIGNIFY_ERROR_OK);
+}
+
+void
+asignify_verify_set_cancel(asignify_verify_t *ctx, const asignify_cancel_t *c)
+{
+	if (ctx != NULL) {
+		ctx->cancel = c;
+	}
+}
+
+void
+asignify_verify_set_limits(asignify_verify_t *ctx, size_t max_memory,
+	unsigned int max_entries, unsigned int max_path)
+{
+	if (ctx != NULL) {
+		ctx->max_memory = max_memory;
+		ctx->max_entries = max_entries;
+		ctx->max_path = max_path;
+	}
+}
+
+void
+asignify_verify_set_decompress(asignify_verify_t *ctx, bool decompress)
+{
+	if (ctx != NULL) {
+		ctx->decompress = decompress;
+	}
+}
+
+void
+asignify_verify_set_digest_policy(asignify_verify_t *ctx,
+	enum asignify_digest_policy policy, enum asignify_digest_type prefer)
+{
+	if (ctx != NULL) {
+		ctx->digest_policy = policy;
+		ctx->digest_prefer = prefer;
+	}
+}
 
 const char*
 asignify_verify_get_error(asignify_verify_t *ctx)
@@ -556,6 +1662,7 @@ asignify_verify_free(asignify_verify_t *ctx)
 						free(d);
 					}
 					free(f->fname);
+					free(f->attest);
 					free(f);
 				}
 			}
@@ -0,0 +1,860 @@
+/* Copyright (c) 2015, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "blake2.h"
+#include "chacha.h"
+#include "asignify.h"
+#include "asignify_internal.h"
+#include "tweetnacl.h"
+#include "kvec.h"
+
+/*
+ * Split-volume encryption:
+ *
+ * Input is split into contiguous ranges, each range is encrypted to its own
+ * volume file with a random key, and every volume is authenticated by
+ * blake2b keyed with its own random key over the volume header and the
+ * ciphertext. Volumes are independent, so they are produced and consumed
+ * concurrently and in any order. Ranges, keys and MACs are listed in the
+ * volume index which is encrypted and signed as a normal encrypted file.
+ */
+
+#define VOLUME_MAGIC "asignify-volume:"
+#define VOLUME_INDEX_MAGIC "asignify-volume-index:"
+#define VOLUME_VERSION 1
+#define VOLUME_INDEX_MAX_SIZE (64 * 1024 * 1024)
+#define VOLUME_MAX 65536
+#define VOLUME_SET_ID_LEN 16
+#define VOLUME_KEY_LEN 32
+#define VOLUME_MAC_LEN 32
+#define VOLUME_HDR_MAX 128
+#define VOLUME_BUF_SIZE (1024 * 1024)
+
+struct asignify_volume {
+	uint64_t off;
+	uint64_t len;
+	unsigned char key[VOLUME_KEY_LEN];
+	unsigned char mac_key[VOLUME_KEY_LEN];
+	unsigned char mac[VOLUME_MAC_LEN];
+	bool claimed;
+};
+
+struct asignify_volume_set {
+	const asignify_cancel_t *cancel;
+	struct asignify_volume *vols;
+	unsigned int nvols;
+	/* Volume files in any order for decryption */
+	char **paths;
+	unsigned int npaths;
+	unsigned int next;
+	unsigned char id[VOLUME_SET_ID_LEN];
+	int rounds;
+	int fd;
+	bool decrypt;
+	enum asignify_error err;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mtx;
+#endif
+};
+
+static void
+asignify_volume_lock(struct asignify_volume_set *s)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&s->mtx);
+#endif
+}
+
+static void
+asignify_volume_unlock(struct asignify_volume_set *s)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&s->mtx);
+#endif
+}
+
+static void
+asignify_volume_fail(struct asignify_volume_set *s, enum asignify_error err)
+{
+	asignify_volume_lock(s);
+	/* The first error wins */
+	if (s->err == ASIGNIFY_ERROR_OK) {
+		s->err = err;
+	}
+	asignify_volume_unlock(s);
+}
+
+/*
+ * Header is the prefix that binds a volume to its set followed by the volume
+ * number, the number is omitted if n is zero
+ */
+static int
+asignify_volume_header(struct asignify_volume_set *s, unsigned int n,
+	char *hdr, size_t hdrlen)
+{
+	char hexid[VOLUME_SET_ID_LEN * 2 + 1];
+
+	bin2hex(hexid, sizeof(hexid), s->id, sizeof(s->id));
+
+	if (n == 0) {
+		return (snprintf(hdr, hdrlen, "%s%d:%s:", VOLUME_MAGIC,
+			VOLUME_VERSION, hexid));
+	}
+
+	return (snprintf(hdr, hdrlen, "%s%d:%s:%u\n", VOLUME_MAGIC,
+		VOLUME_VERSION, hexid, n));
+}
+
+static bool
+asignify_volume_write(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, buf, len);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (false);
+		}
+
+		buf += r;
+		len -= r;
+	}
+
+	return (true);
+}
+
+static bool
+asignify_volume_pwrite(int fd, const unsigned char *buf, size_t len, off_t off)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = pwrite(fd, buf, len, off);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (false);
+		}
+
+		buf += r;
+		len -= r;
+		off += r;
+	}
+
+	return (true);
+}
+
+static bool
+asignify_volume_pread(int fd, unsigned char *buf, size_t len, off_t off)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = pread(fd, buf, len, off);
+
+		if (r == -1 && errno == EINTR) {
+			continue;
+		}
+		else if (r <= 0) {
+			return (false);
+		}
+
+		buf += r;
+		len -= r;
+		off += r;
+	}
+
+	return (true);
+}
+
+/*
+ * Encrypts one input range to its volume file
+ */
+static enum asignify_error
+asignify_volume_crypt(struct asignify_volume_set *s, unsigned int n,
+	const char *path, unsigned char *in, unsigned char *out)
+{
+	struct asignify_volume *v = &s->vols[n - 1];
+	const chacha_iv iv = {{0}};
+	chacha_state st;
+	blake2b_state sh;
+	char hdr[VOLUME_HDR_MAX];
+	uint64_t done = 0;
+	size_t len, clen;
+	enum asignify_error err = ASIGNIFY_ERROR_OK;
+	int fd, l;
+
+	if ((fd = xopen(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+		return (ASIGNIFY_ERROR_FILE);
+	}
+
+	l = asignify_volume_header(s, n, hdr, sizeof(hdr));
+	blake2b_init_key(&sh, VOLUME_MAC_LEN, v->mac_key, sizeof(v->mac_key));
+	blake2b_update(&sh, (const unsigned char *)hdr, l);
+	/* Key is used for this volume only, so zero nonce is fine */
+	chacha_init(&st, (chacha_key *)v->key, &iv, s->rounds);
+
+	if (!asignify_volume_write(fd, (const unsigned char *)hdr, l)) {
+		err = ASIGNIFY_ERROR_FILE;
+	}
+
+	while (err == ASIGNIFY_ERROR_OK && done < v->len) {
+		if (asignify_cancel_check(s->cancel)) {
+			err = ASIGNIFY_ERROR_CANCELLED;
+			break;
+		}
+
+		len = v->len - done > VOLUME_BUF_SIZE ? VOLUME_BUF_SIZE : v->len - done;
+
+		if (!asignify_volume_pread(s->fd, in, len, v->off + done)) {
+			err = ASIGNIFY_ERROR_FILE;
+			break;
+		}
+
+		clen = chacha_update(&st, in, out, len);
+
+		if (done + len == v->len) {
+			clen += chacha_final(&st, out + clen);
+		}
+
+		blake2b_update(&sh, out, clen);
+
+		if (!asignify_volume_write(fd, out, clen)) {
+			err = ASIGNIFY_ERROR_FILE;
+		}
+
+		done += len;
+	}
+
+	if (close(fd) == -1 && err == ASIGNIFY_ERROR_OK) {
+		err = ASIGNIFY_ERROR_FILE;
+	}
+
+	blake2b_final(&sh, v->mac, VOLUME_MAC_LEN);
+	explicit_memzero(&st, sizeof(st));
+
+	return (err);
+}
+
+/*
+ * Authenticates and decrypts one volume file to its range of the output,
+ * the volume number is taken from its header
+ */
+static enum asignify_error
+asignify_volume_decrypt(struct asignify_volume_set *s, const char *path,
+	unsigned char *in, unsigned char *out)
+{
+	struct asignify_volume *v;
+	const chacha_iv iv = {{0}};
+	chacha_state st;
+	blake2b_state sh;
+	struct stat sb;
+	char hdr[VOLUME_HDR_MAX], prefix[VOLUME_HDR_MAX], *errstr;
+	unsigned char mac[VOLUME_MAC_LEN];
+	unsigned long n;
+	uint64_t done = 0, produced = 0;
+	size_t len, clen, hlen;
+	ssize_t r;
+	enum asignify_error err = ASIGNIFY_ERROR_OK;
+	int fd, l;
+
+	if ((fd = xopen(path, O_RDONLY, 0)) == -1) {
+		return (ASIGNIFY_ERROR_FILE);
+	}
+
+	while ((r = pread(fd, hdr, sizeof(hdr) - 1, 0)) == -1 && errno == EINTR);
+
+	if (r <= 0 || fstat(fd, &sb) == -1) {
+		close(fd);
+		return (ASIGNIFY_ERROR_FILE);
+	}
+
+	hdr[r] = '\0';
+	l = asignify_volume_header(s, 0, prefix, sizeof(prefix));
+
+	/* Volumes of other sets are rejected before their MACs are computed */
+	if (r <= l || memcmp(hdr, prefix, l) != 0) {
+		close(fd);
+		return (ASIGNIFY_ERROR_VERIFY);
+	}
+
+	errno = 0;
+	n = strtoul(hdr + l, &errstr, 10);
+
+	if (*errstr != '\n' || errno != 0 || n == 0 || n > s->nvols) {
+		close(fd);
+		return (ASIGNIFY_ERROR_FORMAT);
+	}
+
+	hlen = errstr - hdr + 1;
+
+	v = &s->vols[n - 1];
+
+	if (sb.st_size != hlen + v->len) {
+		close(fd);
+		return (ASIGNIFY_ERROR_VERIFY_SIZE);
+	}
+
+	asignify_volume_lock(s);
+	if (v->claimed) {
+		/* The same volume is specified twice */
+		err = ASIGNIFY_ERROR_MISUSE;
+	}
+	v->claimed = true;
+	asignify_volume_unlock(s);
+
+	if (err != ASIGNIFY_ERROR_OK) {
+		close(fd);
+		return (err);
+	}
+
+	blake2b_init_key(&sh, VOLUME_MAC_LEN, v->mac_key, sizeof(v->mac_key));
+	blake2b_update(&sh, (const unsigned char *)hdr, hlen);
+	chacha_init(&st, (chacha_key *)v->key, &iv, s->rounds);
+
+	/* Output is a temporary file that is discarded unless all MACs match */
+	while (done < v->len) {
+		if (asignify_cancel_check(s->cancel)) {
+			err = ASIGNIFY_ERROR_CANCELLED;
+			break;
+		}
+
+		len = v->len - done > VOLUME_BUF_SIZE ? VOLUME_BUF_SIZE : v->len - done;
+
+		if (!asignify_volume_pread(fd, in, len, hlen + done)) {
+			err = ASIGNIFY_ERROR_FILE;
+			break;
+		}
+
+		blake2b_update(&sh, in, len);
+		clen = chacha_update(&st, in, out, len);
+
+		if (done + len == v->len) {
+			clen += chacha_final(&st, out + clen);
+		}
+
+		/* Chacha may lag behind the input by less than a block */
+		if (!asignify_volume_pwrite(s->fd, out, clen, v->off + produced)) {
+			err = ASIGNIFY_ERROR_FILE;
+			break;
+		}
+
+		done += len;
+		produced += clen;
+	}
+
+	close(fd);
+	blake2b_final(&sh, mac, sizeof(mac));
+	explicit_memzero(&st, sizeof(st));
+
+	if (err == ASIGNIFY_ERROR_OK && crypto_verify_32(mac, v->mac) != 0) {
+		err = ASIGNIFY_ERROR_VERIFY;
+	}
+
+	return (err);
+}
+
+static void *
+asignify_volume_worker(void *ud)
+{
+	struct asignify_volume_set *s = ud;
+	unsigned char *in, *out;
+	unsigned int i, total;
+	enum asignify_error err;
+
+	in = xmalloc_aligned(64, VOLUME_BUF_SIZE);
+	out = xmalloc_aligned(64, VOLUME_BUF_SIZE + 64);
+	total = s->decrypt ? s->npaths : s->nvols;
+
+	for (;;) {
+		asignify_volume_lock(s);
+		if (s->err != ASIGNIFY_ERROR_OK || s->next >= total) {
+			asignify_volume_unlock(s);
+			break;
+		}
+		i = s->next ++;
+		asignify_volume_unlock(s);
+
+		if (s->decrypt) {
+			err = asignify_volume_decrypt(s, s->paths[i], in, out);
+		}
+		else {
+			err = asignify_volume_crypt(s, i + 1, s->paths[i], in, out);
+		}
+
+		if (err != ASIGNIFY_ERROR_OK) {
+			asignify_volume_fail(s, err);
+		}
+	}
+
+	explicit_memzero(in, VOLUME_BUF_SIZE);
+	explicit_memzero(out, VOLUME_BUF_SIZE + 64);
+	free(in);
+	free(out);
+
+	return (NULL);
+}
+
+/*
+ * Processes volumes by up to nthreads workers, the caller is one of them
+ */
+static enum asignify_error
+asignify_volume_run(struct asignify_volume_set *s, unsigned int nthreads)
+{
+#ifdef HAVE_PTHREAD
+	pthread_t *thrs = NULL;
+	unsigned int i, started = 0;
+
+	pthread_mutex_init(&s->mtx, NULL);
+
+	if (nthreads > s->nvols) {
+		nthreads = s->nvols;
+	}
+
+	if (nthreads > 1) {
+		thrs = xmalloc0(sizeof(*thrs) * (nthreads - 1));
+
+		for (i = 0; i < nthreads - 1; i ++) {
+			if (pthread_create(&thrs[i], NULL, asignify_volume_worker, s) != 0) {
+				break;
+			}
+		}
+
+		started = i;
+	}
+#endif
+
+	asignify_volume_worker(s);
+
+#ifdef HAVE_PTHREAD
+	for (i = 0; i < started; i ++) {
+		pthread_join(thrs[i], NULL);
+	}
+
+	free(thrs);
+	pthread_mutex_destroy(&s->mtx);
+#endif
+
+	return (s->err);
+}
+
+static char *
+asignify_volume_path(const char *indexf, unsigned int n)
+{
+	char *path;
+
+	path = xmalloc(strlen(indexf) + sizeof(".65536"));
+	sprintf(path, "%s.%u", indexf, n);
+
+	return (path);
+}
+
+static void
+asignify_volume_set_free(struct asignify_volume_set *s)
+{
+	unsigned int i;
+
+	if (s->vols != NULL) {
+		explicit_memzero(s->vols, sizeof(*s->vols) * s->nvols);
+		free(s->vols);
+	}
+
+	if (s->paths != NULL) {
+		for (i = 0; i < s->npaths; i ++) {
+			free(s->paths[i]);
+		}
+		free(s->paths);
+	}
+}
+
+bool
+asignify_encrypt_crypt_volumes(asignify_encrypt_t *ctx, unsigned int version,
+	const char *inf, const char *indexf, unsigned int nvolumes,
+	enum asignify_encrypt_type type)
+{
+	struct asignify_volume_set s;
+	struct asignify_volume *v;
+	struct stat st;
+	kvec_t(char) index;
+	unsigned char shared[crypto_box_BEFORENMBYTES];
+	char line[512], hexid[VOLUME_SET_ID_LEN * 2 + 1],
+		hexkey[VOLUME_KEY_LEN * 4 + 1], hexmac[VOLUME_MAC_LEN * 2 + 1];
+	unsigned char keys[VOLUME_KEY_LEN * 2];
+	uint64_t per, off = 0;
+	enum asignify_error err;
+	unsigned int i;
+	bool ret = false;
+	FILE *out;
+	int l;
+
+	if (ctx == NULL || inf == NULL || indexf == NULL || version != 1 ||
+			nvolumes == 0 || nvolumes > VOLUME_MAX) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if (type == ASIGNIFY_ENCRYPT_AESGCM) {
+		/* Volumes are always encrypted by chacha */
+		ctx->error = xerr_string(ASIGNIFY_ERROR_CIPHER);
+		return (false);
+	}
+
+	/* Check keys before any volume is written */
+	if (!asignify_encrypt_shared_key(ctx, shared)) {
+		return (false);
+	}
+
+	explicit_memzero(shared, sizeof(shared));
+
+	memset(&s, 0, sizeof(s));
+
+	/* Volumes read their ranges independently, so input must be seekable */
+	if ((s.fd = xopen(inf, O_RDONLY, 0)) == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	if (fstat(s.fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		close(s.fd);
+		return (false);
+	}
+
+	/* Do not produce empty volumes */
+	if (nvolumes > st.st_size) {
+		nvolumes = st.st_size > 0 ? st.st_size : 1;
+	}
+
+	s.cancel = ctx->cancel;
+	s.rounds = asignify_encrypt_rounds(type);
+	s.nvols = nvolumes;
+	s.npaths = nvolumes;
+	s.vols = xmalloc0(sizeof(*s.vols) * nvolumes);
+	s.paths = xmalloc0(sizeof(*s.paths) * nvolumes);
+	randombytes(s.id, sizeof(s.id));
+	per = (st.st_size + nvolumes - 1) / nvolumes;
+
+	for (i = 0; i < nvolumes; i ++) {
+		v = &s.vols[i];
+		v->off = off;
+		v->len = st.st_size - off > per ? per : st.st_size - off;
+		off += v->len;
+		randombytes(v->key, sizeof(v->key));
+		randombytes(v->mac_key, sizeof(v->mac_key));
+		s.paths[i] = asignify_volume_path(indexf, i + 1);
+	}
+
+	err = asignify_volume_run(&s, ctx->nthreads);
+	close(s.fd);
+
+	if (err != ASIGNIFY_ERROR_OK) {
+		ctx->error = xerr_string(err);
+		goto cleanup;
+	}
+
+	kv_init(index);
+	bin2hex(hexid, sizeof(hexid), s.id, sizeof(s.id));
+	l = snprintf(line, sizeof(line), "%s%d:%d:%s:%u:%" PRIu64 "\n",
+		VOLUME_INDEX_MAGIC, VOLUME_VERSION, s.rounds, hexid, s.nvols,
+		(uint64_t)st.st_size);
+	kv_push_a(char, index, line, l);
+
+	/* Each line: <n> <offset> <size> <key><mac key> <mac> */
+	for (i = 0; i < s.nvols; i ++) {
+		v = &s.vols[i];
+		memcpy(keys, v->key, VOLUME_KEY_LEN);
+		memcpy(keys + VOLUME_KEY_LEN, v->mac_key, VOLUME_KEY_LEN);
+		bin2hex(hexkey, sizeof(hexkey), keys, sizeof(keys));
+		bin2hex(hexmac, sizeof(hexmac), v->mac, sizeof(v->mac));
+		l = snprintf(line, sizeof(line), "%u %" PRIu64 " %" PRIu64 " %s %s\n",
+			i + 1, v->off, v->len, hexkey, hexmac);
+		kv_push_a(char, index, line, l);
+	}
+
+	explicit_memzero(keys, sizeof(keys));
+	explicit_memzero(hexkey, sizeof(hexkey));
+	explicit_memzero(line, sizeof(line));
+
+	out = xfopen(indexf, "w");
+
+	if (out == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+	}
+	else {
+		ret = asignify_encrypt_seal_buf(ctx, type, ASIGNIFY_SEAL_VOLUMES,
+			(const unsigned char *)index.a, kv_size(index), out);
+
+		if (fclose(out) != 0 && ret) {
+			ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+			ret = false;
+		}
+	}
+
+	explicit_memzero(index.a, kv_size(index));
+	kv_destroy(index);
+
+cleanup:
+	if (!ret) {
+		for (i = 0; i < s.npaths; i ++) {
+			unlink(s.paths[i]);
+		}
+	}
+
+	asignify_volume_set_free(&s);
+
+	return (ret);
+}
+
+/*
+ * Parses the decrypted index to the volume set
+ */
+static bool
+asignify_volume_index_parse(struct asignify_volume_set *s, const char *p,
+	const char *end)
+{
+	struct asignify_volume *v;
+	const char *nl;
+	char *errstr;
+	unsigned long version, n;
+	uint64_t size, off = 0;
+	unsigned int i;
+
+	if (end - p <= sizeof(VOLUME_INDEX_MAGIC) - 1 ||
+			memcmp(p, VOLUME_INDEX_MAGIC, sizeof(VOLUME_INDEX_MAGIC) - 1) != 0 ||
+			(nl = memchr(p, '\n', end - p)) == NULL) {
+		return (false);
+	}
+
+	/* Header: magic, version, chacha rounds, set id, volumes and size */
+	p += sizeof(VOLUME_INDEX_MAGIC) - 1;
+	version = strtoul(p, &errstr, 10);
+
+	if (*errstr != ':' || version != VOLUME_VERSION) {
+		return (false);
+	}
+
+	s->rounds = strtoul(errstr + 1, &errstr, 10);
+
+	if (*errstr != ':' ||
+			(s->rounds != asignify_encrypt_rounds(ASIGNIFY_ENCRYPT_SAFE) &&
+			s->rounds != asignify_encrypt_rounds(ASIGNIFY_ENCRYPT_FAST))) {
+		return (false);
+	}
+
+	p = errstr + 1;
+
+	if (nl - p < VOLUME_SET_ID_LEN * 2 + 1 || p[VOLUME_SET_ID_LEN * 2] != ':' ||
+			hex2bin(s->id, sizeof(s->id), p, VOLUME_SET_ID_LEN * 2,
+			NULL, NULL) != 0) {
+		return (false);
+	}
+
+	errno = 0;
+	n = strtoul(p + VOLUME_SET_ID_LEN * 2 + 1, &errstr, 10);
+
+	if (*errstr != ':' || n == 0 || n > VOLUME_MAX) {
+		return (false);
+	}
+
+	size = strtoumax(errstr + 1, &errstr, 10);
+
+	if (errstr != nl || errno != 0) {
+		return (false);
+	}
+
+	s->nvols = n;
+	s->vols = xmalloc0(sizeof(*s->vols) * n);
+	p = nl + 1;
+
+	/* Volumes are listed in order and cover the whole output */
+	for (i = 0; i < s->nvols; i ++) {
+		v = &s->vols[i];
+
+		if (p >= end || (nl = memchr(p, '\n', end - p)) == NULL) {
+			return (false);
+		}
+
+		errno = 0;
+		n = strtoul(p, &errstr, 10);
+
+		if (*errstr != ' ' || n != i + 1) {
+			return (false);
+		}
+
+		v->off = strtoumax(errstr + 1, &errstr, 10);
+
+		if (*errstr != ' ' || v->off != off) {
+			return (false);
+		}
+
+		v->len = strtoumax(errstr + 1, &errstr, 10);
+
+		if (*errstr != ' ' || errno != 0 || v->len > size - off) {
+			return (false);
+		}
+
+		p = errstr + 1;
+
+		if (nl - p != VOLUME_KEY_LEN * 4 + 1 + VOLUME_MAC_LEN * 2 ||
+				p[VOLUME_KEY_LEN * 4] != ' ' ||
+				hex2bin(v->key, sizeof(v->key), p, VOLUME_KEY_LEN * 2,
+					NULL, NULL) != 0 ||
+				hex2bin(v->mac_key, sizeof(v->mac_key), p + VOLUME_KEY_LEN * 2,
+					VOLUME_KEY_LEN * 2, NULL, NULL) != 0 ||
+				hex2bin(v->mac, sizeof(v->mac), p + VOLUME_KEY_LEN * 4 + 1,
+					VOLUME_MAC_LEN * 2, NULL, NULL) != 0) {
+			return (false);
+		}
+
+		off += v->len;
+		p = nl + 1;
+	}
+
+	return (p == end && off == size);
+}
+
+bool
+asignify_encrypt_decrypt_volumes(asignify_encrypt_t *ctx, const char *indexf,
+	const char **volumes, unsigned int nvolumes, const char *outf)
+{
+	struct asignify_volume_set s;
+	unsigned char *data, *index;
+	size_t dlen, ilen;
+	enum asignify_error err;
+	unsigned int i;
+	char *tmp;
+	bool ret = false;
+	int fd;
+
+	if (ctx == NULL || indexf == NULL || outf == NULL ||
+			(volumes == NULL && nvolumes > 0) || strcmp(outf, "-") == 0) {
+		CTX_MAYBE_SET_ERR(ctx, ASIGNIFY_ERROR_MISUSE);
+		return (false);
+	}
+
+	if ((fd = xopen(indexf, O_RDONLY, 0)) == -1) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	data = xread_fd(fd, VOLUME_INDEX_MAX_SIZE, &dlen);
+	close(fd);
+
+	if (data == NULL) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FILE);
+		return (false);
+	}
+
+	index = asignify_encrypt_open_buf(ctx, ASIGNIFY_SEAL_VOLUMES, data, dlen,
+		&ilen);
+	free(data);
+
+	if (index == NULL) {
+		return (false);
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.decrypt = true;
+	s.cancel = ctx->cancel;
+
+	if (!asignify_volume_index_parse(&s, (const char *)index,
+			(const char *)index + ilen)) {
+		ctx->error = xerr_string(ASIGNIFY_ERROR_FORMAT);
+		goto cleanup;
+	}
+
+	/* Volumes are named after the index unless they are specified */
+	if (nvolumes == 0) {
+		s.npaths = s.nvols;
+		s.paths = xmalloc0(sizeof(*s.paths) * s.npaths);
+
+		for (i = 0; i < s.npaths; i ++) {
+			s.paths[i] = asignify_volume_path(indexf, i + 1);
+		}
+	}
+	else {
+		s.npaths = nvolumes;
+		s.paths = xmalloc0(sizeof(*s.paths) * s.npaths);
+
+		for (i = 0; i < s.npaths; i ++) {
+			s.paths[i] = xstrdup(volumes[i]);
+		}
+	}
+
+	if ((s.fd = asignify_encrypt_tmp_open(ctx, outf, &tmp)) == -1) {
+		goto cleanup;
+	}
+
+	if (ftruncate(s.fd, s.vols[s.nvols - 1].off + s.vols[s.nvols - 1].len) == -1) {
+		err = ASIGNIFY_ERROR_FILE;
+	}
+	else {
+		err = asignify_volume_run(&s, ctx->nthreads);
+	}
+
+	for (i = 0; i < s.nvols && err == ASIGNIFY_ERROR_OK; i ++) {
+		if (!s.vols[i].claimed) {
+			/* Missing volume */
+			err = ASIGNIFY_ERROR_FILE;
+		}
+	}
+
+	if (err != ASIGNIFY_ERROR_OK) {
+		ctx->error = xerr_string(err);
+	}
+
+	ret = asignify_encrypt_tmp_close(ctx, s.fd, tmp, outf,
+		err == ASIGNIFY_ERROR_OK);
+
+cleanup:
+	explicit_memzero(index, ilen);
+	free(index);
+	asignify_volume_set_free(&s);
+
+	return (ret);
+}
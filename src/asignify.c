@@ -47,14 +47,26 @@ usage(const char *error)
 		fprintf(stderr, "%s\n", error);
 
 	fprintf(stderr, "usage:"
-	    "\tasignify [-q] %s\n"
+	    "\tasignify [-q] [--io-depth=N] [--io-block=SIZE] [--io-direct] <command>\n"
 	    "\tasignify [-q] %s\n"
 	    "\tasignify [-q] %s\n"
 	    "\tasignify [-q] %s\n"
 	    "\tasignify [-q] %s\n",
 	    cli_verify_help(false), cli_check_help(false),
-	    cli_sign_help(false), cli_generate_help(false),
-	    cli_encrypt_help(false));
+	    cli_log_verify_help(false), cli_delta_apply_help(false));
+#ifndef ASIGNIFY_VERIFY_ONLY
+	fprintf(stderr,
+	    "\tasignify [-q] %s\n"
+	    "\tasignify [-q] %s\n"
+	    "\tasignify [-q] %s\n"
+	    "\tasignify [-q] %s\n"
+	    "\tasignify [-q] %s\n"
+	    "\tasignify [-q] %s\n"
+	    "\tasignify [-q] %s\n",
+	    cli_sign_help(false), cli_digest_help(false), cli_generate_help(false),
+	    cli_encrypt_help(false), cli_verify_encrypted_help(false),
+	    cli_log_sign_help(false), cli_delta_sign_help(false));
+#endif
 
 	exit(EXIT_FAILURE);
 }
@@ -81,9 +93,19 @@ void help(bool failed, int argc, char **argv)
 		else if (strcasecmp(argv[0], "verify") == 0) {
 			ret = cli_verify_help(true);
 		}
+		else if (strcasecmp(argv[0], "log-verify") == 0) {
+			ret = cli_log_verify_help(true);
+		}
+		else if (strcasecmp(argv[0], "delta-apply") == 0) {
+			ret = cli_delta_apply_help(true);
+		}
+#ifndef ASIGNIFY_VERIFY_ONLY
 		else if (strcasecmp(argv[0], "sign") == 0) {
 			ret = cli_sign_help(true);
 		}
+		else if (strcasecmp(argv[0], "digest") == 0) {
+			ret = cli_digest_help(true);
+		}
 		else if (strcasecmp(argv[0], "generate") == 0) {
 			ret = cli_generate_help(true);
 		}
@@ -91,6 +113,16 @@ void help(bool failed, int argc, char **argv)
 					strcasecmp(argv[0], "decrypt") == 0) {
 			ret = cli_encrypt_help(true);
 		}
+		else if (strcasecmp(argv[0], "verify-encrypted") == 0) {
+			ret = cli_verify_encrypted_help(true);
+		}
+		else if (strcasecmp(argv[0], "log-sign") == 0) {
+			ret = cli_log_sign_help(true);
+		}
+		else if (strcasecmp(argv[0], "delta-sign") == 0) {
+			ret = cli_delta_sign_help(true);
+		}
+#endif
 		else {
 			usage("unknown command");
 		}
@@ -109,6 +141,55 @@ void help(bool failed, int argc, char **argv)
 
 }
 
+size_t
+parse_size(const char *str)
+{
+	char *end;
+	unsigned long long res;
+
+	res = strtoull(str, &end, 10);
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		res *= 1024;
+		end ++;
+		break;
+	case 'm':
+	case 'M':
+		res *= 1024 * 1024;
+		end ++;
+		break;
+	default:
+		break;
+	}
+
+	if (*end != '\0' || res == 0) {
+		usage("bad size value");
+	}
+
+	return (res);
+}
+
+static unsigned int
+parse_depth(const char *str)
+{
+	char *end;
+	unsigned long res;
+
+	if (*str < '0' || *str > '9') {
+		usage("bad io depth value");
+	}
+
+	res = strtoul(str, &end, 10);
+
+	if (*end != '\0' || res == 0 || res > ASIGNIFY_IO_MAX_DEPTH) {
+		usage("bad io depth value");
+	}
+
+	return (res);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -117,10 +198,15 @@ main(int argc, char **argv)
 		{"quiet",   no_argument,       0,  'q' },
 		{"help", 	no_argument,       0,  'h' },
 		{"version",	no_argument,       0,  'v' },
+		{"io-depth", required_argument, 0, 'D' },
+		{"io-block", required_argument, 0, 'B' },
+		{"io-direct", no_argument,     0, 'O' },
 		{0,         0,                 0,  0 }
 	};
 	char **our_argv;
 	int our_argc;
+	unsigned int io_depth = 0;
+	size_t io_block = 0;
 
 	/*
 	 * Workaround to fix lack of brain of glibc authors:
@@ -148,6 +234,15 @@ main(int argc, char **argv)
 		case 'v':
 			version();
 			break;
+		case 'D':
+			io_depth = parse_depth(optarg);
+			break;
+		case 'B':
+			io_block = parse_size(optarg);
+			break;
+		case 'O':
+			asignify_set_io_direct(true);
+			break;
 		case 'h':
 		default:
 			usage(NULL);
@@ -157,6 +252,10 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	if (io_depth > 0 || io_block > 0) {
+		asignify_set_io_params(io_depth, io_block);
+	}
+
 	/* Read command as the next argument */
 	if (argc == 0) {
 		usage("must specify at least one command");
@@ -176,9 +275,19 @@ main(int argc, char **argv)
 	else if (strcasecmp(argv[0], "verify") == 0) {
 		ret = cli_verify(argc, argv);
 	}
+	else if (strcasecmp(argv[0], "log-verify") == 0) {
+		ret = cli_log_verify(argc, argv);
+	}
+	else if (strcasecmp(argv[0], "delta-apply") == 0) {
+		ret = cli_delta_apply(argc, argv);
+	}
+#ifndef ASIGNIFY_VERIFY_ONLY
 	else if (strcasecmp(argv[0], "sign") == 0) {
 		ret = cli_sign(argc, argv);
 	}
+	else if (strcasecmp(argv[0], "digest") == 0) {
+		ret = cli_digest(argc, argv);
+	}
 	else if (strcasecmp(argv[0], "generate") == 0) {
 		ret = cli_generate(argc, argv);
 	}
@@ -186,6 +295,16 @@ main(int argc, char **argv)
 					strcasecmp(argv[0], "decrypt") == 0) {
 		ret = cli_encrypt(argc, argv);
 	}
+	else if (strcasecmp(argv[0], "verify-encrypted") == 0) {
+		ret = cli_verify_encrypted(argc, argv);
+	}
+	else if (strcasecmp(argv[0], "log-sign") == 0) {
+		ret = cli_log_sign(argc, argv);
+	}
+	else if (strcasecmp(argv[0], "delta-sign") == 0) {
+		ret = cli_delta_sign(argc, argv);
+	}
+#endif
 	else if (strcasecmp(argv[0], "help") == 0) {
 		help(false, argc - 1, argv + 1);
 	} else {
@@ -29,6 +29,9 @@
 
 extern int quiet;
 
+/* Parses size with optional k/m suffix, exits on error */
+size_t parse_size(const char *str);
+
 const char * cli_verify_help(bool full);
 int cli_verify(int argc, char **argv);
 
@@ -38,10 +41,28 @@ int cli_check(int argc, char **argv);
 const char * cli_sign_help(bool full);
 int cli_sign(int argc, char **argv);
 
+const char * cli_digest_help(bool full);
+int cli_digest(int argc, char **argv);
+
 const char * cli_generate_help(bool full);
 int cli_generate(int argc, char **argv);
 
 const char * cli_encrypt_help(bool full);
 int cli_encrypt(int argc, char **argv);
 
+const char * cli_verify_encrypted_help(bool full);
+int cli_verify_encrypted(int argc, char **argv);
+
+const char * cli_log_sign_help(bool full);
+int cli_log_sign(int argc, char **argv);
+
+const char * cli_log_verify_help(bool full);
+int cli_log_verify(int argc, char **argv);
+
+const char * cli_delta_sign_help(bool full);
+int cli_delta_sign(int argc, char **argv);
+
+const char * cli_delta_apply_help(bool full);
+int cli_delta_apply(int argc, char **argv);
+
 #endif /* CLI_H_ */
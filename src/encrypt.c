@@ -69,16 +69,29 @@ cli_encrypt_help(bool full)
 
 	const char *fullmsg = ""
 		"asignify [global_opts] encrypt/decrypt - encrypt or decrypt a file\n\n"
-		"Usage: asignify encrypt [-d] <secretkey> <pubkey> <in> <out>\n"
+		"Usage: asignify encrypt [-d] [-f] [-a <cipher>] [-j <threads>] [-c <dir>] [-n <volumes>] <secretkey> <pubkey> <in> <out> [volume...]\n"
 		"\t-d            Perform decryption\n"
 		"\t-f            Use less safe but faster encryption (chacha8)\n"
+		"\t-a            Cipher: chacha20 (default), chacha8, aes-gcm or auto\n"
+		"\t              (aes-gcm if CPU supports it, chacha20 otherwise)\n"
+		"\t-j            Number of threads for regular files (0 for all CPUs)\n"
+		"\t-c            Chunked mode: store deduplicated encrypted chunks in\n"
+		"\t              the specified directory, out (or in for decryption)\n"
+		"\t              is the encrypted chunks index\n"
+		"\t-n            Volumes mode: split into the specified number of\n"
+		"\t              independently authenticated volumes out.1 ... out.N\n"
+		"\t              encrypted in parallel (all CPUs unless -j is set),\n"
+		"\t              out is the encrypted volumes index; decryption\n"
+		"\t              recognizes the index given as in without -n and\n"
+		"\t              reads the number from it, volumes in any order\n"
+		"\t              may follow out\n"
 		"\tsecretkey     Path to a secret key file encrypt and sign\n"
 		"\tpubkey        Path to a peer's public key (must not be related to secretkey)\n"
 		"\tin            Path to input file\n"
 		"\tout           Path to ouptut file (must be a regular file)\n";
 
 	if (!full) {
-		return ("encrypt [-d] [-f] <secretkey> <pubkey> <in> <out>");
+		return ("encrypt [-d] [-f] [-a cipher] [-j threads] [-c dir] [-n volumes] <secretkey> <pubkey> <in> <out> [volume...]");
 	}
 
 	return (fullmsg);
@@ -89,13 +102,19 @@ cli_encrypt(int argc, char **argv)
 {
 	asignify_encrypt_t *enc;
 	const char *seckeyfile = NULL, *pubkeyfile = NULL,
-				*infile = NULL, *outfile = NULL;
+				*infile = NULL, *outfile = NULL, *chunkdir = NULL;
 	int ch;
-	bool decrypt = false;
+	unsigned int nthreads = 1, nvolumes = 0;
+	bool decrypt = false, auto_cipher = false, volumes = false,
+		threads_set = false;
 	enum asignify_encrypt_type type = ASIGNIFY_ENCRYPT_SAFE;
 	static struct option long_options[] = {
 		{"fast",   no_argument,     0,  'f' },
+		{"cipher",   required_argument,     0,  'a' },
+		{"chunks",   required_argument,     0,  'c' },
 		{"decrypt", 	required_argument, 0,  'd' },
+		{"threads", 	required_argument, 0,  'j' },
+		{"volumes", 	required_argument, 0,  'n' },
 		{0,         0,                 0,  0 }
 	};
 
@@ -103,7 +122,7 @@ cli_encrypt(int argc, char **argv)
 		decrypt = true;
 	}
 
-	while ((ch = getopt_long(argc, argv, "df", long_options, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "dfa:c:j:n:", long_options, NULL)) != -1) {
 		switch (ch) {
 		case 'd':
 			decrypt = true;
@@ -111,6 +130,35 @@ cli_encrypt(int argc, char **argv)
 		case 'f':
 			type = ASIGNIFY_ENCRYPT_FAST;
 			break;
+		case 'a':
+			if (strcmp(optarg, "chacha20") == 0) {
+				type = ASIGNIFY_ENCRYPT_SAFE;
+			}
+			else if (strcmp(optarg, "chacha8") == 0) {
+				type = ASIGNIFY_ENCRYPT_FAST;
+			}
+			else if (strcmp(optarg, "aes-gcm") == 0) {
+				type = ASIGNIFY_ENCRYPT_AESGCM;
+			}
+			else if (strcmp(optarg, "auto") == 0) {
+				auto_cipher = true;
+			}
+			else {
+				fprintf(stderr, "bad cipher: %s\n", optarg);
+				return (0);
+			}
+			break;
+		case 'c':
+			chunkdir = optarg;
+			break;
+		case 'j':
+			nthreads = strtoul(optarg, NULL, 10);
+			threads_set = true;
+			break;
+		case 'n':
+			nvolumes = strtoul(optarg, NULL, 10);
+			volumes = true;
+			break;
 		default:
 			return (0);
 			break;
@@ -119,10 +167,28 @@ cli_encrypt(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc < 4) {
+	/* Volume indexes are recognized by their header, so -n is not needed */
+	if (decrypt && chunkdir == NULL && argc >= 4 &&
+			asignify_encrypt_is_volume_index(argv[2])) {
+		volumes = true;
+	}
+
+	if (argc < 4 || (argc > 4 && !(volumes && decrypt)) ||
+			(volumes && chunkdir != NULL) ||
+			(volumes && !decrypt && nvolumes == 0)) {
 		return (0);
 	}
 
+	if (auto_cipher) {
+		/* Chunks and volumes are always encrypted by chacha */
+		type = (chunkdir != NULL || volumes) ?
+			ASIGNIFY_ENCRYPT_SAFE : asignify_encrypt_auto_type();
+	}
+
+	if (volumes && !threads_set) {
+		/* Volumes are independent, so use all CPUs by default */
+		nthreads = 0;
+	}
 
 	seckeyfile = argv[0];
 	pubkeyfile = argv[1];
@@ -130,6 +196,7 @@ cli_encrypt(int argc, char **argv)
 	outfile = argv[3];
 
 	enc = asignify_encrypt_init();
+	asignify_encrypt_set_threads(enc, nthreads);
 
 	if (!asignify_encrypt_load_privkey(enc, seckeyfile, read_password, NULL)) {
 		fprintf(stderr, "cannot load private key %s: %s\n", seckeyfile,
@@ -145,17 +212,36 @@ cli_encrypt(int argc, char **argv)
 		return (-1);
 	}
 
-	if (decrypt) {
-		if (!asignify_encrypt_decrypt_file(enc, infile, outfile)) {
+	if (decrypt && volumes) {
+		if (!asignify_encrypt_decrypt_volumes(enc, infile,
+				(const char **)argv + 4, argc - 4, outfile)) {
 			fprintf(stderr, "cannot decrypt file %s: %s\n", infile,
 				asignify_encrypt_get_error(enc));
-			unlink(outfile);
+			/* Output is not touched on errors */
+			asignify_encrypt_free(enc);
+			return (-1);
+		}
+	}
+	else if (decrypt) {
+		if (chunkdir != NULL ?
+				!asignify_encrypt_decrypt_chunked(enc, infile, chunkdir, outfile) :
+				!asignify_encrypt_decrypt_file(enc, infile, outfile)) {
+			fprintf(stderr, "cannot decrypt file %s: %s\n", infile,
+				asignify_encrypt_get_error(enc));
+			/* Parallel decryption does not touch output on errors */
+			if (chunkdir != NULL || nthreads == 1) {
+				unlink(outfile);
+			}
 			asignify_encrypt_free(enc);
 			return (-1);
 		}
 	}
 	else {
-		if (!asignify_encrypt_crypt_file(enc, 1, infile, outfile, type)) {
+		if (volumes ?
+				!asignify_encrypt_crypt_volumes(enc, 1, infile, outfile, nvolumes, type) :
+				chunkdir != NULL ?
+				!asignify_encrypt_crypt_chunked(enc, 1, infile, outfile, chunkdir, type) :
+				!asignify_encrypt_crypt_file(enc, 1, infile, outfile, type)) {
 			fprintf(stderr, "cannot encrypt file %s: %s\n", infile,
 				asignify_encrypt_get_error(enc));
 			unlink(outfile);
@@ -181,3 +267,57 @@ cli_encrypt(int argc, char **argv)
 
 	return (1);
 }
+
+const char *
+cli_verify_encrypted_help(bool full)
+{
+
+	const char *fullmsg = ""
+		"asignify [global_opts] verify-encrypted - check integrity of encrypted files\n\n"
+		"Usage: asignify verify-encrypted <pubkey> <file>...\n"
+		"\tpubkey        Path to the sender's public key\n"
+		"\tfile          Encrypted file (or chunks index) to check\n";
+
+	if (!full) {
+		return ("verify-encrypted <pubkey> <file> [file...]");
+	}
+
+	return (fullmsg);
+}
+
+int
+cli_verify_encrypted(int argc, char **argv)
+{
+	asignify_encrypt_t *enc;
+	const char *pubkeyfile;
+	int i, ret = 1;
+
+	if (argc < 3) {
+		return (0);
+	}
+
+	pubkeyfile = argv[1];
+	enc = asignify_encrypt_init();
+
+	if (!asignify_encrypt_load_pubkey(enc, pubkeyfile)) {
+		fprintf(stderr, "cannot load public key %s: %s\n", pubkeyfile,
+			asignify_encrypt_get_error(enc));
+		asignify_encrypt_free(enc);
+		return (-1);
+	}
+
+	for (i = 2; i < argc; i ++) {
+		if (!asignify_encrypt_verify_file(enc, argv[i])) {
+			fprintf(stderr, "verification failed for %s: %s\n", argv[i],
+				asignify_encrypt_get_error(enc));
+			ret = -1;
+		}
+		else if (!quiet) {
+			printf("encrypted file %s has been verified\n", argv[i]);
+		}
+	}
+
+	asignify_encrypt_free(enc);
+
+	return (ret);
+}
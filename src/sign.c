@@ -69,15 +69,45 @@ cli_sign_help(bool full)
 
 	const char *fullmsg = ""
 		"asignify [global_opts] sign - creates a signature\n\n"
-		"Usage: asignify sign [-n] [-d <digest>...] <secretkey> <signature> [file1 [file2...]]\n"
-		"\t-n            Do not record files sizes\n"
-		"\t-d            Write specific digest (sha256, sha512, blake2)\n"
-		"\tsecretkey     Path to a secret key file make a signature\n"
-		"\tsignature     Path to signature file to write\n"
-		"\tfile          A file that will be recorded in the signature digests\n";
+		"Usage: asignify sign [-n] [-S] [-d <digest>...] [--from-digests=<file>...] [--update=<oldsig>] <secretkey> <signature> [file1 [file2...]]\n"
+		"\t-n             Do not record files sizes\n"
+		"\t--mtime        Record files modification times to speed up --update\n"
+		"\t--update       Update an old signature: rehash only changed files (implies --mtime)\n"
+		"\t-d             Write specific digest (sha256, sha512, blake2)\n"
+		"\t-S             Sort digests by file names\n"
+		"\t--sort-memory  Memory used for sorting before spilling to disk (default: 64m)\n"
+		"\t--tmpdir       Directory for temporary files used by sorting\n"
+		"\t--from-digests Add digests from a file produced by `asignify digest` (implies -S)\n"
+		"\tsecretkey      Path to a secret key file make a signature\n"
+		"\tsignature      Path to signature file to write\n"
+		"\tfile           A file that will be recorded in the signature digests\n";
 
 	if (!full) {
-		return ("sign [-n] [-d <digest>] secretkey signature [file1 [file2...]]");
+		return ("sign [-n] [-S] [-d <digest>] [--from-digests=<file>] [--update=<oldsig>] secretkey signature [file1 [file2...]]");
+	}
+
+	return (fullmsg);
+}
+
+const char *
+cli_digest_help(bool full)
+{
+
+	const char *fullmsg = ""
+		"asignify [global_opts] digest - writes unsigned digests\n\n"
+		"Usage: asignify digest [-n] [-S] [-d <digest>...] [--from-digests=<file>...] <digests> [file1 [file2...]]\n"
+		"\t-n             Do not record files sizes\n"
+		"\t--mtime        Record files modification times\n"
+		"\t-d             Write specific digest (sha256, sha512, blake2)\n"
+		"\t-S             Sort digests by file names\n"
+		"\t--sort-memory  Memory used for sorting before spilling to disk (default: 64m)\n"
+		"\t--tmpdir       Directory for temporary files used by sorting\n"
+		"\t--from-digests Merge digests from another digests file (implies -S)\n"
+		"\tdigests        Path to digests file to write ('-' for stdout)\n"
+		"\tfile           A file that will be recorded in the digests\n";
+
+	if (!full) {
+		return ("digest [-n] [-S] [-d <digest>] [--from-digests=<file>] digests [file1 [file2...]]");
 	}
 
 	return (fullmsg);
@@ -88,30 +118,74 @@ struct digest_item {
 	struct digest_item *next;
 };
 
-int
-cli_sign(int argc, char **argv)
+struct digests_file_item {
+	const char *name;
+	struct digests_file_item *next;
+};
+
+/*
+ * Digests are calculated without a secret key by `digest` command (keyless
+ * is true), e.g. on build hosts, and signed later by `sign --from-digests`
+ */
+static int
+cli_sign_common(int argc, char **argv, bool keyless)
 {
 	asignify_sign_t *sgn;
 	const char *seckeyfile = NULL, *sigfile = NULL;
-	int i;
+	int i, nargs = keyless ? 1 : 2;
 	int ch;
 	int ret = 1;
 	int added = 0;
-	bool no_size = false;
-	/* XXX: we do not free this list on exit */
+	unsigned int types = 0;
+	bool no_size = false, sorted = false, mtime = false;
+	size_t sort_memory = 0;
+	const char *tmpdir = NULL, *update = NULL;
+	/* XXX: we do not free these lists on exit */
 	struct digest_item *dt_list = NULL, *dtit;
+	struct digests_file_item *df_list = NULL, *dfit;
 	enum asignify_digest_type dt;
 	static struct option long_options[] = {
 		{"no-size",   no_argument,     0,  'n' },
 		{"digest", 	required_argument, 0,  'd' },
+		{"sort",   no_argument,     0,  'S' },
+		{"sort-memory", required_argument, 0,  'M' },
+		{"tmpdir", required_argument, 0,  'T' },
+		{"from-digests", required_argument, 0,  'F' },
+		{"mtime",   no_argument,     0,  'm' },
+		{"update", required_argument, 0,  'U' },
 		{0,         0,                 0,  0 }
 	};
 
-	while ((ch = getopt_long(argc, argv, "nd:", long_options, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "nd:S", long_options, NULL)) != -1) {
 		switch (ch) {
 		case 'n':
 			no_size = true;
 			break;
+		case 'S':
+			sorted = true;
+			break;
+		case 'M':
+			sort_memory = parse_size(optarg);
+			break;
+		case 'T':
+			tmpdir = optarg;
+			break;
+		case 'm':
+			mtime = true;
+			break;
+		case 'U':
+			/* Hints are needed to update the new signature later */
+			mtime = true;
+			update = optarg;
+			break;
+		case 'F':
+			/* Merging requires sorting to find duplicates */
+			sorted = true;
+			dfit = malloc(sizeof(*dfit));
+			dfit->name = optarg;
+			dfit->next = df_list;
+			df_list = dfit;
+			break;
 		case 'd':
 			dt = asignify_digest_from_str(optarg, strlen(optarg));
 			if (dt == ASIGNIFY_DIGEST_MAX) {
@@ -131,7 +205,12 @@ cli_sign(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc < 2) {
+	if (argc < nargs) {
+		return (0);
+	}
+
+	if (keyless && update != NULL) {
+		fprintf(stderr, "cannot update digests without a secret key\n");
 		return (0);
 	}
 
@@ -141,22 +220,79 @@ cli_sign(int argc, char **argv)
 		dt_list->type = ASIGNIFY_DIGEST_BLAKE2;
 	}
 
-	seckeyfile = argv[0];
-	sigfile = argv[1];
+	if (!keyless) {
+		seckeyfile = argv[0];
+	}
+	sigfile = argv[nargs - 1];
 
 	sgn = asignify_sign_init();
 
-	if (!asignify_sign_load_privkey(sgn, seckeyfile, read_password, NULL)) {
+	if (sorted) {
+		asignify_sign_set_sorted(sgn, sort_memory, tmpdir);
+	}
+
+	if (!keyless && !asignify_sign_load_privkey(sgn, seckeyfile,
+			read_password, NULL)) {
 		fprintf(stderr, "cannot load private key %s: %s\n", seckeyfile,
 			asignify_sign_get_error(sgn));
 		asignify_sign_free(sgn);
 		return (-1);
 	}
 
-	for (i = 2; i < argc; i ++) {
+	if (update != NULL) {
+		if (!asignify_sign_load_update(sgn, update)) {
+			fprintf(stderr, "cannot load signature %s: %s\n", update,
+				asignify_sign_get_error(sgn));
+			asignify_sign_free(sgn);
+			return (-1);
+		}
+
+		if (!quiet) {
+			printf("updating signature %s\n", update);
+		}
+		added ++;
+	}
+
+	for (dfit = df_list; dfit != NULL; dfit = dfit->next) {
+		if (!asignify_sign_add_digests(sgn, dfit->name)) {
+			fprintf(stderr, "cannot load digests file %s: %s\n", dfit->name,
+				asignify_sign_get_error(sgn));
+			asignify_sign_free(sgn);
+			return (-1);
+		}
+
+		if (!quiet) {
+			printf("added digests from %s\n", dfit->name);
+		}
+		added ++;
+	}
+
+	/* All hash digests of a file are computed by a single read */
+	for (dtit = dt_list; dtit != NULL; dtit = dtit->next) {
+		if (dtit->type < ASIGNIFY_DIGEST_SIZE) {
+			types |= ASIGNIFY_DIGEST_BIT(dtit->type);
+		}
+	}
+
+	for (i = nargs; i < argc; i ++) {
+		if (types != 0 &&
+				!asignify_sign_add_file_digests(sgn, argv[i], types, 0, NULL)) {
+			fprintf(stderr, "cannot sign file %s: %s\n", argv[i],
+				asignify_sign_get_error(sgn));
+			ret = -1;
+			continue;
+		}
+
 		dtit = dt_list;
 		while(dtit != NULL) {
-			if (!asignify_sign_add_file(sgn, argv[i], dtit->type)) {
+			if (dtit->type < ASIGNIFY_DIGEST_SIZE) {
+				if (!quiet) {
+					printf("added %s digest of %s\n",
+							asignify_digest_name(dtit->type), argv[i]);
+				}
+				added ++;
+			}
+			else if (!asignify_sign_add_file(sgn, argv[i], dtit->type)) {
 				fprintf(stderr, "cannot sign file %s: %s\n", argv[i],
 					asignify_sign_get_error(sgn));
 				ret = -1;
@@ -177,6 +313,13 @@ cli_sign(int argc, char **argv)
 				ret = -1;
 			}
 		}
+		if (mtime) {
+			if (!asignify_sign_add_file(sgn, argv[i], ASIGNIFY_DIGEST_MTIME)) {
+				fprintf(stderr, "cannot get file mtime %s: %s\n", argv[i],
+					asignify_sign_get_error(sgn));
+				ret = -1;
+			}
+		}
 	}
 
 	if (added == 0) {
@@ -184,7 +327,15 @@ cli_sign(int argc, char **argv)
 		return (-1);
 	}
 
-	if (!asignify_sign_write_signature(sgn, sigfile)) {
+	if (keyless) {
+		if (!asignify_sign_write_digests(sgn, sigfile)) {
+			fprintf(stderr, "cannot write digests file %s: %s\n", sigfile,
+				asignify_sign_get_error(sgn));
+			asignify_sign_free(sgn);
+			return (-1);
+		}
+	}
+	else if (!asignify_sign_write_signature(sgn, sigfile)) {
 		fprintf(stderr, "cannot write sign file %s: %s\n", sigfile,
 			asignify_sign_get_error(sgn));
 		asignify_sign_free(sgn);
@@ -193,14 +344,177 @@ cli_sign(int argc, char **argv)
 
 	asignify_sign_free(sgn);
 
-	if (!quiet) {
+	if (!quiet && !(keyless && strcmp(sigfile, "-") == 0)) {
 		if (ret == 1) {
-			printf("Digests file %s has been successfully signed\n", sigfile);
+			printf("Digests file %s has been successfully %s\n", sigfile,
+				keyless ? "written" : "signed");
 		}
 		else {
-			printf("Digests file %s has been signed but some files were not added due to errors\n", sigfile);
+			printf("Digests file %s has been %s but some files were not added due to errors\n",
+				sigfile, keyless ? "written" : "signed");
 		}
 	}
 
 	return (ret);
 }
+
+int
+cli_sign(int argc, char **argv)
+{
+	return (cli_sign_common(argc, argv, false));
+}
+
+int
+cli_digest(int argc, char **argv)
+{
+	return (cli_sign_common(argc, argv, true));
+}
+
+const char *
+cli_log_sign_help(bool full)
+{
+
+	const char *fullmsg = ""
+		"asignify [global_opts] log-sign - signs a tree head of an append-only log\n\n"
+		"Usage: asignify log-sign [-r] [-s <size>] [--prev=<oldhead>] <secretkey> <head> <log>\n"
+		"\t-s             Segment size (default: 64k)\n"
+		"\t-r             Split log by records: segments end by a newline after segment size\n"
+		"\t--prev         Extend the previous head: only data appended since it is hashed\n"
+		"\tsecretkey      Path to a secret key file make a signature\n"
+		"\thead           Path to tree head file to write\n"
+		"\tlog            Log file to sign\n";
+
+	if (!full) {
+		return ("log-sign [-r] [-s size] [--prev=oldhead] secretkey head log");
+	}
+
+	return (fullmsg);
+}
+
+int
+cli_log_sign(int argc, char **argv)
+{
+	asignify_sign_t *sgn;
+	const char *seckeyfile, *headfile, *logfile, *prev = NULL;
+	size_t segment = 0;
+	bool records = false;
+	int ch;
+	static struct option long_options[] = {
+		{"segment", required_argument, 0,  's' },
+		{"records", no_argument,     0,  'r' },
+		{"prev", required_argument, 0,  'P' },
+		{0,         0,                 0,  0 }
+	};
+
+	while ((ch = getopt_long(argc, argv, "rs:", long_options, NULL)) != -1) {
+		switch (ch) {
+		case 's':
+			segment = parse_size(optarg);
+			break;
+		case 'r':
+			records = true;
+			break;
+		case 'P':
+			prev = optarg;
+			break;
+		default:
+			return (0);
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 3) {
+		return (0);
+	}
+
+	seckeyfile = argv[0];
+	headfile = argv[1];
+	logfile = argv[2];
+
+	sgn = asignify_sign_init();
+
+	if (!asignify_sign_load_privkey(sgn, seckeyfile, read_password, NULL)) {
+		fprintf(stderr, "cannot load private key %s: %s\n", seckeyfile,
+			asignify_sign_get_error(sgn));
+		asignify_sign_free(sgn);
+		return (-1);
+	}
+
+	if (!asignify_sign_log(sgn, logfile, headfile, prev, segment, records)) {
+		fprintf(stderr, "cannot sign log %s: %s\n", logfile,
+			asignify_sign_get_error(sgn));
+		asignify_sign_free(sgn);
+		return (-1);
+	}
+
+	asignify_sign_free(sgn);
+
+	if (!quiet) {
+		printf("Tree head of %s has been successfully signed to %s\n",
+			logfile, headfile);
+	}
+
+	return (1);
+}
+
+const char *
+cli_delta_sign_help(bool full)
+{
+
+	const char *fullmsg = ""
+		"asignify [global_opts] delta-sign - signs a delta between two signatures\n\n"
+		"Usage: asignify delta-sign <secretkey> <base> <target> <delta>\n"
+		"\tsecretkey      Path to a secret key file both signatures are made with\n"
+		"\tbase           Signature clients already have\n"
+		"\ttarget         New signature\n"
+		"\tdelta          Path to delta file to write\n";
+
+	if (!full) {
+		return ("delta-sign secretkey base target delta");
+	}
+
+	return (fullmsg);
+}
+
+int
+cli_delta_sign(int argc, char **argv)
+{
+	asignify_sign_t *sgn;
+	const char *seckeyfile, *basefile, *targetfile, *deltafile;
+
+	if (argc != 5) {
+		return (0);
+	}
+
+	seckeyfile = argv[1];
+	basefile = argv[2];
+	targetfile = argv[3];
+	deltafile = argv[4];
+
+	sgn = asignify_sign_init();
+
+	if (!asignify_sign_load_privkey(sgn, seckeyfile, read_password, NULL)) {
+		fprintf(stderr, "cannot load private key %s: %s\n", seckeyfile,
+			asignify_sign_get_error(sgn));
+		asignify_sign_free(sgn);
+		return (-1);
+	}
+
+	if (!asignify_sign_delta(sgn, basefile, targetfile, deltafile)) {
+		fprintf(stderr, "cannot sign delta from %s to %s: %s\n", basefile,
+			targetfile, asignify_sign_get_error(sgn));
+		asignify_sign_free(sgn);
+		return (-1);
+	}
+
+	asignify_sign_free(sgn);
+
+	if (!quiet) {
+		printf("Delta from %s to %s has been successfully signed to %s\n",
+			basefile, targetfile, deltafile);
+	}
+
+	return (1);
+}
@@ -27,6 +27,7 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <err.h>
@@ -34,61 +35,249 @@
 #include <string.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "asignify.h"
 #include "cli.h"
 
+#ifndef ASIGNIFY_VERIFY_ONLY
+#ifdef HAVE_READPASSPHRASE_H
+#include <readpassphrase.h>
+#elif defined(HAVE_BSD_READPASSPHRASE_H)
+#include <bsd/readpassphrase.h>
+#else
+#include "readpassphrase_compat.h"
+#endif
+#endif
+
+#define CLI_BUILTIN_PUBKEY "@builtin"
+
+#ifndef ASIGNIFY_VERIFY_ONLY
+static int
+read_password(char *buf, size_t len, void *d)
+{
+	char password[512];
+	int l;
+
+	if (readpassphrase("Password:", password, sizeof(password), 0) != NULL) {
+		l = strlen(password);
+		memcpy(buf, password, l);
+		explicit_memzero(password, sizeof(password));
+
+		return (l);
+	}
+
+	return (-1);
+}
+#endif
+
+static bool
+cli_load_pubkey(asignify_verify_t *vrf, const char *pubkeyfile)
+{
+	if (strcmp(pubkeyfile, CLI_BUILTIN_PUBKEY) == 0) {
+		return (asignify_verify_load_builtin_pubkeys(vrf));
+	}
+
+	return (asignify_verify_load_pubkey(vrf, pubkeyfile));
+}
+
+static bool
+cli_parse_limit(const char *str, unsigned int *res)
+{
+	char *end;
+	unsigned long v;
+
+	if (*str < '0' || *str > '9') {
+		return (false);
+	}
+
+	errno = 0;
+	v = strtoul(str, &end, 10);
+
+	if (*end != '\0' || errno != 0 || v > UINT_MAX) {
+		return (false);
+	}
+
+	*res = v;
+
+	return (true);
+}
+
 const char *
 cli_verify_help(bool full)
 {
 	const char *fullmsg = ""
-	"asignify [global_opts] verify - verifies signature\n\n"
-	"Usage: asignify verify <pubkey> <signature>\n"
+	"asignify [global_opts] verify - verifies signatures\n\n"
+	"Usage: asignify verify [-j <threads>] [-l <list>] [--max-memory=<size>]\n"
+	"\t<pubkey> [<signature>...]\n"
+	"\t-j            Number of threads for many signatures (0 for all CPUs, default)\n"
+	"\t-l            File listing signatures (one per line, '-' for stdin)\n"
+	"\t--max-memory  Do not load signatures larger than size (suffixes k and m are accepted)\n"
 	"\tpubkey        Path to a public key file to check signature against\n"
+	"\t              or @builtin to use compiled in trust anchors\n"
 	"\tsignature     Path to signature file to check\n";
 
 	if (!full) {
-		return ("verify pubkey signature");
+		return ("verify [-j threads] [-l list] [--max-memory=size] pubkey [signature...]");
 	}
 
 	return (fullmsg);
 }
 
+static void
+verify_add_signature(const char ***sigs, size_t *nsigs, size_t *sigs_sz,
+	const char *sig)
+{
+	if (*nsigs == *sigs_sz) {
+		*sigs_sz = *sigs_sz ? *sigs_sz * 2 : 64;
+		*sigs = realloc(*sigs, *sigs_sz * sizeof(**sigs));
+
+		if (*sigs == NULL) {
+			err(1, "realloc");
+		}
+	}
+
+	(*sigs)[(*nsigs) ++] = sig;
+}
+
+static bool
+verify_load_list(const char *list_file, const char ***sigs, size_t *nsigs,
+	size_t *sigs_sz)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t linelen = 0;
+	ssize_t r;
+
+	if (strcmp(list_file, "-") == 0) {
+		f = stdin;
+	}
+	else if ((f = fopen(list_file, "r")) == NULL) {
+		return (false);
+	}
+
+	while ((r = getline(&line, &linelen, f)) > 0) {
+		while (r > 0 && (line[r - 1] == '\n' || line[r - 1] == '\r')) {
+			line[--r] = '\0';
+		}
+
+		if (r == 0) {
+			continue;
+		}
+
+		verify_add_signature(sigs, nsigs, sigs_sz, strdup(line));
+	}
+
+	free(line);
+	if (f != stdin) {
+		fclose(f);
+	}
+
+	return (true);
+}
+
 int
 cli_verify(int argc, char **argv)
 {
 	asignify_verify_t *vrf;
-	const char *pubkeyfile = NULL, *sigfile = NULL;
+	struct asignify_verify_result *results;
+	const char *pubkeyfile = NULL, *list_file = NULL, **sigs = NULL;
+	size_t nsigs = 0, sigs_sz = 0, i, valid, nlisted = 0;
+	unsigned int nthreads = 0;
+	size_t max_memory = 0;
+	int ch, ret = 1;
+	static struct option long_options[] = {
+		{"threads", required_argument, 0,  'j' },
+		{"list", required_argument, 0,  'l' },
+		{"max-memory", required_argument, 0, 'M' },
+		{0,         0,                 0,  0 }
+	};
 
-	if (argc != 3) {
+	while ((ch = getopt_long(argc, argv, "j:l:", long_options, NULL)) != -1) {
+		switch (ch) {
+		case 'j':
+			nthreads = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			list_file = optarg;
+			break;
+		case 'M':
+			max_memory = parse_size(optarg);
+			break;
+		default:
+			return (0);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1 || (argc < 2 && list_file == NULL)) {
 		return (0);
 	}
 
-	/* Argv[0] == "verify" */
-	pubkeyfile = argv[1];
-	sigfile = argv[2];
+	pubkeyfile = argv[0];
+
+	for (i = 1; i < (size_t)argc; i ++) {
+		verify_add_signature(&sigs, &nsigs, &sigs_sz, argv[i]);
+	}
+
+	if (list_file != NULL) {
+		if (!verify_load_list(list_file, &sigs, &nsigs, &sigs_sz)) {
+			fprintf(stderr, "cannot read list %s: %s\n", list_file,
+				strerror(errno));
+			free(sigs);
+			return (-1);
+		}
+
+		nlisted = nsigs - (argc - 1);
+	}
 
 	vrf = asignify_verify_init();
-	if (!asignify_verify_load_pubkey(vrf, pubkeyfile)) {
+	asignify_verify_set_limits(vrf, max_memory, 0, 0);
+	if (!cli_load_pubkey(vrf, pubkeyfile)) {
 		fprintf(stderr, "cannot load pubkey %s: %s\n", pubkeyfile,
 			asignify_verify_get_error(vrf));
-		asignify_verify_free(vrf);
-		return (-1);
+		ret = -1;
+		goto cleanup;
 	}
 
-	if (!asignify_verify_load_signature(vrf, sigfile)) {
-		fprintf(stderr, "cannot verify signature %s: %s\n", sigfile,
-			asignify_verify_get_error(vrf));
-		asignify_verify_free(vrf);
-		return (-1);
+	/* The key is loaded once, signatures are checked by a pool of threads */
+	results = calloc(nsigs, sizeof(*results));
+
+	if (nsigs > 0 && results == NULL) {
+		err(1, "calloc");
 	}
-	else if (!quiet) {
-		printf("validated signature in %s\n", sigfile);
+
+	valid = asignify_verify_signatures(vrf, sigs, nsigs, nthreads, results);
+
+	for (i = 0; i < nsigs; i ++) {
+		if (results[i].error != NULL) {
+			fprintf(stderr, "cannot verify signature %s: %s\n", sigs[i],
+				results[i].error);
+		}
+		else if (!quiet) {
+			printf("validated signature in %s\n", sigs[i]);
+		}
+	}
+
+	if (valid != nsigs) {
+		ret = -1;
 	}
 
+	free(results);
+
+cleanup:
 	asignify_verify_free(vrf);
 
-	return (1);
+	/* Listed names are allocated after the arguments */
+	for (i = nsigs - nlisted; i < nsigs; i ++) {
+		free((void *)sigs[i]);
+	}
+	free(sigs);
+
+	return (ret);
 }
 
 const char *
@@ -96,34 +285,283 @@ cli_check_help(bool full)
 {
 	const char *fullmsg = ""
 	"asignify [global_opts] check - verifies signature and check external files validtiy\n\n"
-	"Usage: asignify check <pubkey> <signature> <file>...\n"
+	"Usage: asignify check [-fz] [-o <order>] [-p <list>] [--digest-policy=<policy>]\n"
+	"\t[--accept=<attestation> --accept-key=<verifierpub>]\n"
+	"\t[--attest=<attestation> --attest-key=<verifierkey>]\n"
+	"\t[--max-memory=<size>] [--max-entries=<n>] [--max-path=<n>] <pubkey> <signature> <file>...\n"
+	"\t-f            Stop on the first file that fails verification\n"
+	"\t-o            Order of checks: given (default), smallest-first, largest-first\n"
+	"\t-p            File listing names (one per line) to be checked first\n"
+	"\t-z            Check file.gz or file.zst against digests of file (decompressing it in memory)\n"
+	"\t--digest-policy  Digests to check: all (default), fastest, prefer:<digest>\n"
+	"\t--accept      Do not hash files that are unchanged since they were checked for attestation\n"
+	"\t--accept-key  Public key of the verifier that has signed attestation\n"
+	"\t--attest      Write attestation of valid files signed by verifierkey\n"
+	"\t--attest-key  Secret key of this verifier\n"
+	"\t--max-memory  Memory for the signature and its digests (suffixes k and m are accepted)\n"
+	"\t--max-entries Maximum number of digest lines in the signature\n"
+	"\t--max-path    Maximum length of a file name in the signature\n"
 	"\tpubkey        Path to a public key file to check signature against\n"
+	"\t              or @builtin to use compiled in trust anchors\n"
 	"\tsignature     Path to signature file to check\n"
 	"\tfile          A file that is recorded in the signature digests\n";
 
 	if (!full) {
-		return ("check pubkey signature file [file...]");
+		return ("check [-fz] [-o order] [-p list] [--digest-policy=policy]\n"
+			"\t\t[--accept=att --accept-key=pubkey] [--attest=att --attest-key=seckey]\n"
+			"\t\t[--max-memory=size] [--max-entries=n] [--max-path=n]\n"
+			"\t\tpubkey signature file [file...]");
 	}
 
 	return (fullmsg);
 }
 
+enum check_order {
+	CHECK_ORDER_GIVEN = 0,
+	CHECK_ORDER_SMALLEST,
+	CHECK_ORDER_LARGEST
+};
+
+struct check_item {
+	const char *fname;
+	off_t size;
+	unsigned int prio;
+	unsigned int idx;
+};
+
+static enum check_order check_order;
+
+static int
+check_item_cmp(const void *a, const void *b)
+{
+	const struct check_item *i1 = a, *i2 = b;
+
+	if (i1->prio != i2->prio) {
+		return (i1->prio < i2->prio ? -1 : 1);
+	}
+
+	if (i1->size != i2->size) {
+		if (check_order == CHECK_ORDER_SMALLEST) {
+			return (i1->size < i2->size ? -1 : 1);
+		}
+		else if (check_order == CHECK_ORDER_LARGEST) {
+			return (i1->size > i2->size ? -1 : 1);
+		}
+	}
+
+	/* Keep command line order otherwise */
+	return (i1->idx < i2->idx ? -1 : (i1->idx > i2->idx));
+}
+
+static int
+check_name_cmp(const void *a, const void *b)
+{
+	const struct check_item *i1 = a, *i2 = b;
+
+	return (strcmp(i1->fname, i2->fname));
+}
+
+/*
+ * Assigns priorities to files listed in prio_file (earlier lines first),
+ * files that are not listed are checked after all listed ones
+ */
+static bool
+check_load_priorities(const char *prio_file, struct check_item *items,
+	unsigned int nitems)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t linelen = 0;
+	ssize_t r;
+	unsigned int nprio = 0, i;
+	struct check_item *prio = NULL, *found, key;
+	size_t prio_sz = 0;
+
+	if (strcmp(prio_file, "-") == 0) {
+		f = stdin;
+	}
+	else if ((f = fopen(prio_file, "r")) == NULL) {
+		return (false);
+	}
+
+	while ((r = getline(&line, &linelen, f)) > 0) {
+		while (r > 0 && (line[r - 1] == '\n' || line[r - 1] == '\r')) {
+			line[--r] = '\0';
+		}
+
+		if (r == 0) {
+			continue;
+		}
+
+		if (nprio == prio_sz) {
+			prio_sz = prio_sz ? prio_sz * 2 : 64;
+			prio = realloc(prio, prio_sz * sizeof(*prio));
+
+			if (prio == NULL) {
+				err(1, "realloc");
+			}
+		}
+
+		prio[nprio].fname = strdup(line);
+		prio[nprio].prio = nprio;
+		nprio ++;
+	}
+
+	free(line);
+	if (f != stdin) {
+		fclose(f);
+	}
+
+	qsort(prio, nprio, sizeof(*prio), check_name_cmp);
+
+	for (i = 0; i < nitems; i ++) {
+		key.fname = items[i].fname;
+		found = bsearch(&key, prio, nprio, sizeof(*prio), check_name_cmp);
+		items[i].prio = found ? found->prio : UINT_MAX;
+	}
+
+	for (i = 0; i < nprio; i ++) {
+		free((void *)prio[i].fname);
+	}
+	free(prio);
+
+	return (true);
+}
+
 int
 cli_check(int argc, char **argv)
 {
 	asignify_verify_t *vrf;
-	const char *pubkeyfile = NULL, *sigfile = NULL;
-	int i, ret = 1;
+#ifndef ASIGNIFY_VERIFY_ONLY
+	asignify_sign_t *sgn = NULL;
+#endif
+	struct asignify_verify_result res;
+	const char *pubkeyfile = NULL, *sigfile = NULL, *prio_file = NULL;
+	const char *accept = NULL, *accept_key = NULL;
+	const char *attest = NULL, *attest_key = NULL;
+	int i, ch, ret = 1;
+	unsigned int nitems, checked = 0;
+	bool fail_fast = false, decompress = false;
+	size_t max_memory = 0;
+	unsigned int max_entries = 0, max_path = 0;
+	enum asignify_digest_policy policy = ASIGNIFY_DIGEST_POLICY_ALL;
+	enum asignify_digest_type prefer = ASIGNIFY_DIGEST_SIZE;
+	struct check_item *items;
+	struct stat st;
+	static struct option long_options[] = {
+		{"fail-fast", no_argument,       0,  'f' },
+		{"order",     required_argument, 0,  'o' },
+		{"priority",  required_argument, 0,  'p' },
+		{"decompress", no_argument,      0,  'z' },
+		{"digest-policy", required_argument, 0, 'D' },
+		{"accept",    required_argument, 0,  'A' },
+		{"accept-key", required_argument, 0, 'B' },
+		{"attest",    required_argument, 0,  'T' },
+		{"attest-key", required_argument, 0, 'K' },
+		{"max-memory", required_argument, 0, 'M' },
+		{"max-entries", required_argument, 0, 'E' },
+		{"max-path",  required_argument, 0,  'L' },
+		{0,         0,                 0,  0 }
+	};
 
-	if (argc < 4) {
+	check_order = CHECK_ORDER_GIVEN;
+
+	while ((ch = getopt_long(argc, argv, "fo:p:z", long_options, NULL)) != -1) {
+		switch (ch) {
+		case 'f':
+			fail_fast = true;
+			break;
+		case 'o':
+			if (strcmp(optarg, "given") == 0) {
+				check_order = CHECK_ORDER_GIVEN;
+			}
+			else if (strcmp(optarg, "smallest-first") == 0) {
+				check_order = CHECK_ORDER_SMALLEST;
+			}
+			else if (strcmp(optarg, "largest-first") == 0) {
+				check_order = CHECK_ORDER_LARGEST;
+			}
+			else {
+				fprintf(stderr, "bad check order: %s\n", optarg);
+				return (0);
+			}
+			break;
+		case 'p':
+			prio_file = optarg;
+			break;
+		case 'z':
+			decompress = true;
+			break;
+		case 'D':
+			if (strcmp(optarg, "all") == 0) {
+				policy = ASIGNIFY_DIGEST_POLICY_ALL;
+			}
+			else if (strcmp(optarg, "fastest") == 0) {
+				policy = ASIGNIFY_DIGEST_POLICY_FASTEST;
+			}
+			else if (strncmp(optarg, "prefer:", sizeof("prefer:") - 1) == 0) {
+				policy = ASIGNIFY_DIGEST_POLICY_PREFER;
+				optarg += sizeof("prefer:") - 1;
+				prefer = asignify_digest_from_str(optarg, strlen(optarg));
+
+				if (prefer >= ASIGNIFY_DIGEST_SIZE) {
+					fprintf(stderr, "bad digest type: %s\n", optarg);
+					return (0);
+				}
+			}
+			else {
+				fprintf(stderr, "bad digest policy: %s\n", optarg);
+				return (0);
+			}
+			break;
+		case 'A':
+			accept = optarg;
+			break;
+		case 'B':
+			accept_key = optarg;
+			break;
+		case 'T':
+			attest = optarg;
+			break;
+		case 'K':
+			attest_key = optarg;
+			break;
+		case 'M':
+			max_memory = parse_size(optarg);
+			break;
+		case 'E':
+			if (!cli_parse_limit(optarg, &max_entries)) {
+				fprintf(stderr, "bad entries limit: %s\n", optarg);
+				return (0);
+			}
+			break;
+		case 'L':
+			if (!cli_parse_limit(optarg, &max_path)) {
+				fprintf(stderr, "bad path limit: %s\n", optarg);
+				return (0);
+			}
+			break;
+		default:
+			return (0);
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 3 || (accept == NULL) != (accept_key == NULL) ||
+			(attest == NULL) != (attest_key == NULL)) {
 		return (0);
 	}
 
-	pubkeyfile = argv[1];
-	sigfile = argv[2];
+	pubkeyfile = argv[0];
+	sigfile = argv[1];
 
 	vrf = asignify_verify_init();
-	if (!asignify_verify_load_pubkey(vrf, pubkeyfile)) {
+	asignify_verify_set_decompress(vrf, decompress);
+	asignify_verify_set_digest_policy(vrf, policy, prefer);
+	asignify_verify_set_limits(vrf, max_memory, max_entries, max_path);
+	if (!cli_load_pubkey(vrf, pubkeyfile)) {
 		fprintf(stderr, "cannot load pubkey %s: %s\n", pubkeyfile,
 			asignify_verify_get_error(vrf));
 		asignify_verify_free(vrf);
@@ -140,18 +578,245 @@ cli_check(int argc, char **argv)
 		printf("validated signature in %s\n", sigfile);
 	}
 
-	for (i = 3; i < argc; i ++) {
-		if (!asignify_verify_file(vrf, argv[i])) {
-			fprintf(stderr, "verification failed for %s: %s\n", argv[i],
-				asignify_verify_get_error(vrf));
+	/* Stale attestations are not fatal: files are just hashed again */
+	if (accept != NULL && !asignify_verify_load_attestation(vrf, accept_key,
+			accept)) {
+		fprintf(stderr, "cannot load attestation %s: %s\n", accept,
+			asignify_verify_get_error(vrf));
+	}
+
+	if (attest != NULL) {
+#ifndef ASIGNIFY_VERIFY_ONLY
+		sgn = asignify_sign_init();
+
+		if (!asignify_sign_load_privkey(sgn, attest_key, read_password, NULL)) {
+			fprintf(stderr, "cannot load private key %s: %s\n", attest_key,
+				asignify_sign_get_error(sgn));
+			asignify_sign_free(sgn);
+			asignify_verify_free(vrf);
+			return (-1);
+		}
+#else
+		fprintf(stderr, "attestations cannot be made by verify-only builds\n");
+		asignify_verify_free(vrf);
+		return (-1);
+#endif
+	}
+
+	nitems = argc - 2;
+	items = calloc(nitems, sizeof(*items));
+
+	if (items == NULL) {
+		err(1, "calloc");
+	}
+
+	for (i = 0; i < (int)nitems; i ++) {
+		items[i].fname = argv[i + 2];
+		items[i].idx = i;
+
+		/* Files that cannot be stat'ed are treated as empty ones */
+		if (check_order != CHECK_ORDER_GIVEN &&
+				stat(items[i].fname, &st) != -1) {
+			items[i].size = st.st_size;
+		}
+	}
+
+	if (prio_file != NULL &&
+			!check_load_priorities(prio_file, items, nitems)) {
+		fprintf(stderr, "cannot read priority list %s: %s\n", prio_file,
+			strerror(errno));
+		free(items);
+		asignify_verify_free(vrf);
+		return (-1);
+	}
+
+	if (prio_file != NULL || check_order != CHECK_ORDER_GIVEN) {
+		qsort(items, nitems, sizeof(*items), check_item_cmp);
+	}
+
+	for (i = 0; i < (int)nitems; i ++) {
+		checked ++;
+
+		if (!asignify_verify_file_r(vrf, items[i].fname, &res)) {
+			fprintf(stderr, "verification failed for %s: %s\n", items[i].fname,
+				res.error);
 			ret = -1;
+
+			if (fail_fast) {
+				break;
+			}
+
+			continue;
 		}
 		else if (!quiet) {
-			printf("file %s has been verified\n", argv[i]);
+			printf("file %s has been %s\n", items[i].fname,
+				res.attested ? "accepted by attestation" : "verified");
+		}
+
+#ifndef ASIGNIFY_VERIFY_ONLY
+		if (sgn != NULL && res.has_id &&
+				!asignify_sign_attest_file(sgn, items[i].fname, &res.id)) {
+			fprintf(stderr, "cannot attest %s: %s\n", items[i].fname,
+				asignify_sign_get_error(sgn));
+		}
+#endif
+	}
+
+	if (checked < nitems && !quiet) {
+		printf("%u files have not been checked\n", nitems - checked);
+	}
+
+#ifndef ASIGNIFY_VERIFY_ONLY
+	if (sgn != NULL) {
+		const unsigned char *sigdigest;
+		size_t dlen;
+
+		sigdigest = asignify_verify_get_signatures_digest(vrf, &dlen);
+
+		if (!asignify_sign_write_attestation(sgn, attest, sigdigest, dlen)) {
+			fprintf(stderr, "cannot write attestation %s: %s\n", attest,
+				asignify_sign_get_error(sgn));
+			ret = -1;
 		}
+
+		asignify_sign_free(sgn);
 	}
+#endif
 
+	free(items);
 	asignify_verify_free(vrf);
 
 	return (ret);
 }
+
+const char *
+cli_log_verify_help(bool full)
+{
+	const char *fullmsg = ""
+	"asignify [global_opts] log-verify - verifies a signed tree head of an append-only log\n\n"
+	"Usage: asignify log-verify [--prev=<oldhead>] <pubkey> <head> <log>\n"
+	"\t--prev        Check that head extends oldhead reading only data appended since it\n"
+	"\tpubkey        Path to a public key file to check signature against\n"
+	"\t              or @builtin to use compiled in trust anchors\n"
+	"\thead          Path to tree head file to check\n"
+	"\tlog           Log file named in the head\n";
+
+	if (!full) {
+		return ("log-verify [--prev=oldhead] pubkey head log");
+	}
+
+	return (fullmsg);
+}
+
+int
+cli_log_verify(int argc, char **argv)
+{
+	asignify_verify_t *vrf;
+	const char *pubkeyfile, *headfile, *logfile, *prev = NULL;
+	int ch;
+	static struct option long_options[] = {
+		{"prev", required_argument, 0,  'P' },
+		{0,         0,                 0,  0 }
+	};
+
+	while ((ch = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (ch) {
+		case 'P':
+			prev = optarg;
+			break;
+		default:
+			return (0);
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 3) {
+		return (0);
+	}
+
+	pubkeyfile = argv[0];
+	headfile = argv[1];
+	logfile = argv[2];
+
+	vrf = asignify_verify_init();
+	if (!cli_load_pubkey(vrf, pubkeyfile)) {
+		fprintf(stderr, "cannot load pubkey %s: %s\n", pubkeyfile,
+			asignify_verify_get_error(vrf));
+		asignify_verify_free(vrf);
+		return (-1);
+	}
+
+	if (!asignify_verify_log(vrf, logfile, headfile, prev)) {
+		fprintf(stderr, "verification failed for %s: %s\n", logfile,
+			asignify_verify_get_error(vrf));
+		asignify_verify_free(vrf);
+		return (-1);
+	}
+	else if (!quiet) {
+		printf("log %s has been verified against %s\n", logfile, headfile);
+	}
+
+	asignify_verify_free(vrf);
+
+	return (1);
+}
+
+const char *
+cli_delta_apply_help(bool full)
+{
+	const char *fullmsg = ""
+	"asignify [global_opts] delta-apply - applies a signed delta to a local signature\n\n"
+	"Usage: asignify delta-apply <pubkey> <base> <delta> <target>\n"
+	"\tpubkey        Path to a public key file to check delta signature against\n"
+	"\t              or @builtin to use compiled in trust anchors\n"
+	"\tbase          Local copy of the signature the delta has been made for\n"
+	"\tdelta         Path to delta file\n"
+	"\ttarget        Path to signature file to write (may be the same as base)\n";
+
+	if (!full) {
+		return ("delta-apply pubkey base delta target");
+	}
+
+	return (fullmsg);
+}
+
+int
+cli_delta_apply(int argc, char **argv)
+{
+	asignify_verify_t *vrf;
+	const char *pubkeyfile, *basefile, *deltafile, *targetfile;
+
+	if (argc != 5) {
+		return (0);
+	}
+
+	pubkeyfile = argv[1];
+	basefile = argv[2];
+	deltafile = argv[3];
+	targetfile = argv[4];
+
+	vrf = asignify_verify_init();
+	if (!cli_load_pubkey(vrf, pubkeyfile)) {
+		fprintf(stderr, "cannot load pubkey %s: %s\n", pubkeyfile,
+			asignify_verify_get_error(vrf));
+		asignify_verify_free(vrf);
+		return (-1);
+	}
+
+	if (!asignify_verify_apply_delta(vrf, basefile, deltafile, targetfile)) {
+		fprintf(stderr, "cannot apply delta %s to %s: %s\n", deltafile,
+			basefile, asignify_verify_get_error(vrf));
+		asignify_verify_free(vrf);
+		return (-1);
+	}
+	else if (!quiet) {
+		printf("delta %s has been applied to %s, target is written to %s\n",
+			deltafile, basefile, targetfile);
+	}
+
+	asignify_verify_free(vrf);
+
+	return (1);
+}